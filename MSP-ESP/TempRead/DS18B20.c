@@ -23,6 +23,8 @@ unsigned char OneWireInByte();
 void OneWireOutByte(unsigned char data);
 unsigned char OneWireReset();
 
+static unsigned char resolution = 12;   // bits, the power up default
+
 unsigned char DS18B20_init()
 {
 	DirectionPort &= ~DS18B20_Pin;  // Clear the direction pin
@@ -31,8 +33,54 @@ unsigned char DS18B20_init()
     // Give time for the power to the peripheral to stabalise
     __delay_cycles(1000 * CPU_MHz);
     return OneWireReset();
-    // Note: not setting the config register,
-    // therefore the default startup of 12bit resolution is used.
+    // Note: not setting the config register here,
+    // use DS18B20_setResolution() for other than the default 12 bits.
+}
+
+// 9 to 12 bits. The EEPROM is only written when the setting changes.
+void DS18B20_setResolution(unsigned char bits)
+{
+    unsigned char th, tl, config;
+
+    if (bits < 9 || bits > 12)
+        return;
+    resolution = bits;
+    config = ((bits - 9) << 5) | 0x1f;
+
+    OneWireReset();
+    OneWireOutByte(0xcc);  // Skip ROM command
+    OneWireOutByte(0xbe);  // Read Scratchpad command
+    OneWireInByte();       // temperature
+    OneWireInByte();
+    th = OneWireInByte();  // alarm registers, kept as they are
+    tl = OneWireInByte();
+    if (OneWireInByte() == config)
+    {
+        OneWireReset();    // end the read
+        return;
+    }
+
+    OneWireReset();
+    OneWireOutByte(0xcc);  // Skip ROM command
+    OneWireOutByte(0x4e);  // Write Scratchpad command: TH, TL, config
+    OneWireOutByte(th);
+    OneWireOutByte(tl);
+    OneWireOutByte(config);
+
+    OneWireReset();
+    OneWireOutByte(0xcc);  // Skip ROM command
+    OneWireOutByte(0x48);  // Copy Scratchpad command, keep it in EEPROM
+    __delay_cycles(10000 * CPU_MHz);    // 10ms EEPROM write
+}
+
+// Wait out a conversion at the current resolution:
+// 93.75, 187.5, 375 or 750ms.
+void DS18B20_waitConversion()
+{
+    unsigned int ms = (750 >> (12 - resolution)) + 1;
+
+    while (ms--)
+        __delay_cycles(1000 * CPU_MHz);
 }
 
 void DS18B20_initiateConversion()
@@ -56,6 +104,7 @@ short DS18B20_GetCurrentTempX100()
     LowByte = OneWireInByte();
     HighByte = OneWireInByte();
     TReading = (HighByte << 8) + LowByte;
+    TReading &= ~((1 << (12 - resolution)) - 1);    // low bits undefined below 12 bits
 
     if (TReading & 0x8000) // negative
     {
@@ -4,6 +4,8 @@
 // Public function prototypes
 unsigned char DS18B20_init();
 void DS18B20_initiateConversion();
+void DS18B20_setResolution(unsigned char bits);
+void DS18B20_waitConversion();
 short DS18B20_GetCurrentTempX100();
 
 short DS18B20_GetCurrentTempQ8_7();
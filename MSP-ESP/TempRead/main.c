@@ -6,6 +6,8 @@
 #include <msp430.h>				
 #include "DS18B20.h"
 
+#define RESOLUTION	12	// bits, 9 to 12
+
 volatile short temp;
 
 int main(void) {
@@ -19,12 +21,13 @@ int main(void) {
 	{
 		while(1);
 	}
+	DS18B20_setResolution(RESOLUTION);
 
 	for(;;)
 	{
 		DS18B20_initiateConversion();
 
-		__delay_cycles(750000*8);
+		DS18B20_waitConversion();
 
 		temp = DS18B20_GetCurrentTempX100();
 
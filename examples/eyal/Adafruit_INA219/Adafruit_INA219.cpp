@@ -509,6 +509,42 @@ void Adafruit_INA219::reCalibrate() {		// EL added
   reCalibrate_raw();
 }
 
+/*!
+ *  @brief  Sets the shunt ADC resolution and averaging, which is also
+ *          the conversion time. EL added.
+ *  @param  sadcres
+ *          one of INA219_CONFIG_SADCRES_*
+ */
+void Adafruit_INA219::setShuntADC(uint16_t sadcres) {
+  uint16_t config;
+  wireReadRegister(INA219_REG_CONFIG, &config);
+  config = (config & ~INA219_CONFIG_SADCRES_MASK) | sadcres;
+  wireWriteRegister(INA219_REG_CONFIG, config);
+}
+
+/*!
+ *  @brief  Points the chip at a register for readStream_raw(). The chip
+ *          keeps the pointer, so each read is then only the 2 bytes.
+ *          Any other call here moves it, call this again after. EL added.
+ *  @param  reg
+ *          register address
+ */
+void Adafruit_INA219::startStream(uint8_t reg) {
+  _i2c->beginTransmission(ina219_i2caddr);
+  _i2c->write(reg);
+  _i2c->endTransmission();
+}
+
+/*!
+ *  @brief  Reads the register set by startStream(). EL added.
+ *  @return the raw register value
+ */
+int16_t Adafruit_INA219::readStream_raw() {
+  _i2c->requestFrom(ina219_i2caddr, (uint8_t)2);
+  uint16_t value = _i2c->read() << 8;	// in this order
+  return (int16_t)(value | _i2c->read());
+}
+
 /*!
  *  @brief  Gets the power value in mW, taking into account the
  *          config settings and current LSB
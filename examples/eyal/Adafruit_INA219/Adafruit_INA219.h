@@ -142,6 +142,10 @@ public:
   float getCurrentFast_mA();	// EL added
   float getPower_mW();
   void powerSave(bool on);
+  void setShuntADC(uint16_t sadcres);	// EL added
+  void startStream(uint8_t reg);	// EL added
+  int16_t readStream_raw();		// EL added
+  uint32_t getCurrentDivider_mA() { return ina219_currentDivider_mA; }	// EL added
 
 private:
   TwoWire *_i2c;
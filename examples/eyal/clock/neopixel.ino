@@ -1,6 +1,9 @@
 #define fastLED   1
 #define NeoPixel  0
 
+#define FIXED_POINT 1   // 0 for the float renderer
+#define SHOW_FPS    1   // print the frame rate every second
+
 #if NeoPixel
 #include <Adafruit_NeoPixel.h>
 #elif fastLED
@@ -55,10 +58,18 @@ int second;
 int milliSecond;
 long lastTime;
 
+#if SHOW_FPS
+static uint32_t fpsStart;
+static uint32_t fpsFrames;
+static uint32_t fpsRenderUs;
+#endif
+
+#if !FIXED_POINT
 int red;
 int green;
 int blue;
 int ledIndex;
+#endif
 
 void setup()
 {
@@ -77,6 +88,10 @@ void setup()
   FastLED.setBrightness(255);
 #endif
 
+#if FIXED_POINT
+  BuildLuts();
+#endif
+
   minute = 0;
   second = 0;
 }
@@ -89,13 +104,39 @@ void loop()
   }
 
   ProgressInternalTime();
+#if SHOW_FPS
+  uint32_t renderStart = micros();
+#endif
+#if FIXED_POINT
+  FixedHandDisplay();
+#else
   TrailingFadeHandDisplay();
+#endif
+#if SHOW_FPS
+  fpsRenderUs += micros() - renderStart;
+#endif
 
 #if NeoPixel
   leds.show();
 #elif fastLED
   FastLED.show();
 #endif
+
+#if SHOW_FPS
+  ++fpsFrames;
+  uint32_t fpsTime = millis() - fpsStart;
+  if (fpsTime >= 1000)
+  {
+    Serial.print("fps=");
+    Serial.print(fpsFrames * 1000 / fpsTime);
+    Serial.print(" render=");
+    Serial.print(fpsRenderUs / fpsFrames);
+    Serial.println("us");
+    fpsStart += fpsTime;
+    fpsFrames = 0;
+    fpsRenderUs = 0;
+  }
+#endif
 }
 
 void ReadExternalTime()
@@ -164,6 +205,162 @@ void ProgressInternalTime()
   }
 }
 
+int IndexToLed(int ledPosition)
+{
+  return (2 * LedCount - 1 - ledPosition) % LedCount;
+}
+
+#if FIXED_POINT
+/*
+ * The same picture as TrailingFadeHandDisplay() below, without floats.
+ *
+ * Positions are in 1/256 of a LED, brightness is 1/256 (256 is full).
+ * pow() is looked up in tables made in setup(), and only the LEDs under
+ * a hand or a marker are touched. The ones lit in the last frame are
+ * cleared first.
+ */
+
+#define SUB         256                       // a LED, and 1.0
+#define DIAL        ((int32_t)LedCount * SUB)
+#define PERIOD_MS   ((int32_t)(pulsePeriod * 1000))
+#define PULSE_LUT   (32 * 8)                  // 1/8 LED steps, (1-2d)^16 is 0 past 32 LEDs
+#define PERCENT_MAX (SUB + SUB / 4)           // a hand is 1.0 plus a quarter pulse
+#define LEDS(width) ((int)((width) * LedCount + 0.5f))
+
+static uint16_t gammaLut[PERCENT_MAX + 1];    // p^2, as AddColour()
+static uint16_t pulseLut[PULSE_LUT];          // PulsePercent()
+static uint16_t markerLut[SUB + 1];           // PulsingFiveMinuteMarker()
+
+static uint8_t litLeds[LedCount];
+static int litCount;
+
+void BuildLuts()
+{
+  int i;
+
+  for (i = 0; i <= PERCENT_MAX; i++)
+    gammaLut[i] = (uint32_t)i * i / SUB;
+  for (i = 0; i < PULSE_LUT; i++)
+    pulseLut[i] = SUB * pow(1.0f - 2.0f * i / 8 / LedCount, 16.0f) + 0.5f;
+  for (i = 0; i <= SUB; i++)
+    markerLut[i] = SUB * pow(0.5f + 0.5f * i / SUB, 7) + 0.5f;
+}
+
+static uint8_t AddSaturated(uint8_t a, uint32_t b)
+{
+  b += a;
+  return b > 255 ? 255 : b;
+}
+
+void AddLed(int index, int sectionRed, int sectionGreen, int sectionBlue, int percent)
+{
+  if (percent > PERCENT_MAX)
+    percent = PERCENT_MAX;
+  uint32_t p = gammaLut[percent];
+  int ledPosition = IndexToLed(index);
+
+#if NeoPixel
+  uint32_t c = leds.getPixelColor(ledPosition);
+  leds.setPixelColor(ledPosition,
+    AddSaturated(c >> 16, p * sectionRed / SUB),
+    AddSaturated(c >> 8, p * sectionGreen / SUB),
+    AddSaturated(c, p * sectionBlue / SUB));
+#elif fastLED
+  leds[ledPosition].red = AddSaturated(leds[ledPosition].red, p * sectionRed / SUB);
+  leds[ledPosition].green = AddSaturated(leds[ledPosition].green, p * sectionGreen / SUB);
+  leds[ledPosition].blue = AddSaturated(leds[ledPosition].blue, p * sectionBlue / SUB);
+#endif
+
+  litLeds[litCount++] = index;
+}
+
+void ClearLit()
+{
+  while (litCount > 0)
+  {
+    int ledPosition = IndexToLed(litLeds[--litCount]);
+#if NeoPixel
+    leds.setPixelColor(ledPosition, 0);
+#elif fastLED
+    leds[ledPosition] = CRGB::Black;
+#endif
+  }
+}
+
+// 'pulse' is where the pulse is now, anywhere on the dial
+int FixedPulse(int32_t pulse, int32_t ledMin, int32_t ledMax)
+{
+  int32_t d = (pulse - ledMax) % DIAL;   // to within half a dial of ledMax
+  if (d >= DIAL / 2)
+    d -= DIAL;
+  else if (d < -DIAL / 2)
+    d += DIAL;
+  pulse = ledMax + d;
+
+  if (pulse > ledMax)
+    d = pulse - ledMax;
+  else if (pulse < ledMin)
+    d = ledMin - pulse;
+  else
+    return SUB;
+
+  d /= SUB / 8;
+  return d < PULSE_LUT ? pulseLut[d] : 0;
+}
+
+void FixedHand(int32_t sectionEnd, int width, int sectionRed, int sectionGreen, int sectionBlue, int32_t pulse)
+{
+  int32_t sectionStart = sectionEnd - (int32_t)width * SUB;
+  int32_t ledMin = (sectionStart + DIAL) / SUB * SUB - DIAL;    // the LED the tail is in
+
+  for (; ledMin <= sectionEnd; ledMin += SUB)
+  {
+    int32_t ledMax = ledMin + SUB;
+    int percent;
+
+    if (ledMin <= sectionEnd && sectionEnd < ledMax)
+      percent = sectionEnd - ledMin;
+    else if ((sectionStart <= ledMin && ledMax <= sectionEnd) ||  // '<=', as ends now land on LED edges
+             (ledMin < sectionStart && sectionStart < ledMax))
+      percent = SUB - (sectionEnd - ledMax) / width;
+    else
+      continue;
+
+    percent += FixedPulse(pulse, ledMin, ledMax) / 4;
+    AddLed((ledMin + DIAL) / SUB % LedCount, sectionRed, sectionGreen, sectionBlue, percent);
+  }
+}
+
+void FixedHandDisplay()
+{
+  int32_t msInMinute = second * 1000L + milliSecond;
+  int32_t msInHour = minute * 60000L + msInMinute;
+  int32_t msInDial = hour * 3600000L + msInHour;
+
+  int32_t secondEnd = (int64_t)msInMinute * DIAL / 60000L;
+  int32_t minuteEnd = (int64_t)msInHour * DIAL / 3600000L;
+  int32_t hourEnd = (int64_t)msInDial * DIAL / 43200000L;
+
+  // where each pulse is, it goes round the dial once a pulsePeriod
+  int32_t secondPulse = (msInMinute + (int32_t)(SecondPulseOffset * 1000)) % PERIOD_MS * DIAL / PERIOD_MS;
+  int32_t minutePulse = (msInMinute + (int32_t)(MinutePulseOffset * 1000)) % PERIOD_MS * DIAL / PERIOD_MS;
+  int32_t hourPulse = (msInMinute + (int32_t)(HourPulseOffset * 1000)) % PERIOD_MS * DIAL / PERIOD_MS;
+
+  ClearLit();
+
+  FixedHand(secondEnd, LEDS(SecondDisplayWidth), SecondRed, SecondGreen, SecondBlue, secondEnd + secondPulse);
+  FixedHand(minuteEnd, LEDS(MinuteDisplayWidth), MinuteRed, MinuteGreen, MinuteBlue, minuteEnd + minutePulse);
+  FixedHand(hourEnd, LEDS(HourDisplayWidth), HourRed, HourGreen, HourBlue, hourEnd + hourPulse);
+
+  // 0.5 to 1.0 and back, once a pulsePeriod
+  int32_t phase = msInMinute % PERIOD_MS;
+  int marker = markerLut[abs(phase * 2 * SUB / PERIOD_MS - SUB)];
+  for (int i = 0; i < LedCount; i += LedCount / 12)
+    AddLed(i, 0xff, 0xff, 0xff, marker);
+}
+
+#else // !FIXED_POINT
+
 void TrailingFadeHandDisplay()
 {
   float milliSecondEnd = milliSecond / 1000.0f;
@@ -217,11 +414,6 @@ void ApplyColourToLed()
 #endif
 }
 
-int IndexToLed(int ledPosition)
-{
-  return (2 * LedCount - 1 - ledPosition) % LedCount;
-}
-
 void TrailingFadeHandAddColour(float sectionEnd, float sectionWidth, int sectionRed, int sectionGreen, int sectionBlue, float pulseOffset)
 {
   const float LedWidth = 1.0f / LedCount;
@@ -306,4 +498,5 @@ void PulsingFiveMinuteMarker()
     AddColour(0xff, 0xff, 0xff, percent);
   }
 }
-
+
+#endif // FIXED_POINT
@@ -16,6 +16,20 @@ extern bool read_temp(int n, byte addr[][8], float temp[]);
 extern uint32_t time_read;    // us
 extern void show_state(void);
 
+extern void sched_wake(uint32_t time_start);
+extern bool sched_fix(void);
+extern uint32_t sched_sleep_us(void);
+
+/*
+ * A reading from a cycle without WiFi, sent with the next WiFi cycle.
+ * The cycles are SLEEP_MS apart, so runCount also tells the time.
+ */
+struct rtcSample {
+  uint32_t runCount;
+  uint16_t vdd;                 // mv
+  int16_t  temp[rangeof(addr)]; // 1/16 degrees Celcius, as read
+};
+
 /*
  * Change the value of RTC_magic in rtc.cpp when you change this structure
  */
@@ -28,9 +42,36 @@ struct rtcMem {
   uint32_t failRead;      // count
   uint32_t lastTime;      // us
   uint32_t totalTime;     // ms
+  uint8_t  apChannel;     // of the last good connect, 0 = scan
+  uint8_t  apBssid[6];
+  uint32_t apIp;          // the dhcp lease
+  uint32_t apGw;
+  uint32_t apMask;
+  uint32_t apLeaseRun;    // runCount when the lease was bound
+  uint32_t apLeaseS;      // reuse it this long, the lease's T1 (0 = do not)
+  uint8_t  arpValid;      // arpMac was learnt by arp_save()
+  uint8_t  arpMac[6];     // of the server (or gateway), from the last send
+  uint8_t  arpUses;       // cycles since it was learnt, relearnt at ARP_REFRESH
+  int32_t  schedPpm;      // SDK sleep error, learnt
+  uint32_t schedBoot[2];  // us to setup(), without and with RF, learnt
+  uint32_t schedPhase;    // us into the cycle when going to sleep
+  uint32_t schedSleep;    // us asked for
+  uint32_t schedSlept;    // us asked for since the last NTP fix
+  int32_t  schedError;    // us, setup() versus the boundary at the last fix
+  uint8_t  schedFixed;    // had an NTP fix
+  uint8_t  schedMisses;   // NTP requests in a row without a reply
+  uint8_t  schedSkip;     // WiFi cycles left before asking again
+#if RTC_SAMPLES > 0
+  uint16_t nSamples;      // in the ring
+  uint16_t nextSample;    // where the next one goes
+  struct rtcSample samples[RTC_SAMPLES];
+#endif
 };
 extern struct rtcMem rtcMem;
 
+// user RTC memory is 512 bytes from block 64
+static_assert(sizeof(struct rtcMem) <= 512, "struct rtcMem too large for RTC memory");
+
 extern bool rtc_init(void);
 extern void rtc_commit(void);
 
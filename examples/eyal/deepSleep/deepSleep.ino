@@ -6,6 +6,25 @@
 
 #include <WiFiUDP.h>
 
+#ifdef ARP_FAST
+extern "C" {
+  #include <lwip/netif.h>
+  #include <lwip/etharp.h>
+}
+
+#define ARP_FRAME_LEN     42
+static bool               arp_used = false; // the kept MAC was put in
+#endif
+
+#if defined(WIFI_FAST) && defined(WIFI_USE_DHCP)
+extern "C" {
+  #include <lwip/netif.h>
+  #include <lwip/dhcp.h>
+}
+
+static bool               lease_reused = false; // the lease from last time, no DHCP
+#endif
+
 static WiFiUDP            UDP;
 
 static bool               woken_up = true;
@@ -18,6 +37,39 @@ static uint32_t           time_udp_bug; // ms
 ADC_MODE(ADC_VCC);
 static uint16_t           vdd;          // mv
 
+#if DROOP_MS > 0
+// vdd under the radio load, from the WiFi start to the send
+static struct {
+  uint32_t start;                       // us
+  uint32_t min_time;                    // us since start
+  uint32_t sum;                         // mv
+  uint16_t min;                         // mv
+  uint16_t n;
+} droop;
+static os_timer_t         droop_timer;
+
+static void
+droop_sample(void *arg)
+{
+  uint16_t v = system_get_vdd33();
+
+  if (0 == droop.n || v < droop.min) {
+    droop.min = v;
+    droop.min_time = micros() - droop.start;
+  }
+  droop.sum += v;
+  ++droop.n;
+}
+
+static void
+droop_start(void)
+{
+  droop.start = micros();
+  os_timer_setfn(&droop_timer, droop_sample, NULL);
+  os_timer_arm(&droop_timer, DROOP_MS, true);
+}
+#endif
+
 static float              temp[rangeof(addr)]; // degrees Celcius
 static bool               wifing = false;
 
@@ -87,10 +139,34 @@ mark_end()
   digitalWrite(TIME_PIN, LOW);
 }
 
+#if defined(WIFI_FAST) && defined(WIFI_USE_DHCP)
+// The cycles are SLEEP_MS apart, so runCount tells the lease's age
+static bool
+lease_good(void)
+{
+  return (uint64_t)(rtcMem.runCount - rtcMem.apLeaseRun) * SLEEP_MS
+    < (uint64_t)rtcMem.apLeaseS * 1000;
+}
+
+// the renewal time of the lease just bound, 0 if unknown
+static uint32_t
+lease_t1(void)
+{
+  struct dhcp *dhcp;
+
+  if (NULL == netif_default || NULL == (dhcp = netif_dhcp_data(netif_default)))
+    return 0;
+  return dhcp->offered_t1_renew;
+}
+#endif
+
 static bool
 set_up_wifi(void)
 {
   time_wifi = micros();
+#if DROOP_MS > 0
+  droop_start();
+#endif
 
 #ifdef SERIAL_CHATTY
 Serial.print("before set_up_wifi ssid='");
@@ -102,6 +178,12 @@ Serial.println(ip);
 #endif
 
 #ifdef WIFI_SSID
+#ifdef WIFI_FAST
+  if (rtcMem.apChannel) {
+    WiFi.persistent(false);       // do not write the flash every wake
+    WiFi.begin(WIFI_SSID, WIFI_PASSWORD, rtcMem.apChannel, rtcMem.apBssid);
+  } else
+#endif
   if (WiFi.SSID() != WIFI_SSID) {
     WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
 //    if (!WiFi.getAutoConnect()) {
@@ -111,7 +193,14 @@ Serial.println(ip);
   }
 #endif
 
-#ifndef WIFI_USE_DHCP
+#ifdef WIFI_USE_DHCP
+#ifdef WIFI_FAST
+  if (rtcMem.apChannel && rtcMem.apIp && lease_good()) { // the lease from last time, until T1
+    lease_reused = true;
+    WiFi.config(IPAddress(rtcMem.apIp), IPAddress(rtcMem.apGw), IPAddress(rtcMem.apMask));
+  }
+#endif
+#else
   if (WiFi.localIP() != ip)
     WiFi.config(ip, gw, dns);     // set static IP
   if (WiFi.hostname() != HOSTNAME)
@@ -143,6 +232,21 @@ wait_for_wifi(void)
       Serial.print(wstatus);
       old_wstatus = wstatus;
     }
+#ifdef WIFI_FAST
+    if (rtcMem.apChannel &&
+        (WL_NO_SSID_AVAIL == wstatus || WL_CONNECT_FAILED == wstatus ||
+         WIFI_TIMEOUT_MS - timeout >= WIFI_FAST_MS)) {
+      Serial.print(" scan ");
+      rtcMem.apChannel = 0;         // forget it and scan
+      rtcMem.arpValid = 0;          // a new network maybe
+      ++rtcMem.failSoft;
+#ifdef WIFI_USE_DHCP
+      lease_reused = false;
+      WiFi.config(IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0), IPAddress(0, 0, 0, 0));
+#endif
+      WiFi.begin(WIFI_SSID, WIFI_PASSWORD);
+    }
+#endif
     toggle();
     delay(WIFI_WAIT_MS);
     if ((timeout -= WIFI_WAIT_MS) <= 0) {
@@ -153,6 +257,20 @@ wait_for_wifi(void)
   }
   time_wifi = micros() - time_wifi;
   digitalWrite(TIME_PIN, LOW);
+
+#ifdef WIFI_FAST
+  rtcMem.apChannel = WiFi.channel();
+  memcpy(rtcMem.apBssid, WiFi.BSSID(), sizeof(rtcMem.apBssid));
+  rtcMem.apIp   = WiFi.localIP();
+  rtcMem.apGw   = WiFi.gatewayIP();
+  rtcMem.apMask = WiFi.subnetMask();
+#ifdef WIFI_USE_DHCP
+  if (!lease_reused) {              // a new lease, its clock starts now
+    rtcMem.apLeaseRun = rtcMem.runCount;
+    rtcMem.apLeaseS   = lease_t1();
+  }
+#endif
+#endif
   Serial.print(wstatus);
   Serial.print(" time_wifi=");
   Serial.println(time_wifi);
@@ -167,6 +285,88 @@ wait_for_wifi(void)
   return true;
 }
 
+#ifdef ARP_FAST
+// where the server is reached through
+static struct netif *
+next_hop(ip4_addr_t *hop)
+{
+  struct netif *netif = netif_default;
+  IPAddress server;
+
+  if (NULL == netif || !server.fromString(WIFI_SERVER))
+    return NULL;
+  hop->addr = (uint32_t)server;
+  if (!ip4_addr_netcmp(hop, netif_ip4_addr(netif), netif_ip4_netmask(netif)))
+    ip4_addr_copy(*hop, *netif_ip4_gw(netif));
+  return netif;
+}
+
+/* lwIP has no static ARP entries here, so the reply the server gave last
+ * time is made up and fed in as if it had just arrived. When this does
+ * not take, lwIP ARPs as usual.
+ */
+static void
+arp_restore(void)
+{
+  struct netif *netif;
+  ip4_addr_t hop;
+  const ip4_addr_t *ip;
+  struct eth_addr *eth;
+  struct pbuf *p;
+  uint8_t *f;
+
+  if (!rtcMem.arpValid || rtcMem.arpUses >= ARP_REFRESH)
+    return;
+  if (NULL == (netif = next_hop(&hop)) || NULL == netif->input)
+    return;
+  if (NULL == (p = pbuf_alloc(PBUF_RAW, ARP_FRAME_LEN, PBUF_RAM)))
+    return;
+
+  f = (uint8_t *)p->payload;
+  memcpy(f+0, netif->hwaddr, 6);      // ethernet, to us
+  memcpy(f+6, rtcMem.arpMac, 6);      // from the server
+  f[12] = 0x08; f[13] = 0x06;         // ARP
+  f[14] = 0x00; f[15] = 0x01;         // hardware ethernet
+  f[16] = 0x08; f[17] = 0x00;         // protocol IPv4
+  f[18] = 6;    f[19] = 4;
+  f[20] = 0x00; f[21] = 0x02;         // reply
+  memcpy(f+22, rtcMem.arpMac, 6);
+  memcpy(f+28, &hop, 4);
+  memcpy(f+32, netif->hwaddr, 6);
+  memcpy(f+38, netif_ip4_addr(netif), 4);
+  if (ERR_OK != netif->input(p, netif))
+    pbuf_free(p);
+
+  arp_used = etharp_find_addr(netif, &hop, &eth, &ip) >= 0;
+#ifdef SERIAL_CHATTY
+  Serial.println(arp_used ? " ARP entry put in" : " ARP entry not taken");
+#endif
+}
+
+// after the send, keep the MAC ARP found for the next cycles
+static void
+arp_save(void)
+{
+  struct netif *netif;
+  ip4_addr_t hop;
+  const ip4_addr_t *ip;
+  struct eth_addr *eth;
+
+  if (arp_used) {
+    ++rtcMem.arpUses;
+    return;
+  }
+  if (NULL == (netif = next_hop(&hop)) || etharp_find_addr(netif, &hop, &eth, &ip) < 0)
+    return;
+  memcpy(rtcMem.arpMac, eth->addr, sizeof(rtcMem.arpMac));
+  rtcMem.arpValid = 1;
+  rtcMem.arpUses = 0;
+}
+#else
+#define arp_restore()
+#define arp_save()
+#endif
+
 static bool
 send_udp(char *message)
 {
@@ -178,6 +378,28 @@ send_udp(char *message)
   return true;
 }
 
+#if RTC_SAMPLES > 0
+/* keep this cycle's reading for the next WiFi cycle, the oldest
+ * reading is dropped when the ring is full
+ */
+static void
+save_sample(void)
+{
+  struct rtcSample *s = &rtcMem.samples[rtcMem.nextSample];
+
+  s->runCount = rtcMem.runCount;
+  s->vdd = vdd;
+  for (int i = 0; i < rangeof(temp); ++i)
+    s->temp[i] = (int16_t)(temp[i]*16);
+
+  rtcMem.nextSample = (rtcMem.nextSample + 1) % RTC_SAMPLES;
+  if (rtcMem.nSamples < RTC_SAMPLES)
+    ++rtcMem.nSamples;
+}
+#else
+#define save_sample()
+#endif
+
 #define CHECK \
 do { \
   if (n < 0 || n >= l) return false; \
@@ -195,13 +417,41 @@ do { \
   CHECK; \
 } while (0)
   
+#define MSG_HEAD_LEN      (240 + rangeof(addr)*10)
+#define MSG_SAMPLE_LEN    (20 + rangeof(addr)*10) // ";runCount,vdd,temp..."
+
+#if RTC_SAMPLES > 0
+// one batched sample, false (and nothing added) if it does not fit
+static bool
+format_sample(char **pp, unsigned int *pl, struct rtcSample *s, bool first)
+{
+  char *p = *pp;
+  unsigned int l = *pl;
+  int n;
+
+  PRINT ("%s%lu", (first ? " batch=" : ";"), s->runCount);
+  SHOW (",", 3, s->vdd);
+  for (int k = 0; k < rangeof(temp); ++k)
+    SHOW (",", 4, (long)s->temp[k]*625);    // 1/16 = 0.0625
+
+  *pp = p;
+  *pl = l;
+  return true;
+}
+#endif
+
+/* 'nbatch' is set to the number of saved samples included, oldest first.
+ * Those that do not fit stay for the next WiFi cycle.
+ */
 static bool
-format_message(char *buf, unsigned int bsize)
+format_message(char *buf, unsigned int bsize, int *nbatch)
 {
   char *p = buf;
   unsigned int l = bsize;
   int n;
 
+  *nbatch = 0;
+
   PRINT ("%s %s %lu",
     WIFI_OP, HOSTNAME, rtcMem.runCount);
     
@@ -218,6 +468,11 @@ format_message(char *buf, unsigned int bsize)
   SHOW (",t", 3, (micros() - time_start)/1000);
 #endif
   
+#ifdef SLEEP_SCHED
+  PRINT (" sched=p%ld", (long)rtcMem.schedPpm);
+  SHOW (",e", 3, rtcMem.schedError);
+#endif
+
 #ifdef SEND_STATS
   PRINT (" stats=fs%lu,fh%lu,fr%lu",
     rtcMem.failSoft, rtcMem.failHard, rtcMem.failRead);
@@ -229,26 +484,55 @@ format_message(char *buf, unsigned int bsize)
 
   SHOW (" vdd=", 3, vdd);
 
+#if DROOP_MS > 0
+  os_timer_disarm(&droop_timer);
+  if (droop.n > 0) {
+    SHOW (" droop=m", 3, droop.min);
+    SHOW (",a", 3, droop.sum / droop.n);
+    SHOW (",t", 3, droop.min_time / 1000);
+    PRINT (",n%u", droop.n);
+  }
+#endif
+
   for (int i = 0; i < rangeof(temp); ++i)
     SHOW ((i > 0 ? "," : " "), 4, (long)(temp[i]*10000));
 
+#if RTC_SAMPLES > 0
+/* " batch=runCount,vdd,temp...;..." oldest first
+ */
+  for (int i = 0; i < rtcMem.nSamples; ++i) {
+    int j = (rtcMem.nextSample + RTC_SAMPLES - rtcMem.nSamples + i) % RTC_SAMPLES;
+
+    if (!format_sample(&p, &l, &rtcMem.samples[j], 0 == i)) {
+      *p = '\0';                     // drop the partial one
+      break;
+    }
+    ++*nbatch;
+  }
+#endif
+
   return true;
 }
 
 static bool
 send_message(void)
 {
-  char message[200];
+  char message[MSG_HEAD_LEN + RTC_SAMPLES*MSG_SAMPLE_LEN];
+  int nbatch;
 
   time_save = micros();
 
-  if (!format_message(message, sizeof(message)))
+  if (!format_message(message, sizeof(message), &nbatch))
     return false;
 
   if (wifing) {
     if (!send_udp(message))
       return false;
-  }
+#if RTC_SAMPLES > 0
+    rtcMem.nSamples -= nbatch;      // delivered, the oldest
+#endif
+  } else
+    save_sample();
 
 #ifdef PRINT_MESSAGE
   Serial.println(message);
@@ -278,8 +562,17 @@ do_stuff()
   if (!read_vdd()) // read while wifi comes up
     return false;
 
-  if (wifing && !wait_for_wifi())
+  if (wifing && !wait_for_wifi()) {
+    save_sample();                  // try again next WiFi cycle
     return false;
+  }
+  if (wifing)
+    arp_restore();                  // before the NTP and the message
+
+#ifdef SLEEP_SCHED
+  if (wifing)
+    (void)sched_fix();              // no reply, keep the estimate
+#endif
 
   if (!send_message())
     return false;
@@ -340,12 +633,22 @@ cycle(void)
   uint32_t now = millis();
   if (now < time_udp_bug)
     delay (time_udp_bug - now);
+  if (wifing && did_ok)
+    arp_save();
 
   uint32_t last_wake_type = rtcMem.wakeType;
   rtcMem.wakeType = WIFI_ON_RATE
     ? ((rtcMem.runCount%WIFI_ON_RATE) ? WAKE_RF_DISABLED : WAKE_RFCAL)
     : WAKE_RF_DISABLED;
 
+#ifdef SLEEP_SCHED
+  uint32_t sleep_us = sched_sleep_us();
+
+  rtc_commit();
+  mark_end();
+
+  ESP.deepSleep(sleep_us, rtcMem.wakeType);
+#else
   rtc_commit();
   mark_end();
 
@@ -376,6 +679,7 @@ cycle(void)
   }
 
   Serial.println("### no dsleep");         // we are late, start new cycle NOW
+#endif
 }
 
 void
@@ -400,6 +704,10 @@ setup() {
     show_state();
     ESP.deepSleep(1, rtcMem.wakeType);
   }
+
+#ifdef SLEEP_SCHED
+  sched_wake(time_start);
+#endif
 }
 
 void
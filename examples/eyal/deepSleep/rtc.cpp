@@ -3,8 +3,15 @@
 /*
  * Change this value when you change the structure of 'struct rtcMem'
  */
-  #define RTC_magic         0xd1dad1d1  // L
+//#define RTC_magic         0xd1dad1d1  // L
 //#define RTC_magic         0xdad1d1da  // X
+//#define RTC_magic         0xd1dad1d2  // L with samples
+//#define RTC_magic         0xd1dad1d3  // L with samples and AP
+//#define RTC_magic         0xd1dad1d4  // L with samples, AP and sched
+//#define RTC_magic         0xd1dad1d5  // L with samples, AP, sched and ARP
+//#define RTC_magic         0xd1dad1d6  // L with samples, AP, sched (backoff) and ARP
+//#define RTC_magic         0xd1dad1d7  // L with samples, AP (lease), sched (backoff) and ARP
+  #define RTC_magic         0xd1dad1d8  // L with samples, AP (lease), sched (backoff) and ARP (valid)
 
 struct rtcMem rtcMem;
 
@@ -39,6 +46,23 @@ rtc_init(void)
     rtcMem.failRead  = 0;
     rtcMem.lastTime  = 0;
     rtcMem.totalTime = 0;
+    rtcMem.apChannel = 0;
+    rtcMem.apLeaseS  = 0;
+    rtcMem.arpValid  = 0;
+    rtcMem.arpUses   = 0;
+    rtcMem.schedPpm     = 0;
+    rtcMem.schedBoot[0] = rtcMem.schedBoot[1] = 0;
+    rtcMem.schedPhase   = 0;
+    rtcMem.schedSleep   = 0;
+    rtcMem.schedSlept   = 0;
+    rtcMem.schedError   = 0;
+    rtcMem.schedFixed   = 0;
+    rtcMem.schedMisses  = 0;
+    rtcMem.schedSkip    = 0;
+#if RTC_SAMPLES > 0
+    rtcMem.nSamples   = 0;
+    rtcMem.nextSample = 0;
+#endif
     rtc_write ();
     return false;
   }
@@ -0,0 +1,192 @@
+#include "deepSleep.h"
+
+#ifdef SLEEP_SCHED
+
+/*
+ * Wake every SLEEP_MS on the dot of wall clock time.
+ *
+ * A deep sleep wake resets the RTC counter, so the sleep cannot be timed
+ * locally. Instead, on WiFi cycles the time is asked from an NTP server,
+ * and the difference between where we estimated setup() started in the
+ * cycle and where it really did, divided by the sleep since the previous
+ * fix, is the error of the SDK sleep timer [ppm]. This replaces the
+ * measured TIME_SPEED.
+ *
+ * The boot time (to setup()) is measured by micros() each wake, separately
+ * for wakes with and without RF. What micros() does not see (entering deep
+ * sleep, the ROM boot) is a fixed guess, the ppm absorbs the rest.
+ *
+ * Without an NTP reply it keeps to the last estimate. After a few requests
+ * in a row go unanswered it asks only every SCHED_BACKOFF WiFi cycles, so
+ * a missing server does not cost NTP_TIMEOUT_MS on every radio wake.
+ */
+
+#ifndef SCHED_NTP_SERVER
+#error "SLEEP_SCHED needs SCHED_NTP_SERVER"
+#endif
+
+#include <WiFiUDP.h>
+
+#define CYCLE_US          ((uint32_t)SLEEP_MS*1000)
+#define SCHED_OVERHEAD_US 160000    // not seen by micros(), about the same on all modules
+#define SCHED_MIN_SLEEP_US 100000   // else skip a cycle
+#define SCHED_MAX_PPM     100000    // the SDK sleep is not off by more than 10%
+
+#define NTP_PORT          123
+#define NTP_LOCAL_PORT    2390
+#define NTP_TIMEOUT_MS    100
+#define SCHED_MAX_MISSES  3         // unanswered requests before backing off
+#define SCHED_BACKOFF     20        // WiFi cycles between requests after that
+#define NTP_UNIX_OFFSET   2208988800UL  // 1900 to 1970
+
+static uint32_t setup_micros;   // micros() at setup()
+static uint32_t setup_phase;    // us into the cycle at setup() [estimated]
+
+// to -CYCLE_US/2..CYCLE_US/2
+static int32_t
+wrap(int64_t d)
+{
+  d %= CYCLE_US;
+  if (d > CYCLE_US/2)
+    d -= CYCLE_US;
+  else if (d < -(int64_t)(CYCLE_US/2))
+    d += CYCLE_US;
+  return (int32_t)d;
+}
+
+void
+sched_wake(uint32_t time_start)
+{
+  byte rf = rtcMem.wakeType != WAKE_RF_DISABLED;
+
+  setup_micros = time_start;
+
+  if (0 == rtcMem.schedBoot[0])     // first time, a guess
+    rtcMem.schedBoot[0] = rtcMem.schedBoot[1] = time_start;
+  else
+    rtcMem.schedBoot[rf] += ((int32_t)time_start - (int32_t)rtcMem.schedBoot[rf]) / 4;
+
+  if (0 == rtcMem.schedSleep) {     // not from a scheduled sleep
+    setup_phase = time_start % CYCLE_US;
+    return;
+  }
+
+  uint64_t slept = (uint64_t)rtcMem.schedSleep * (1000000 + rtcMem.schedPpm) / 1000000;
+  setup_phase = (rtcMem.schedPhase + slept + SCHED_OVERHEAD_US + time_start) % CYCLE_US;
+}
+
+/*
+ * Ask the server for the time, WiFi must be up.
+ */
+static bool
+ask_ntp(void)
+{
+  WiFiUDP ntp;
+  byte buf[48];
+
+  memset(buf, 0, sizeof(buf));
+  buf[0] = 0x1B;                    // LI 0, version 3, client
+
+  if (!ntp.begin(NTP_LOCAL_PORT))
+    return false;
+  uint32_t t1 = micros();
+  ntp.beginPacket(SCHED_NTP_SERVER, NTP_PORT);
+  ntp.write(buf, sizeof(buf));
+  ntp.endPacket();
+
+  uint32_t start = millis();
+  while (ntp.parsePacket() < (int)sizeof(buf)) {
+    if (millis() - start >= NTP_TIMEOUT_MS) {
+      ntp.stop();
+      return false;
+    }
+    delay(1);
+  }
+  uint32_t t4 = micros();
+  ntp.read(buf, sizeof(buf));
+  ntp.stop();
+
+  // transmit time, taken as half way through the exchange
+  uint32_t sec  = ((uint32_t)buf[40] << 24) | ((uint32_t)buf[41] << 16) | ((uint32_t)buf[42] << 8) | buf[43];
+  uint32_t frac = ((uint32_t)buf[44] << 24) | ((uint32_t)buf[45] << 16) | ((uint32_t)buf[46] << 8) | buf[47];
+  if (0 == sec)
+    return false;
+  uint64_t now = (uint64_t)(sec - NTP_UNIX_OFFSET) * 1000000 + (((uint64_t)frac * 1000000) >> 32);
+
+  uint32_t mid = t1 + (t4 - t1)/2;
+  uint32_t phase = (now - (mid - setup_micros)) % CYCLE_US;
+  int32_t r = wrap((int64_t)phase - setup_phase);
+
+  if (rtcMem.schedFixed && rtcMem.schedSlept > CYCLE_US/2) {
+    int32_t ppm = rtcMem.schedPpm + (int32_t)((int64_t)r * 1000000 / rtcMem.schedSlept) / 2;
+    if (ppm > SCHED_MAX_PPM)
+      ppm = SCHED_MAX_PPM;
+    else if (ppm < -SCHED_MAX_PPM)
+      ppm = -SCHED_MAX_PPM;
+    rtcMem.schedPpm = ppm;
+  }
+  rtcMem.schedFixed = 1;
+  rtcMem.schedSlept = 0;
+  rtcMem.schedError = wrap(phase);  // setup() versus the boundary
+
+  setup_phase = phase;
+
+#ifdef SERIAL_CHATTY
+  Serial.print("sched: error=");
+  Serial.print(rtcMem.schedError);
+  Serial.print("us residual=");
+  Serial.print(r);
+  Serial.print("us ppm=");
+  Serial.println(rtcMem.schedPpm);
+#endif
+
+  return true;
+}
+
+bool
+sched_fix(void)
+{
+  if (rtcMem.schedSkip > 0) {
+    --rtcMem.schedSkip;
+    return false;
+  }
+
+  if (ask_ntp()) {
+    rtcMem.schedMisses = 0;
+    return true;
+  }
+
+  if (++rtcMem.schedMisses >= SCHED_MAX_MISSES)
+    rtcMem.schedSkip = SCHED_BACKOFF;
+  return false;
+}
+
+/*
+ * Call after the next wakeType is set, returns the ESP.deepSleep() time.
+ * When too late for the next boundary a cycle is skipped, runCount still
+ * counts the cycles.
+ */
+uint32_t
+sched_sleep_us(void)
+{
+  byte rf = rtcMem.wakeType != WAKE_RF_DISABLED;   // the next wake
+  uint32_t phase = (setup_phase + (micros() - setup_micros)) % CYCLE_US;
+  int64_t sleep = (int64_t)CYCLE_US - phase - SCHED_OVERHEAD_US - rtcMem.schedBoot[rf];
+
+  while (sleep < SCHED_MIN_SLEEP_US) {
+    sleep += CYCLE_US;
+    ++rtcMem.runCount;
+  }
+
+  uint32_t req = (uint32_t)(sleep * 1000000 / (1000000 + rtcMem.schedPpm));
+
+  rtcMem.schedPhase  = phase;
+  rtcMem.schedSleep  = req;
+  rtcMem.schedSlept += req;
+  if (rtcMem.schedSlept > 0x80000000UL) // too long without a fix to learn from
+    rtcMem.schedFixed = 0;
+
+  return req;
+}
+
+#endif // SLEEP_SCHED
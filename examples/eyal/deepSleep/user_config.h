@@ -23,13 +23,20 @@ static byte               addr[][8] = {
 #define WIFI_PORT         21883
 
 //#define WIFI_USE_DHCP
+#define WIFI_FAST                   // connect straight to the last AP (and lease), no scan
+#define ARP_FAST                    // reuse the server's MAC from the last cycle, no ARP
+#define ARP_REFRESH       100       // WiFi cycles between real ARPs, in case the server changed
 #define HOSTNAME          "esp-12c"
 static IPAddress          ip(192,168,2,52);  // static IP config
 static IPAddress          gw(192,168,2,7);
 static IPAddress          dns(192,168,2,7);
 
+//#define SLEEP_SCHED                 // wake on SLEEP_MS boundaries, learning the clock error (sched.cpp)
+//#define SCHED_NTP_SERVER  "192.168.2.1" // a LAN NTP server, asked for the time on WiFi cycles
+
 /*
  * The following three are wall clock ms
+ * WAKEUP_MS and DSLEEP_MS are not used with SLEEP_SCHED
  */
 
 /*
@@ -46,7 +53,7 @@ static IPAddress          dns(192,168,2,7);
 #define SLEEP_MS          10000     // time between wakeups [wall clock]
 
 /*
- * RTC/WallClock ratio for this host [measured]
+ * RTC/WallClock ratio for this host [measured], not used with SLEEP_SCHED
  */
 #define TIME_SPEED        1.0175    // esp-12c, 60s cycle
 
@@ -57,7 +64,12 @@ static IPAddress          dns(192,168,2,7);
 #define UDP_DELAY_MS      10        // work around SDK UDP bug
 #define WIFI_WAIT_MS      1         // how often to check wifi when waiting
 #define WIFI_TIMEOUT_MS   (10*1000) // how long to wait before giving up
+#define WIFI_FAST_MS      1000      // how long to wait for the last AP before a scan
+// Each vdd read briefly stops the radio, so frequent reads slow the very association
+// being measured. A longer period disturbs it less but can miss the short TX dips.
+#define DROOP_MS          100       // vdd sampled this often while the radio is on, 0=never
 #define WIFI_ON_RATE      6         // WiFi on every n cycles, 1=always, 0=never
+#define RTC_SAMPLES       10        // readings kept for the next WiFi cycle, 0=none
 
 //#define                   DO_NOTHING
 
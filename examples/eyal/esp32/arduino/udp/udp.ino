@@ -1,5 +1,6 @@
 #include <esp_deep_sleep.h>
 #include <esp_wifi.h>
+#include <esp_wifi_internal.h>
 #include <esp_event_loop.h>
 #include <sys/socket.h>
 //#include <lwip/udp.h>
@@ -14,13 +15,21 @@
 #define MY_GW     SVR_IP
 
 #define SLEEP_S   5
-#define GRACE_MS  10    // 5ms is too short
+#define GRACE_MS  10    // 5ms is too short, now the limit on waiting for TX done
 
 #define USE_DHCPC 0     // 0=no
 
 static int mysocket;
 static struct sockaddr_in remote_addr;
 static RTC_DATA_ATTR int n;
+static volatile bool tx_done;
+static size_t tx_len;
+
+// the WiFi task is done with a frame, skip the short ones (ARP)
+static void tx_cb(uint8_t *data, uint16_t *len, bool txStatus) {
+      if (*len >= tx_len)
+        tx_done = true;
+}
 
 static void send_msg(void) {
       char msg[20];
@@ -32,12 +41,17 @@ static void send_msg(void) {
       remote_addr.sin_addr.s_addr = inet_addr(SVR_IP);
 Serial.print(micros());
 Serial.println(" Sending");
+      tx_len = strlen(msg);
+      tx_done = false;
       sendto(mysocket, msg, strlen(msg), 0,
         (struct sockaddr *)&remote_addr, sizeof(remote_addr));
 Serial.print(micros());
 Serial.println(" Sent");
       ++n;
-      delay(GRACE_MS);
+      for (unsigned long t = millis(); !tx_done && millis() - t < GRACE_MS; )
+        delay(1);
+Serial.print(micros());
+Serial.println(tx_done ? " TX done" : " TX timed out");
       esp_deep_sleep(SLEEP_S*1000000);      
 }
 
@@ -111,6 +125,7 @@ Serial.print(micros());
 Serial.println(" esp_wifi_init");
   wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
   esp_wifi_init(&cfg);
+  esp_wifi_internal_reg_txcb(tx_cb);
 
 //  struct station_config sta_config;
 //  wifi_station_set_config(&sta_config);
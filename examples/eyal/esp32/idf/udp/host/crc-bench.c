@@ -0,0 +1,177 @@
+/* Time the 1-Wire CRC variants in main/onewire-crc.c on this host.
+ *
+ * Each is first checked against the plain bit loop, then timed on ROM id,
+ * scratchpad and bulk sized inputs. The host only gives the ratios, run it
+ * on the target for real numbers.
+ *
+ * Slicing-by-4 (4 tables, 1KB) is here only to see what it would buy.
+ *
+ *	crc-bench [-n iterations]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "udp.h"
+#include "onewire.h"
+
+#define BULK8		255	// the most onewire_crc8() takes
+#define BULK16		4096
+
+static volatile unsigned sink;
+
+static uint8_t slice[4][256];
+
+static void slice_init (void)
+{
+	int i, k;
+
+	for (i = 0; i < 256; ++i) {
+		uint8_t b = i;
+
+		slice[0][i] = onewire_crc8_bits (&b, 1);
+	}
+	for (k = 1; k < 4; ++k)
+		for (i = 0; i < 256; ++i)
+			slice[k][i] = slice[0][slice[k-1][i]];
+}
+
+static uint8_t crc8_slice4 (const uint8_t *addr, uint8_t len)
+{
+	uint8_t crc = 0;
+
+	for (; len >= 4; len -= 4, addr += 4)
+		crc = slice[3][crc ^ addr[0]] ^ slice[2][addr[1]]
+		    ^ slice[1][addr[2]] ^ slice[0][addr[3]];
+	while (len--)
+		crc = slice[0][crc ^ *addr++];
+	return crc;
+}
+
+static struct {
+	const char *name;
+	uint8_t (*f) (const uint8_t *addr, uint8_t len);
+} crc8s[] = {
+	{"bits",   onewire_crc8_bits},
+	{"nibble", onewire_crc8_nibble},
+	{"table",  onewire_crc8_table},
+	{"slice4", crc8_slice4},
+};
+
+static struct {
+	const char *name;
+	uint16_t (*f) (const uint8_t* input, uint16_t len, uint16_t crc);
+} crc16s[] = {
+	{"parity", onewire_crc16_parity},
+	{"nibble", onewire_crc16_nibble},
+};
+
+#define NUM(a)	(sizeof(a)/sizeof(a[0]))
+
+static double now_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+static int check (const uint8_t *buf)
+{
+	static const uint8_t rom[] = "\x28\xdc\x01\x78\x06\x00\x00\x0f";	// esp-32a
+	int bad = 0;
+	int len;
+	size_t i;
+
+	for (i = 0; i < NUM(crc8s); ++i) {
+		if (crc8s[i].f (rom, 7) != rom[7]) {
+			printf ("crc8 %s: bad ROM id crc\n", crc8s[i].name);
+			++bad;
+		}
+		for (len = 0; len <= BULK8; ++len)
+			if (crc8s[i].f (buf, len) != onewire_crc8_bits (buf, len)) {
+				printf ("crc8 %s: wrong for len %d\n", crc8s[i].name, len);
+				++bad;
+				break;
+			}
+	}
+
+	for (i = 0; i < NUM(crc16s); ++i)
+		for (len = 0; len <= 300; ++len)
+			if (crc16s[i].f (buf, len, len) != onewire_crc16_parity (buf, len, len)) {
+				printf ("crc16 %s: wrong for len %d\n", crc16s[i].name, len);
+				++bad;
+				break;
+			}
+
+	return bad;
+}
+
+int main (int argc, char *argv[])
+{
+	static uint8_t buf[BULK16];
+	static const int lens8[] = {7, 8, BULK8};
+	static const int lens16[] = {11, 32, BULK16};
+	long n = 1000000;
+	size_t i, j;
+	long k;
+	int opt;
+
+	while ((opt = getopt (argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n': n = atol (optarg); break;
+		default:
+			fprintf (stderr, "usage: %s [-n iterations]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	srand (1);
+	for (i = 0; i < sizeof(buf); ++i)
+		buf[i] = rand ();
+	slice_init ();
+
+	if (check (buf))
+		return 1;
+
+	printf ("%-8s", "crc8");
+	for (j = 0; j < NUM(lens8); ++j)
+		printf (" %6dB ns/B", lens8[j]);
+	printf ("\n");
+	for (i = 0; i < NUM(crc8s); ++i) {
+		printf ("%-8s", crc8s[i].name);
+		for (j = 0; j < NUM(lens8); ++j) {
+			long reps = n * 8 / lens8[j];
+			double t = now_ns ();
+
+			for (k = 0; k < reps; ++k)
+				sink += crc8s[i].f (buf + (k & 63), lens8[j]);
+			t = now_ns () - t;
+			printf (" %12.3f", t / reps / lens8[j]);
+		}
+		printf ("\n");
+	}
+
+	printf ("%-8s", "crc16");
+	for (j = 0; j < NUM(lens16); ++j)
+		printf (" %6dB ns/B", lens16[j]);
+	printf ("\n");
+	for (i = 0; i < NUM(crc16s); ++i) {
+		printf ("%-8s", crc16s[i].name);
+		for (j = 0; j < NUM(lens16); ++j) {
+			long reps = n * 8 / lens16[j];
+			double t = now_ns ();
+
+			for (k = 0; k < reps; ++k)
+				sink += crc16s[i].f (buf, lens16[j], k);
+			t = now_ns () - t;
+			printf (" %12.3f", t / reps / lens16[j]);
+		}
+		printf ("\n");
+	}
+
+	return 0;
+}
@@ -0,0 +1,743 @@
+/* Host (Linux) stand-in for the parts of ESP-IDF used by the udp app.
+ *
+ * Every IDF header the app includes is a one line wrapper around this file.
+ * The declarations follow the IDF v3.0 API that the app was written against,
+ * the implementations are in sim*.c and model the time each call takes on
+ * the board, so that one run of the app can be timed on a build box.
+*/
+
+#ifndef _SIM_H
+#define _SIM_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/time.h>
+
+/* sdkconfig.h */
+#define CONFIG_CONSOLE_UART_NUM		0
+#define CONFIG_CONSOLE_UART_BAUDRATE	115200
+#define CONFIG_FREERTOS_HZ		100
+#define CONFIG_ESP32_DEFAULT_CPU_FREQ_MHZ	240
+
+/* esp_err.h */
+typedef int32_t esp_err_t;
+#define ESP_OK			0
+#define ESP_FAIL		-1
+#define ESP_ERR_NO_MEM		0x101
+#define ESP_ERR_INVALID_ARG	0x102
+#define ESP_ERR_INVALID_STATE	0x103
+#define ESP_ERR_NOT_FOUND	0x105
+#define ESP_ERR_TIMEOUT		0x107
+#define ESP_ERR_INVALID_CRC	0x109
+
+#ifndef BIT
+#define BIT(n)			(1UL << (n))
+#endif
+#define BIT0			0x00000001
+#define BIT1			0x00000002
+#define BIT2			0x00000004
+#define BIT3			0x00000008
+#define BIT4			0x00000010
+#define BIT5			0x00000020
+
+/* esp_attr.h: RTC memory is kept by the simulator across deep sleep */
+#define RTC_DATA_ATTR		__attribute__((section("rtc_data")))
+#define RTC_RODATA_ATTR		RTC_DATA_ATTR
+#define IRAM_ATTR
+
+/* esp_system.h */
+typedef enum {
+	CHIP_ESP32 = 1,
+} esp_chip_model_t;
+
+typedef struct {
+	esp_chip_model_t model;
+	uint32_t features;
+	uint8_t cores;
+	uint8_t revision;
+} esp_chip_info_t;
+
+void esp_chip_info(esp_chip_info_t *out_info);
+esp_err_t esp_efuse_mac_get_default(uint8_t *mac);
+const char *esp_get_idf_version(void);
+void esp_deep_sleep(uint64_t time_in_us) __attribute__((noreturn));
+
+/* esp_log.h */
+typedef enum {
+	ESP_LOG_NONE,
+	ESP_LOG_ERROR,
+	ESP_LOG_WARN,
+	ESP_LOG_INFO,
+	ESP_LOG_DEBUG,
+	ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+/* esp_clk.h, soc/rtc.h */
+uint64_t esp_clk_rtc_time(void);
+uint32_t esp_clk_slowclk_cal_get(void);
+uint64_t rtc_time_get(void);
+#define RTC_CLK_CAL_FRACT	19	// slow_cal is us per tick << 19
+
+/* rom/rtc.h */
+typedef enum {
+	NO_SLEEP        = 0,
+	EXT_EVENT0_TRIG = BIT0,
+	EXT_EVENT1_TRIG = BIT1,
+	GPIO_TRIG       = BIT2,
+	TIMER_EXPIRE    = BIT3,
+} WAKEUP_REASON;
+
+typedef enum {
+	NO_MEAN                =  0,
+	POWERON_RESET          =  1,
+	SW_RESET               =  3,
+	DEEPSLEEP_RESET        =  5,
+} RESET_REASON;
+
+uint32_t rtc_get_wakeup_cause(void);
+RESET_REASON rtc_get_reset_reason(int cpu_no);
+
+/* rom/ets_sys.h */
+void ets_delay_us(uint32_t us);
+
+/* rom/uart.h */
+void uart_tx_wait_idle(uint8_t uart_no);
+
+/* the author's IDF exports these from time.c */
+uint64_t gettimeofday_us(void);
+uint64_t get_time_since_boot_64(void);
+
+/* freertos/FreeRTOS.h, freertos/task.h */
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define portTICK_PERIOD_MS	(1000 / CONFIG_FREERTOS_HZ)
+#define portTICK_RATE_MS	portTICK_PERIOD_MS
+#define portMAX_DELAY		(TickType_t)0xffffffffUL
+#define pdTRUE			1
+#define pdFALSE			0
+#define pdPASS			pdTRUE
+#define tskIDLE_PRIORITY	0
+#define tskNO_AFFINITY		0x7FFFFFFF
+#define configMAX_PRIORITIES	25
+
+/* one task runs at a time, nothing to lock */
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	0
+#define portENTER_CRITICAL(mux)		((void)(mux))
+#define portEXIT_CRITICAL(mux)		((void)(mux))
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName,
+	uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority,
+	TaskHandle_t *pvCreatedTask, BaseType_t xCoreID);
+void vTaskDelete(TaskHandle_t xTaskToDelete);
+void vTaskDelay(TickType_t xTicksToDelay);
+
+/* esp_timer.h, the callback runs in its own task */
+typedef struct sim_esp_timer *esp_timer_handle_t;
+typedef void (*esp_timer_cb_t)(void *arg);
+typedef struct {
+	esp_timer_cb_t callback;
+	void *arg;
+	int dispatch_method;
+	const char *name;
+} esp_timer_create_args_t;
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle);
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period);
+esp_err_t esp_timer_stop(esp_timer_handle_t timer);
+esp_err_t esp_timer_delete(esp_timer_handle_t timer);
+int64_t esp_timer_get_time(void);
+
+/* freertos/event_groups.h */
+typedef uint32_t EventBits_t;
+typedef struct sim_event_group *EventGroupHandle_t;
+
+EventGroupHandle_t xEventGroupCreate(void);
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t xEventGroup,
+	EventBits_t uxBitsToWaitFor, BaseType_t xClearOnExit,
+	BaseType_t xWaitForAllBits, TickType_t xTicksToWait);
+EventBits_t xEventGroupSetBits(EventGroupHandle_t xEventGroup, EventBits_t uxBitsToSet);
+EventBits_t xEventGroupClearBits(EventGroupHandle_t xEventGroup, EventBits_t uxBitsToClear);
+EventBits_t xEventGroupGetBits(EventGroupHandle_t xEventGroup);
+
+/* driver/gpio.h */
+typedef int gpio_num_t;
+
+typedef enum {
+	GPIO_MODE_DISABLE = 0,
+	GPIO_MODE_INPUT,
+	GPIO_MODE_OUTPUT,
+	GPIO_MODE_OUTPUT_OD,
+	GPIO_MODE_INPUT_OUTPUT_OD,
+	GPIO_MODE_INPUT_OUTPUT,
+} gpio_mode_t;
+
+typedef enum {
+	GPIO_PULLUP_ONLY,
+	GPIO_PULLDOWN_ONLY,
+	GPIO_PULLUP_PULLDOWN,
+	GPIO_FLOATING,
+} gpio_pull_mode_t;
+
+typedef enum {
+	GPIO_PULLUP_DISABLE = 0,
+	GPIO_PULLUP_ENABLE = 1,
+} gpio_pullup_t;
+
+void gpio_pad_select_gpio(uint8_t gpio_num);
+esp_err_t gpio_set_direction(gpio_num_t gpio_num, gpio_mode_t mode);
+esp_err_t gpio_set_level(gpio_num_t gpio_num, uint32_t level);
+int gpio_get_level(gpio_num_t gpio_num);
+esp_err_t gpio_set_pull_mode(gpio_num_t gpio_num, gpio_pull_mode_t pull);
+esp_err_t gpio_pullup_en(gpio_num_t gpio_num);
+
+/* rom/gpio.h, soc/gpio_sig_map.h */
+#define RMT_SIG_IN0_IDX		83
+#define RMT_SIG_OUT0_IDX	87
+
+void gpio_matrix_out(uint32_t gpio, uint32_t signal_idx, bool out_inv, bool oen_inv);
+void gpio_matrix_in(uint32_t gpio, uint32_t signal_idx, bool inv);
+
+/* freertos/ringbuf.h */
+typedef struct sim_ringbuf *RingbufHandle_t;
+
+void *xRingbufferReceive(RingbufHandle_t ringbuf, size_t *item_size, TickType_t ticks_to_wait);
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void *item);
+
+/* driver/rmt.h */
+typedef enum {
+	RMT_CHANNEL_0 = 0,
+	RMT_CHANNEL_1,
+	RMT_CHANNEL_2,
+	RMT_CHANNEL_3,
+	RMT_CHANNEL_4,
+	RMT_CHANNEL_5,
+	RMT_CHANNEL_6,
+	RMT_CHANNEL_7,
+	RMT_CHANNEL_MAX
+} rmt_channel_t;
+
+typedef enum {
+	RMT_MODE_TX = 0,
+	RMT_MODE_RX,
+	RMT_MODE_MAX
+} rmt_mode_t;
+
+typedef enum {
+	RMT_IDLE_LEVEL_LOW = 0,
+	RMT_IDLE_LEVEL_HIGH,
+	RMT_IDLE_LEVEL_MAX,
+} rmt_idle_level_t;
+
+typedef enum {
+	RMT_CARRIER_LEVEL_LOW = 0,
+	RMT_CARRIER_LEVEL_HIGH,
+	RMT_CARRIER_LEVEL_MAX
+} rmt_carrier_level_t;
+
+typedef struct {
+	bool loop_en;
+	uint32_t carrier_freq_hz;
+	uint8_t carrier_duty_percent;
+	rmt_carrier_level_t carrier_level;
+	bool carrier_en;
+	rmt_idle_level_t idle_level;
+	bool idle_output_en;
+} rmt_tx_config_t;
+
+typedef struct {
+	bool filter_en;
+	uint8_t filter_ticks_thresh;
+	uint16_t idle_threshold;
+} rmt_rx_config_t;
+
+typedef struct {
+	rmt_mode_t rmt_mode;
+	rmt_channel_t channel;
+	uint8_t clk_div;
+	gpio_num_t gpio_num;
+	uint8_t mem_block_num;
+	union {
+		rmt_tx_config_t tx_config;
+		rmt_rx_config_t rx_config;
+	};
+} rmt_config_t;
+
+typedef struct {
+	union {
+		struct {
+			uint32_t duration0 :15;
+			uint32_t level0 :1;
+			uint32_t duration1 :15;
+			uint32_t level1 :1;
+		};
+		uint32_t val;
+	};
+} rmt_item32_t;
+
+esp_err_t rmt_config(const rmt_config_t *rmt_param);
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags);
+esp_err_t rmt_get_ringbuf_handle(rmt_channel_t channel, RingbufHandle_t *buf_handle);
+esp_err_t rmt_set_rx_idle_thresh(rmt_channel_t channel, uint16_t thresh);
+esp_err_t rmt_rx_start(rmt_channel_t channel, bool rx_idx_rst);
+esp_err_t rmt_rx_stop(rmt_channel_t channel);
+esp_err_t rmt_write_items(rmt_channel_t channel, const rmt_item32_t *rmt_item,
+	int item_num, bool wait_tx_done);
+
+/* driver/i2c.h */
+typedef int i2c_port_t;
+#define I2C_NUM_0		0
+#define I2C_NUM_1		1
+
+typedef enum {
+	I2C_MODE_SLAVE = 0,
+	I2C_MODE_MASTER,
+} i2c_mode_t;
+
+#define I2C_MASTER_WRITE	0
+#define I2C_MASTER_READ		1
+
+typedef struct {
+	i2c_mode_t mode;
+	gpio_num_t sda_io_num;
+	gpio_pullup_t sda_pullup_en;
+	gpio_num_t scl_io_num;
+	gpio_pullup_t scl_pullup_en;
+	union {
+		struct {
+			uint32_t clk_speed;
+		} master;
+		struct {
+			uint8_t addr_10bit_en;
+			uint16_t slave_addr;
+		} slave;
+	};
+} i2c_config_t;
+
+typedef struct sim_i2c_cmd *i2c_cmd_handle_t;
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf);
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode,
+	size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags);
+esp_err_t i2c_driver_delete(i2c_port_t i2c_num);
+i2c_cmd_handle_t i2c_cmd_link_create(void);
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle);
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle);
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle);
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data, bool ack_en);
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd_handle, uint8_t *data, size_t data_len, bool ack_en);
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd_handle, uint8_t *data, int ack);
+esp_err_t i2c_master_read(i2c_cmd_handle_t cmd_handle, uint8_t *data, size_t data_len, int ack);
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle, TickType_t ticks_to_wait);
+
+/* driver/adc.h, esp_adc_cal.h */
+typedef enum {
+	ADC_ATTEN_0db   = 0,
+	ADC_ATTEN_2_5db = 1,
+	ADC_ATTEN_6db   = 2,
+	ADC_ATTEN_11db  = 3,
+} adc_atten_t;
+
+typedef enum {
+	ADC_WIDTH_9Bit  = 0,
+	ADC_WIDTH_10Bit = 1,
+	ADC_WIDTH_11Bit = 2,
+	ADC_WIDTH_12Bit = 3,
+} adc_bits_width_t;
+
+typedef enum {
+	ADC1_CHANNEL_0 = 0,
+	ADC1_CHANNEL_1,
+	ADC1_CHANNEL_2,
+	ADC1_CHANNEL_3,
+	ADC1_CHANNEL_4,
+	ADC1_CHANNEL_5,
+	ADC1_CHANNEL_6,
+	ADC1_CHANNEL_7,
+	ADC1_CHANNEL_MAX,
+} adc1_channel_t;
+
+#define ADC1_GPIO36_CHANNEL	ADC1_CHANNEL_0
+#define ADC1_GPIO37_CHANNEL	ADC1_CHANNEL_1
+#define ADC1_GPIO38_CHANNEL	ADC1_CHANNEL_2
+#define ADC1_GPIO39_CHANNEL	ADC1_CHANNEL_3
+#define ADC1_GPIO32_CHANNEL	ADC1_CHANNEL_4
+#define ADC1_GPIO33_CHANNEL	ADC1_CHANNEL_5
+#define ADC1_GPIO34_CHANNEL	ADC1_CHANNEL_6
+#define ADC1_GPIO35_CHANNEL	ADC1_CHANNEL_7
+
+typedef struct {
+	uint32_t v_ref;
+	adc_atten_t atten;
+	adc_bits_width_t bit_width;
+} esp_adc_cal_characteristics_t;
+
+esp_err_t adc1_config_width(adc_bits_width_t width_bit);
+esp_err_t adc1_config_channel_atten(adc1_channel_t channel, adc_atten_t atten);
+int adc1_get_raw(adc1_channel_t channel);
+void esp_adc_cal_get_characteristics(uint32_t v_ref, adc_atten_t atten,
+	adc_bits_width_t bit_width, esp_adc_cal_characteristics_t *chars);
+uint32_t adc1_to_voltage(adc1_channel_t channel, const esp_adc_cal_characteristics_t *chars);
+uint32_t esp_adc_cal_raw_to_voltage(uint32_t adc, const esp_adc_cal_characteristics_t *chars);
+
+/* soc/sens_reg.h: only the temperature sensor readout is modelled */
+#define SENS_SAR_MEAS_WAIT2_REG		0
+#define SENS_SAR_TSENS_CTRL_REG		0
+#define SENS_SAR_SLAVE_ADDR3_REG	0
+#define SENS_FORCE_XPD_SAR		0
+#define SENS_FORCE_XPD_SAR_S		0
+#define SENS_TSENS_CLK_DIV		0
+#define SENS_TSENS_CLK_DIV_S		0
+#define SENS_TSENS_POWER_UP		0
+#define SENS_TSENS_POWER_UP_FORCE	0
+#define SENS_TSENS_DUMP_OUT		0
+#define SENS_TSENS_OUT			0
+#define SENS_TSENS_OUT_S		0
+#define SET_PERI_REG_BITS(reg, bit_map, value, shift)	((void)0)
+#define SET_PERI_REG_MASK(reg, mask)			((void)0)
+#define CLEAR_PERI_REG_MASK(reg, mask)			((void)0)
+#define GET_PERI_REG_BITS2(reg, mask, shift)		sim_tsens_raw()
+uint32_t sim_tsens_raw(void);
+
+/* nvs_flash.h */
+esp_err_t nvs_flash_init(void);
+
+/* nvs.h */
+typedef uint32_t nvs_handle;
+typedef enum {
+	NVS_READONLY,
+	NVS_READWRITE
+} nvs_open_mode;
+#define ESP_ERR_NVS_BASE		0x1100
+#define ESP_ERR_NVS_NOT_INITIALIZED	(ESP_ERR_NVS_BASE + 0x01)
+#define ESP_ERR_NVS_NOT_FOUND		(ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_NOT_ENOUGH_SPACE	(ESP_ERR_NVS_BASE + 0x05)
+#define ESP_ERR_NVS_INVALID_HANDLE	(ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_INVALID_LENGTH	(ESP_ERR_NVS_BASE + 0x0c)
+
+esp_err_t nvs_open(const char *name, nvs_open_mode open_mode, nvs_handle *out_handle);
+esp_err_t nvs_get_blob(nvs_handle handle, const char *key, void *out_value, size_t *length);
+esp_err_t nvs_set_blob(nvs_handle handle, const char *key, const void *value, size_t length);
+esp_err_t nvs_commit(nvs_handle handle);
+void nvs_close(nvs_handle handle);
+
+/* lwip ip4_addr.h, tcpip_adapter.h */
+typedef struct {
+	uint32_t addr;
+} ip4_addr_t;
+
+int ip4addr_aton(const char *cp, ip4_addr_t *addr);
+char *ip4addr_ntoa_r(const ip4_addr_t *addr, char *buf, int buflen);
+
+typedef enum {
+	TCPIP_ADAPTER_IF_STA = 0,
+	TCPIP_ADAPTER_IF_AP,
+	TCPIP_ADAPTER_IF_MAX
+} tcpip_adapter_if_t;
+
+typedef struct {
+	ip4_addr_t ip;
+	ip4_addr_t netmask;
+	ip4_addr_t gw;
+} tcpip_adapter_ip_info_t;
+
+void tcpip_adapter_init(void);
+esp_err_t tcpip_adapter_dhcpc_stop(tcpip_adapter_if_t tcpip_if);
+esp_err_t tcpip_adapter_dhcpc_start(tcpip_adapter_if_t tcpip_if);
+esp_err_t tcpip_adapter_set_ip_info(tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t *ip_info);
+esp_err_t tcpip_adapter_get_netif(tcpip_adapter_if_t tcpip_if, void **netif);
+
+/* esp_wifi.h, esp_event_loop.h */
+typedef enum {
+	WIFI_MODE_NULL = 0,
+	WIFI_MODE_STA,
+	WIFI_MODE_AP,
+	WIFI_MODE_APSTA,
+} wifi_mode_t;
+
+typedef enum {
+	ESP_IF_WIFI_STA = 0,
+	ESP_IF_WIFI_AP,
+} esp_interface_t;
+
+typedef enum {
+	WIFI_STORAGE_FLASH,
+	WIFI_STORAGE_RAM,
+} wifi_storage_t;
+
+typedef struct {
+	int magic;
+} wifi_init_config_t;
+#define WIFI_INIT_CONFIG_DEFAULT()	{ .magic = 0x1F2F3F4F }
+
+typedef struct {
+	uint8_t ssid[32];
+	uint8_t password[64];
+	bool bssid_set;
+	uint8_t bssid[6];
+	uint8_t channel;
+} wifi_sta_config_t;
+
+typedef union {
+	wifi_sta_config_t sta;
+} wifi_config_t;
+
+typedef struct {
+	uint8_t bssid[6];
+	uint8_t ssid[33];
+	uint8_t primary;
+	int8_t rssi;
+} wifi_ap_record_t;
+
+typedef enum {
+	SYSTEM_EVENT_WIFI_READY = 0,
+	SYSTEM_EVENT_SCAN_DONE,
+	SYSTEM_EVENT_STA_START,
+	SYSTEM_EVENT_STA_STOP,
+	SYSTEM_EVENT_STA_CONNECTED,
+	SYSTEM_EVENT_STA_DISCONNECTED,
+	SYSTEM_EVENT_STA_AUTHMODE_CHANGE,
+	SYSTEM_EVENT_STA_GOT_IP,
+	SYSTEM_EVENT_MAX
+} system_event_id_t;
+
+typedef struct {
+	uint8_t ssid[32];
+	uint8_t ssid_len;
+	uint8_t bssid[6];
+	uint8_t channel;
+} system_event_sta_connected_t;
+
+typedef struct {
+	uint8_t ssid[32];
+	uint8_t ssid_len;
+	uint8_t bssid[6];
+	uint8_t reason;
+} system_event_sta_disconnected_t;
+
+typedef struct {
+	tcpip_adapter_ip_info_t ip_info;
+	bool ip_changed;
+} system_event_sta_got_ip_t;
+
+typedef union {
+	system_event_sta_connected_t connected;
+	system_event_sta_disconnected_t disconnected;
+	system_event_sta_got_ip_t got_ip;
+} system_event_info_t;
+
+typedef struct {
+	system_event_id_t event_id;
+	system_event_info_t event_info;
+} system_event_t;
+
+typedef esp_err_t (*system_event_cb_t)(void *ctx, system_event_t *event);
+
+esp_err_t esp_event_loop_init(system_event_cb_t cb, void *ctx);
+esp_err_t esp_wifi_init(const wifi_init_config_t *config);
+esp_err_t esp_wifi_set_storage(wifi_storage_t storage);
+esp_err_t esp_wifi_set_mode(wifi_mode_t mode);
+esp_err_t esp_wifi_set_config(esp_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_get_config(esp_interface_t interface, wifi_config_t *conf);
+esp_err_t esp_wifi_start(void);
+esp_err_t esp_wifi_connect(void);
+esp_err_t esp_wifi_disconnect(void);
+esp_err_t esp_wifi_sta_get_ap_info(wifi_ap_record_t *ap_info);
+
+/* lwip err.h, ip_addr.h, pbuf.h, udp.h, priv/tcpip_priv.h (IPv4 only) */
+typedef int8_t err_t;
+#define ERR_OK			0
+#define ERR_MEM			-1
+#define ERR_RTE			-4
+#define ERR_ARG			-16
+
+typedef ip4_addr_t ip_addr_t;
+#define ipaddr_aton(cp, addr)	ip4addr_aton(cp, addr)
+
+typedef enum {
+	PBUF_TRANSPORT,
+	PBUF_IP,
+	PBUF_LINK,
+	PBUF_RAW
+} pbuf_layer;
+
+typedef enum {
+	PBUF_RAM,
+	PBUF_ROM,
+	PBUF_REF,
+	PBUF_POOL
+} pbuf_type;
+
+struct pbuf {
+	struct pbuf *next;
+	void *payload;
+	uint16_t tot_len;
+	uint16_t len;
+	uint8_t type;
+	uint16_t ref;
+};
+
+struct pbuf *pbuf_alloc(pbuf_layer layer, uint16_t length, pbuf_type type);
+uint8_t pbuf_free(struct pbuf *p);
+
+struct udp_pcb;
+struct udp_pcb *udp_new(void);
+void udp_remove(struct udp_pcb *pcb);
+err_t udp_sendto(struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, uint16_t dst_port);
+
+/* lwip netif.h, ip4.h, etharp.h, netif/ethernet.h, dhcp.h */
+struct dhcp {
+	uint32_t offered_t0_lease;	// s
+	uint32_t offered_t1_renew;
+};
+
+struct netif {
+	ip4_addr_t ip_addr;
+	ip4_addr_t netmask;
+	ip4_addr_t gw;
+	uint8_t hwaddr[6];
+	struct dhcp *dhcp;		// NULL without dhcp
+};
+#define netif_dhcp_data(netif)		((netif)->dhcp)
+#define netif_ip4_addr(netif)		(&(netif)->ip_addr)
+#define netif_ip4_netmask(netif)	(&(netif)->netmask)
+#define netif_ip4_gw(netif)		(&(netif)->gw)
+#define ip_2_ip4(ipaddr)		(ipaddr)
+#define ip4_addr_cmp(a, b)		((a)->addr == (b)->addr)
+#define ip4_addr_netcmp(a, b, mask)	(((a)->addr & (mask)->addr) == ((b)->addr & (mask)->addr))
+
+struct eth_addr {
+	uint8_t addr[6];
+};
+
+struct netif *ip4_route(const ip4_addr_t *dest);
+err_t ethernet_input(struct pbuf *p, struct netif *netif);
+int8_t etharp_find_addr(struct netif *netif, const ip4_addr_t *ipaddr,
+	struct eth_addr **eth_ret, const ip4_addr_t **ip_ret);
+
+struct tcpip_api_call_data {
+	err_t err;
+};
+typedef err_t (*tcpip_api_call_fn)(struct tcpip_api_call_data *call);
+err_t tcpip_api_call(tcpip_api_call_fn fn, struct tcpip_api_call_data *call);
+
+/* esp_wifi_internal.h */
+typedef void (*wifi_txdone_cb_t)(uint8_t *data, uint16_t *len, bool txStatus);
+esp_err_t esp_wifi_internal_reg_txcb(wifi_txdone_cb_t fn);
+
+/**************** simulator internals, not part of the IDF API ****************/
+
+#define SIM_NUM_GPIO		40
+#define SIM_MAX_TASKS		8
+#define SIM_MAX_OW		8
+#define SIM_RTC_SIZE		(8*1024)	// RTC slow memory
+#define SIM_MSG_SIZE		1500
+#define SIM_NVS_KEYS		4
+#define SIM_NVS_BLOB		256
+
+// one NVS blob, namespace and key as in the IDF (15 chars)
+struct sim_nvs {
+	char ns[16];
+	char key[16];
+	size_t len;
+	uint8_t data[SIM_NVS_BLOB];
+};
+
+struct sim_ds18b20 {
+	uint8_t rom[8];
+	uint8_t scratchpad[9];
+	uint8_t eeprom[3];		// TH, TL, config
+	float temp;			// what the next conversion reads
+	uint64_t busy_until;		// conversion or copy in progress
+};
+
+struct sim_bme280 {
+	uint8_t regs[256];
+	uint64_t ready_at;		// forced measurement done
+	float temp, press, humi;	// what the next measurement reads
+};
+
+/* Everything in here survives deep sleep, it lives in memory shared with
+ * the parent process that runs the wake loop.
+ */
+struct sim_shared {
+	/* configuration */
+	int wakes;			// number of wakes to run
+	int verbose;			// show the console output
+	uint32_t boot_us;		// power up to app_main
+	uint32_t assoc_ms;		// esp_wifi_connect to CONNECTED, with a scan
+	uint32_t direct_ms;		// the same, to a known bssid and channel
+	uint32_t dhcp_ms;		// CONNECTED to GOT_IP
+	uint32_t lease_s;		// dhcp lease
+	int assoc_fail;			// fail the first association every n wakes
+	int txdone_lost;		// no TX done for the message every n wakes
+	int arps;			// ARP requests this wake
+	int rtc_ppm;			// slow clock error
+	int low_pins[SIM_NUM_GPIO];	// inputs that are held LOW
+	int ow_pin;
+	int nds18b20;
+	int have_bme280;
+	uint32_t adc_mv[SIM_NUM_GPIO];	// input voltage on adc pins
+
+	/* state */
+	int wake;			// wakes so far
+	uint64_t now;			// true time
+	uint64_t boot_time;		// true time of this power up
+	uint64_t app_time;		// true time of app_main
+	uint64_t sleep_us;		// requested by esp_deep_sleep()
+	int slept;			// esp_deep_sleep() was called
+	int sockets;			// socket() and udp_new() calls, never closed
+	int sent;			// sendto() calls this wake
+	int msg_len;
+	uint8_t msg[SIM_MSG_SIZE];	// last datagram sent
+	uint32_t rtc_len;
+	uint8_t rtc[SIM_RTC_SIZE];	// RTC_DATA_ATTR variables
+	wifi_config_t wifi_flash;	// esp_wifi_set_config() with WIFI_STORAGE_FLASH
+	struct sim_nvs nvs[SIM_NVS_KEYS];	// nvs_set_blob(), starts out erased
+	uint32_t random;
+
+	/* devices keep their power in deep sleep */
+	struct sim_ds18b20 ds18b20[SIM_MAX_OW];
+	struct sim_bme280 bme280;
+};
+
+extern struct sim_shared *sim;
+
+/* sim.c */
+uint64_t sim_now(void);
+void sim_advance(uint32_t us);
+void sim_at(uint64_t when, void (*func)(void *), void *arg);
+uint32_t sim_random(uint32_t range);
+void sim_fatal(const char *fmt, ...) __attribute__((noreturn));
+
+/* sim-gpio.c */
+void sim_ow_power_on(void);
+void sim_gpio_init(void);
+void sim_ow_drive(int pin, int low, uint64_t when);
+int sim_ow_level(uint64_t when);
+
+/* sim-rmt.c */
+void sim_rmt_init(void);
+
+/* sim-i2c.c */
+void sim_bme280_power_on(void);
+void sim_i2c_init(int cold);
+
+/* sim-adc.c */
+void sim_radio_on(void);
+void sim_radio_tx(uint32_t us);
+
+/* sim-wifi.c */
+void sim_wifi_init(void);
+
+#endif // _SIM_H
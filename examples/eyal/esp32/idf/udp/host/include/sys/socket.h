@@ -0,0 +1,10 @@
+/* lwip's sockets.h also provides the inet helpers */
+#ifndef _SIM_SYS_SOCKET_H
+#define _SIM_SYS_SOCKET_H
+
+#include_next <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "sim.h"
+
+#endif // _SIM_SYS_SOCKET_H
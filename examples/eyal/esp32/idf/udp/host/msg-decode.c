@@ -0,0 +1,157 @@
+/* Decode a binary message (main/msg.h) back into the text message the
+ * app sends when BINARY_MSG is off, so the server side does not change.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "msg.h"
+#include "msg-decode.h"
+
+#define ADD(...) \
+do { \
+	int _len_ = snprintf (buf, blen, __VA_ARGS__); \
+	if (_len_ > 0 && _len_ < blen) { \
+		buf += _len_; \
+		blen -= _len_; \
+	} else \
+		blen = 0; \
+} while (0)
+
+// returns the text length, -1 if this is not a message we know
+int msg_decode (const void *frame, int flen, const char *action, const char *name,
+	char *text, int tlen)
+{
+	const uint8_t *p = frame;
+	struct msg m;
+	struct msg_stages st = {0};
+	struct msg_sched sc = {0};
+	struct msg_droop dr = {0};
+	char *buf = text;
+	int blen = tlen;
+	int nsamples = 0;
+	int i, j;
+
+	if (flen < (int)sizeof(m.h))
+		return -1;
+	memcpy (&m, frame, sizeof(m.h));
+	if (MSG_MAGIC != m.h.magic || m.h.version < 1 || m.h.version > MSG_VERSION)
+		return -1;
+	if (m.h.len != flen || flen < (int)MSG_LEN(0))
+		return -1;
+
+	memset (&m, 0, sizeof(m));
+	memcpy (&m, frame, flen < (int)sizeof(m) ? flen : (int)sizeof(m));
+	if (m.ntemps > MSG_MAX_TEMPS)
+		return -1;
+
+	p += MSG_LEN(m.ntemps);
+	if (1 == m.h.version) {			// no samples
+		if (MSG_LEN(m.ntemps) != (size_t)flen)
+			return -1;
+	} else {
+		size_t extra = (m.h.version >= 3) ? sizeof(st) : 0;
+		size_t extra4 = (m.h.version >= 4) ? sizeof(sc) : 0;
+		size_t extra5 = (m.h.version >= 5) ? sizeof(dr) : 0;
+
+		if (MSG_LEN(m.ntemps) + 1 > (size_t)flen)
+			return -1;
+		nsamples = *p++;
+		if (MSG_LEN(m.ntemps) + 1 + nsamples*MSG_SAMPLE_LEN(m.ntemps) + extra + extra4 + extra5
+				!= (size_t)flen)
+			return -1;
+		if (extra)
+			memcpy (&st, (const uint8_t *)frame + flen - extra5 - extra4 - extra, extra);
+		if (extra4)
+			memcpy (&sc, (const uint8_t *)frame + flen - extra5 - extra4, extra4);
+		if (extra5)
+			memcpy (&dr, (const uint8_t *)frame + flen - extra5, extra5);
+	}
+
+	ADD ("%s %s %u", action, name, m.h.runCount);
+
+	ADD (" times=D%u,T%u,s%u.%06u,r%.3f,w%.3f,t%u.%06u",
+		m.sleep_us, m.sleep_ticks,
+		m.app_start_us / 1000000, m.app_start_us % 1000000,
+		m.readings_us / 1000000.,
+		m.wifi_us / 1000000.,
+		m.now_us / 1000000, m.now_us % 1000000);
+
+	if (m.h.version >= 3)
+		ADD (" stages=rs%.3f,re%.3f,ws%.3f,wc%.3f,wi%.3f,tx%.3f",
+			st.read_start / 1000000.,
+			st.read_end / 1000000.,
+			st.wifi_setup / 1000000.,
+			st.connected / 1000000.,
+			st.got_ip / 1000000.,
+			st.send / 1000000.);
+
+	ADD (" prev=L%.3f,T%u,c%.6f,a%.6f",
+		m.last_us / 1000000.,
+		m.total_s,
+		m.cycle_us / 1000000.,
+		m.active_us / 1000000.);
+
+	ADD (" clocks=R%llu,F%llu,f%llu,C%u,t%llu,g%d",
+		(unsigned long long)m.rtc_us,
+		(unsigned long long)m.frc_us,
+		(unsigned long long)m.frc_raw_us,
+		m.slow_cal,
+		(unsigned long long)m.rtc_ticks,
+		m.grace_us);
+
+	if (m.h.version >= 4 && (sc.ppm || sc.overhead_us || sc.error_us))
+		ADD (" sched=p%d,o%.3f,e%.3f",
+			sc.ppm, sc.overhead_us / 1000., sc.error_us / 1000.);
+
+	ADD (" stats=fs%u,fh%u,fr%u,fR%u",
+		m.fail_soft, m.fail_hard, m.fail_read, m.fail_read_hard);
+	if (m.h.flags & MSG_HAVE_DS18B20)
+		ADD (",Dc%u,Dr%.4f",
+			m.ds18b20_failures, MSG_TEMP_C(m.ds18b20_reason));
+	if (m.h.flags & MSG_HAVE_BME280)
+		ADD (",Bc%u",
+			m.bme280_failures);
+	ADD (",c%03x,r%u",
+		m.wakeup_cause, m.reset_reason);
+
+	ADD (" v=%.3f,%.3f,%.3f",
+		m.bat_mv / 1000., m.vdd_mv / 1000., m.v1_mv / 1000.);
+
+	if (dr.n > 0)
+		ADD (" droop=m%.3f,a%.3f,t%.3f,n%u",
+			dr.min_mv / 1000., dr.mean_mv / 1000.,
+			dr.min_us / 1000000., dr.n);
+
+	ADD (" radio=s%d,c%u",
+		-m.rssi, m.channel);
+
+	if (m.h.flags & MSG_HAVE_BME280)
+		ADD (" w=T%.2f,P%.3f,H%.3f,f%x",
+			MSG_TEMP_C(m.w_temp), m.w_qnh / 1000., m.w_humi / 100., m.w_fail);
+
+	ADD (" adc=%.3f vdd=%.3f",
+		m.bat_mv / 1000., m.vdd_mv / 1000.);
+
+	for (i = 0; i < m.ntemps; ++i)
+		ADD ("%c%.4f", (i ? ',' : ' '), MSG_TEMP_C(m.temps[i]));
+
+	for (i = 0; i < nsamples; ++i, p += MSG_SAMPLE_LEN(m.ntemps)) {
+		struct msg_sample s;
+		int16_t t;
+
+		memcpy (&s, p, sizeof(s));
+		ADD ("%s%u,%u,%.3f,%.3f",
+			(i ? ";" : " batch="), s.runCount, s.rtc_ms,
+			s.bat_mv / 1000., s.vdd_mv / 1000.);
+		for (j = 0; j < m.ntemps; ++j) {
+			memcpy (&t, p + sizeof(s) + j*sizeof(t), sizeof(t));
+			ADD (",%.4f", MSG_TEMP_C(t));
+		}
+	}
+
+	if (0 == blen)
+		return -1;		// truncated
+
+	return tlen - blen;
+}
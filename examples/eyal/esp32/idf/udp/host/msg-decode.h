@@ -0,0 +1,8 @@
+#ifndef _MSG_DECODE_H
+#define _MSG_DECODE_H
+
+/* msg-decode.c */
+int msg_decode (const void *frame, int flen, const char *action, const char *name,
+	char *text, int tlen);
+
+#endif // _MSG_DECODE_H
@@ -0,0 +1,136 @@
+/* ADC1 and the internal temperature sensor.
+ *
+ * The pin voltages are set on the command line, a reading adds a few mV
+ * of noise and now and then a spike, like a WiFi TX burst on the supply.
+ *
+ * Once the radio is started the battery sags by its internal resistance,
+ * a little while receiving and more during the TX bursts sim-wifi.c
+ * reports.
+*/
+
+#include "sim.h"
+
+#define ADC_READ_US		40	// one adc1_get_raw() (rough)
+#define CAL_US			20	// esp_adc_cal_get_characteristics()
+#define SPIKE_RATE		32	// one reading in this many
+#define SPIKE_MV		60
+#define BAT_PIN			33	// behind a 1:2 divider
+#define BAT_DIVIDER		3
+#define BAT_MOHM		500	// internal resistance, a small LiPo
+#define RADIO_RX_MA		100	// radio on, listening
+#define RADIO_TX_MA		250
+#define TX_BURSTS		8	// remembered, this wake only
+
+static const int channel_pin[ADC1_CHANNEL_MAX] = {36, 37, 38, 39, 32, 33, 34, 35};
+static const uint32_t atten_mv[] = {1100, 1500, 2200, 3900};	// full scale
+static adc_bits_width_t width = ADC_WIDTH_12Bit;
+static adc_atten_t atten[ADC1_CHANNEL_MAX];
+static int radio_on;
+static uint64_t tx_start[TX_BURSTS], tx_end[TX_BURSTS];
+static int tx_next;
+
+void sim_radio_on (void)
+{
+	radio_on = 1;
+}
+
+void sim_radio_tx (uint32_t us)
+{
+	uint64_t now = sim_now ();
+
+	tx_start[tx_next] = now;
+	tx_end[tx_next] = now + us;
+	tx_next = (tx_next + 1) % TX_BURSTS;
+}
+
+// mV lost on the battery pin to the radio's current right now
+static int radio_droop_mv (void)
+{
+	uint64_t now = sim_now ();
+	int ma = RADIO_RX_MA;
+	int i;
+
+	if (!radio_on)
+		return 0;
+
+	for (i = 0; i < TX_BURSTS; ++i)
+		if (tx_start[i] <= now && now < tx_end[i]) {
+			ma = RADIO_TX_MA;
+			break;
+		}
+
+	return ma * BAT_MOHM / 1000 / BAT_DIVIDER;
+}
+
+esp_err_t adc1_config_width (adc_bits_width_t width_bit)
+{
+	if (width_bit > ADC_WIDTH_12Bit)
+		return ESP_ERR_INVALID_ARG;
+
+	width = width_bit;
+	return ESP_OK;
+}
+
+esp_err_t adc1_config_channel_atten (adc1_channel_t channel, adc_atten_t a)
+{
+	if (channel >= ADC1_CHANNEL_MAX || a > ADC_ATTEN_11db)
+		return ESP_ERR_INVALID_ARG;
+
+	atten[channel] = a;
+	sim_advance (5);
+	return ESP_OK;
+}
+
+int adc1_get_raw (adc1_channel_t channel)
+{
+	int max = (1 << (9 + width)) - 1;
+	int mv, raw;
+
+	if (channel >= ADC1_CHANNEL_MAX)
+		return -1;
+
+	mv = sim->adc_mv[channel_pin[channel]] + (int)sim_random (9) - 4;
+	if (0 == sim_random (SPIKE_RATE))
+		mv -= SPIKE_MV;
+	if (BAT_PIN == channel_pin[channel])
+		mv -= radio_droop_mv ();
+	raw = (int)((int64_t)mv * max / atten_mv[atten[channel]]);
+	if (raw < 0) raw = 0;
+	if (raw > max) raw = max;
+
+	sim_advance (ADC_READ_US);
+	return raw;
+}
+
+void esp_adc_cal_get_characteristics (uint32_t v_ref, adc_atten_t a,
+	adc_bits_width_t bit_width, esp_adc_cal_characteristics_t *chars)
+{
+	chars->v_ref = v_ref;
+	chars->atten = a;
+	chars->bit_width = bit_width;
+	sim_advance (CAL_US);
+}
+
+// a linear stand-in for the IDF lookup tables, exact at v_ref 1100
+uint32_t esp_adc_cal_raw_to_voltage (uint32_t raw, const esp_adc_cal_characteristics_t *chars)
+{
+	int max = (1 << (9 + chars->bit_width)) - 1;
+
+	return (uint32_t)((int64_t)raw * atten_mv[chars->atten] * chars->v_ref / 1100 / max);
+}
+
+uint32_t adc1_to_voltage (adc1_channel_t channel, const esp_adc_cal_characteristics_t *chars)
+{
+	int raw = adc1_get_raw (channel);
+
+	if (raw < 0)
+		return 0;
+
+	return esp_adc_cal_raw_to_voltage (raw, chars);
+}
+
+// raw sensor counts, the app does not calibrate them
+uint32_t sim_tsens_raw (void)
+{
+	return 128 + sim_random (3);
+}
@@ -0,0 +1,436 @@
+/* GPIO and a 1-Wire bus with DS18B20 devices.
+ *
+ * The devices watch the bus pin: a LOW longer than 480us is a reset, a
+ * shorter one starts a time slot. Like the real thing, a device knows from
+ * its protocol state whether a slot is a write (it samples the line) or a
+ * read (it holds the line LOW for a 0 bit).
+*/
+
+#include "sim.h"
+
+#define RESET_US		480
+#define WRITE_0_US		15	// master LOW longer than this writes a 0
+#define TX_0_US			45	// a device holds a 0 bit this long
+#define PRESENCE_FROM_US	20
+#define PRESENCE_TO_US		140
+
+#define DS18B20_SEARCH_ROM		0xF0
+#define DS18B20_READ_ROM		0x33
+#define DS18B20_MATCH_ROM		0x55
+#define DS18B20_SKIP_ROM		0xCC
+#define DS18B20_CONVERT_T		0x44
+#define DS18B20_WRITE_SCRATCHPAD	0x4E
+#define DS18B20_READ_SCRATCHPAD		0xBE
+#define DS18B20_COPY_SCRATCHPAD		0x48
+#define DS18B20_RECALL_E		0xB8
+#define DS18B20_READ_POWER_SUPPLY	0xB4
+
+enum {
+	OW_IDLE = 0,		// not selected, wait for a reset
+	OW_ROM_CMD,		// rx
+	OW_MATCH,		// rx
+	OW_SEARCH,		// tx bit, tx ~bit, rx direction
+	OW_FUNC_CMD,		// rx
+	OW_WRITE_SP,		// rx
+	OW_TX,			// tx
+	OW_BUSY,		// tx 0 until done
+	OW_POWER,		// tx 1, we are not parasite powered
+};
+
+struct ow_dev {
+	struct sim_ds18b20 *ds;
+	int state;
+	int nbits;		// bits done in this state
+	int phase;		// search phase
+	uint8_t buf[9];
+	int len;		// bits in buf
+	uint64_t low_from;	// device pulls the bus LOW
+	uint64_t low_until;
+};
+
+static int out_enabled[SIM_NUM_GPIO];
+static int out_level[SIM_NUM_GPIO];
+static int out_periph[SIM_NUM_GPIO];	// driven by a peripheral (the RMT), idle HIGH
+
+static struct ow_dev ow_devs[SIM_MAX_OW];
+static int master_low = 0;
+static uint64_t slot_start;
+
+static uint8_t crc8 (const uint8_t *p, int len)
+{
+	uint8_t crc = 0;
+	int i;
+
+	while (len-- > 0) {
+		crc ^= *p++;
+		for (i = 0; i < 8; ++i)
+			crc = (crc & 1) ? (crc >> 1) ^ 0x8C : crc >> 1;
+	}
+	return crc;
+}
+
+static uint32_t conversion_us (const struct sim_ds18b20 *ds)
+{
+	return 93750 << ((ds->scratchpad[4] >> 5) & 3);
+}
+
+// complete a conversion that finished by now
+static void ds_update (struct sim_ds18b20 *ds, uint64_t now)
+{
+	int16_t t;
+	int res;
+
+	if (0 == ds->busy_until || now < ds->busy_until)
+		return;
+	ds->busy_until = 0;
+
+	res = (ds->scratchpad[4] >> 5) & 3;	// 9..12 bits
+	t = (int16_t)(ds->temp * 16);
+	t &= ~((1 << (3 - res)) - 1);		// undefined bits read as 0
+	ds->scratchpad[0] = t & 0xff;
+	ds->scratchpad[1] = (t >> 8) & 0xff;
+}
+
+void sim_ow_power_on (void)
+{
+	int i;
+
+	for (i = 0; i < sim->nds18b20; ++i) {
+		struct sim_ds18b20 *ds = &sim->ds18b20[i];
+
+		ds->rom[0] = 0x28;
+		ds->rom[1] = 0x10 + i;
+		ds->rom[2] = 0x5a;
+		ds->rom[3] = 0x78;
+		ds->rom[4] = 0x06;
+		ds->rom[5] = 0x00;
+		ds->rom[6] = 0x00;
+		ds->rom[7] = crc8 (ds->rom, 7);
+
+		ds->eeprom[0] = 0x4B;	// TH
+		ds->eeprom[1] = 0x46;	// TL
+		ds->eeprom[2] = 0x7F;	// 12 bits
+
+		ds->scratchpad[0] = 0x50;	// 85C until the first conversion
+		ds->scratchpad[1] = 0x05;
+		memcpy (ds->scratchpad+2, ds->eeprom, 3);
+		ds->scratchpad[5] = 0xFF;
+		ds->scratchpad[6] = 0x0C;
+		ds->scratchpad[7] = 0x10;
+
+		ds->temp = 20.5 + i;
+		ds->busy_until = 0;
+	}
+}
+
+static void ow_tx (struct ow_dev *dev, const uint8_t *data, int nbits)
+{
+	memcpy (dev->buf, data, (nbits + 7) / 8);
+	dev->len = nbits;
+	dev->nbits = 0;
+	dev->state = OW_TX;
+}
+
+static void ow_function (struct ow_dev *dev, uint8_t cmd, uint64_t now)
+{
+	struct sim_ds18b20 *ds = dev->ds;
+
+	dev->nbits = 0;
+	switch (cmd) {
+	case DS18B20_CONVERT_T:
+		ds_update (ds, now);
+		ds->busy_until = now + conversion_us (ds);
+		dev->state = OW_BUSY;
+		break;
+	case DS18B20_READ_SCRATCHPAD:
+		ds_update (ds, now);
+		ds->scratchpad[8] = crc8 (ds->scratchpad, 8);
+		ow_tx (dev, ds->scratchpad, 9*8);
+		break;
+	case DS18B20_WRITE_SCRATCHPAD:
+		dev->len = 3*8;
+		dev->state = OW_WRITE_SP;
+		break;
+	case DS18B20_COPY_SCRATCHPAD:
+		memcpy (ds->eeprom, ds->scratchpad+2, 3);
+		dev->state = OW_IDLE;
+		break;
+	case DS18B20_RECALL_E:
+		memcpy (ds->scratchpad+2, ds->eeprom, 3);
+		dev->state = OW_IDLE;
+		break;
+	case DS18B20_READ_POWER_SUPPLY:
+		dev->state = OW_POWER;
+		break;
+	default:
+		dev->state = OW_IDLE;
+		break;
+	}
+}
+
+static void ow_rom (struct ow_dev *dev, uint8_t cmd)
+{
+	dev->nbits = 0;
+	switch (cmd) {
+	case DS18B20_READ_ROM:
+		ow_tx (dev, dev->ds->rom, 8*8);
+		break;
+	case DS18B20_MATCH_ROM:
+		dev->state = OW_MATCH;
+		break;
+	case DS18B20_SKIP_ROM:
+		dev->state = OW_FUNC_CMD;
+		break;
+	case DS18B20_SEARCH_ROM:
+		dev->phase = 0;
+		dev->state = OW_SEARCH;
+		break;
+	default:
+		dev->state = OW_IDLE;
+		break;
+	}
+}
+
+static int rom_bit (struct ow_dev *dev, int n)
+{
+	return (dev->ds->rom[n / 8] >> (n % 8)) & 1;
+}
+
+// a slot starts, transmitting devices decide what to send
+static void ow_fall (uint64_t now)
+{
+	int i, bit;
+
+	for (i = 0; i < sim->nds18b20; ++i) {
+		struct ow_dev *dev = &ow_devs[i];
+
+		switch (dev->state) {
+		case OW_TX:
+			if (dev->nbits >= dev->len) {
+				dev->state = OW_IDLE;
+				continue;
+			}
+			bit = (dev->buf[dev->nbits / 8] >> (dev->nbits % 8)) & 1;
+			++dev->nbits;
+			break;
+		case OW_BUSY:
+			bit = dev->ds->busy_until && now < dev->ds->busy_until ? 0 : 1;
+			break;
+		case OW_SEARCH:
+			if (2 == dev->phase)
+				continue;
+			bit = rom_bit (dev, dev->nbits) ^ dev->phase;
+			break;
+		default:
+			continue;
+		}
+
+		if (!bit) {
+			dev->low_from = now;
+			dev->low_until = now + TX_0_US;
+		}
+	}
+}
+
+// a slot ends or a reset is done, receiving devices sample what was sent
+static void ow_rise (uint64_t now)
+{
+	uint32_t us = now - slot_start;
+	int i, bit;
+
+	if (us >= RESET_US) {
+		for (i = 0; i < sim->nds18b20; ++i) {
+			struct ow_dev *dev = &ow_devs[i];
+
+			dev->state = OW_ROM_CMD;
+			dev->nbits = 0;
+			dev->buf[0] = 0;
+			dev->low_from = now + PRESENCE_FROM_US;
+			dev->low_until = now + PRESENCE_TO_US;
+		}
+		return;
+	}
+
+	bit = us < WRITE_0_US;
+
+	for (i = 0; i < sim->nds18b20; ++i) {
+		struct ow_dev *dev = &ow_devs[i];
+		int n = dev->nbits;
+
+		switch (dev->state) {
+		case OW_ROM_CMD:
+		case OW_FUNC_CMD:
+			if (0 == n) dev->buf[0] = 0;
+			dev->buf[0] |= bit << n;
+			if (++dev->nbits < 8)
+				break;
+			if (OW_ROM_CMD == dev->state)
+				ow_rom (dev, dev->buf[0]);
+			else
+				ow_function (dev, dev->buf[0], now);
+			break;
+		case OW_MATCH:
+			if (bit != rom_bit (dev, n)) {
+				dev->state = OW_IDLE;
+				break;
+			}
+			if (++dev->nbits >= 64) {
+				dev->nbits = 0;
+				dev->buf[0] = 0;
+				dev->state = OW_FUNC_CMD;
+			}
+			break;
+		case OW_SEARCH:
+			if (2 != dev->phase) {	// we sent the bit or its complement
+				++dev->phase;
+				break;
+			}
+			if (bit != rom_bit (dev, n)) {
+				dev->state = OW_IDLE;
+				break;
+			}
+			dev->phase = 0;
+			if (++dev->nbits >= 64)
+				dev->state = OW_IDLE;
+			break;
+		case OW_WRITE_SP:
+			if (0 == n % 8) dev->buf[n / 8] = 0;
+			dev->buf[n / 8] |= bit << (n % 8);
+			if (++dev->nbits < dev->len)
+				break;
+			dev->ds->scratchpad[2] = dev->buf[0];
+			dev->ds->scratchpad[3] = dev->buf[1];
+			dev->ds->scratchpad[4] = (dev->buf[2] & 0x60) | 0x1F;
+			dev->state = OW_IDLE;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+// the master drives the bus at 'when', the GPIO now or the RMT at any time
+void sim_ow_drive (int pin, int low, uint64_t when)
+{
+	if (pin != sim->ow_pin)
+		return;
+
+	if (low == master_low)
+		return;
+	master_low = low;
+
+	if (low) {
+		slot_start = when;
+		ow_fall (when);
+	} else
+		ow_rise (when);
+}
+
+static void ow_update (int pin)
+{
+	int level = out_periph[pin] ? 1 : out_level[pin];
+
+	sim_ow_drive (pin, out_enabled[pin] && 0 == level, sim_now ());
+}
+
+// valid from the last sim_ow_drive() until the next one
+int sim_ow_level (uint64_t when)
+{
+	int i;
+
+	if (master_low)
+		return 0;
+
+	for (i = 0; i < sim->nds18b20; ++i)
+		if (when >= ow_devs[i].low_from && when < ow_devs[i].low_until)
+			return 0;
+
+	return 1;	// pulled up
+}
+
+// a deep sleep resets the pins, the devices keep their power
+void sim_gpio_init (void)
+{
+	int i;
+
+	memset (out_enabled, 0, sizeof(out_enabled));
+	memset (out_level, 0, sizeof(out_level));
+	memset (out_periph, 0, sizeof(out_periph));
+
+	master_low = 0;
+	memset (ow_devs, 0, sizeof(ow_devs));
+	for (i = 0; i < sim->nds18b20; ++i)
+		ow_devs[i].ds = &sim->ds18b20[i];
+}
+
+// back to the GPIO output register
+void gpio_pad_select_gpio (uint8_t gpio_num)
+{
+	if (gpio_num >= SIM_NUM_GPIO)
+		return;
+
+	out_periph[gpio_num] = 0;
+	ow_update (gpio_num);
+}
+
+esp_err_t gpio_set_direction (gpio_num_t gpio_num, gpio_mode_t mode)
+{
+	if (gpio_num < 0 || gpio_num >= SIM_NUM_GPIO)
+		return ESP_ERR_INVALID_ARG;
+
+	out_enabled[gpio_num] = GPIO_MODE_OUTPUT == mode
+		|| GPIO_MODE_OUTPUT_OD == mode
+		|| GPIO_MODE_INPUT_OUTPUT_OD == mode
+		|| GPIO_MODE_INPUT_OUTPUT == mode;
+	ow_update (gpio_num);
+
+	return ESP_OK;
+}
+
+esp_err_t gpio_set_level (gpio_num_t gpio_num, uint32_t level)
+{
+	if (gpio_num < 0 || gpio_num >= SIM_NUM_GPIO)
+		return ESP_ERR_INVALID_ARG;
+
+	out_level[gpio_num] = !!level;
+	ow_update (gpio_num);
+
+	return ESP_OK;
+}
+
+void gpio_matrix_out (uint32_t gpio, uint32_t signal_idx, bool out_inv, bool oen_inv)
+{
+	if (gpio >= SIM_NUM_GPIO)
+		return;
+
+	out_periph[gpio] = 1;
+	ow_update (gpio);
+}
+
+void gpio_matrix_in (uint32_t gpio, uint32_t signal_idx, bool inv)
+{
+}
+
+int gpio_get_level (gpio_num_t gpio_num)
+{
+	if (gpio_num < 0 || gpio_num >= SIM_NUM_GPIO)
+		return 0;
+
+	if (gpio_num == sim->ow_pin)
+		return sim_ow_level (sim_now ());
+
+	if (out_enabled[gpio_num])
+		return out_level[gpio_num];
+
+	return !sim->low_pins[gpio_num];
+}
+
+esp_err_t gpio_set_pull_mode (gpio_num_t gpio_num, gpio_pull_mode_t pull)
+{
+	return ESP_OK;
+}
+
+esp_err_t gpio_pullup_en (gpio_num_t gpio_num)
+{
+	return ESP_OK;
+}
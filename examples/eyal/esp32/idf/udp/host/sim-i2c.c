@@ -0,0 +1,366 @@
+/* I2C master driver and a BME280.
+ *
+ * Command links are recorded and then played against the device in
+ * i2c_master_cmd_begin(), which takes the bus time plus the driver overhead.
+ * The BME280 calibration and raw readings are the data sheet examples.
+*/
+
+#include <stdlib.h>
+
+#include "sim.h"
+
+#define BME280_ADDR		0x76
+#define REG_CAL00		0x88
+#define REG_CAL26		0xE1
+#define REG_CHIPID		0xD0
+#define REG_SOFTRESET		0xE0
+#define REG_CONTROL_HUM		0xF2
+#define REG_STATUS		0xF3
+#define REG_CONTROL		0xF4
+#define REG_CONFIG		0xF5
+#define REG_PRESS		0xF7
+
+#define CMD_BEGIN_US		60	// driver, interrupts, semaphores (rough)
+#define CMD_LINK_US		2	// malloc and queue one op (rough)
+
+#define ADC_T			519888	// 25.08C
+#define ADC_P			415148	// 1006.53hPa
+#define ADC_H			0x7000	// 47.6%
+
+enum {
+	OP_START,
+	OP_STOP,
+	OP_WRITE,
+	OP_READ,
+};
+
+struct sim_i2c_op {
+	int type;
+	uint8_t *data;		// read into
+	uint8_t byte;		// write_byte
+	size_t len;
+	int ack;
+};
+
+struct sim_i2c_cmd {
+	int nops;
+	int size;
+	struct sim_i2c_op *ops;
+};
+
+static int installed[2];
+static uint32_t clk_speed[2] = {100000, 100000};
+
+static const uint8_t cal00[26] = {
+	0x70, 0x6B,		// T1 27504
+	0x43, 0x67,		// T2 26435
+	0x18, 0xFC,		// T3 -1000
+	0x7D, 0x8E,		// P1 36477
+	0x43, 0xD6,		// P2 -10685
+	0xD0, 0x0B,		// P3 3024
+	0x27, 0x0B,		// P4 2855
+	0x8C, 0x00,		// P5 140
+	0xF9, 0xFF,		// P6 -7
+	0x8C, 0x3C,		// P7 15500
+	0xF8, 0xC6,		// P8 -14600
+	0x70, 0x17,		// P9 6000
+	0x00,
+	0x4B,			// H1 75
+};
+
+static const uint8_t cal26[7] = {
+	0x6A, 0x01,		// H2 362
+	0x00,			// H3 0
+	0x13, 0x29, 0x03,	// H4 313, H5 50
+	0x1E,			// H6 30
+};
+
+static void bme280_reset (void)
+{
+	struct sim_bme280 *b = &sim->bme280;
+
+	memset (b->regs, 0, sizeof(b->regs));
+	memcpy (b->regs + REG_CAL00, cal00, sizeof(cal00));
+	memcpy (b->regs + REG_CAL26, cal26, sizeof(cal26));
+	b->regs[REG_CHIPID] = 0x60;
+	b->regs[0xD1] = 0x01;
+
+	b->regs[REG_PRESS+0] = 0x80;	// no measurement yet
+	b->regs[REG_PRESS+3] = 0x80;
+	b->regs[REG_PRESS+6] = 0x80;
+
+	b->ready_at = 0;
+}
+
+void sim_bme280_power_on (void)
+{
+	bme280_reset ();
+}
+
+static int oversampling (int osrs)
+{
+	return osrs > 5 ? 16 : (1 << osrs) >> 1;	// 0,1,2,4,8,16
+}
+
+// data sheet, appendix B, max measurement time
+static uint32_t measurement_us (void)
+{
+	struct sim_bme280 *b = &sim->bme280;
+	int ost = oversampling ((b->regs[REG_CONTROL] >> 5) & 7);
+	int osp = oversampling ((b->regs[REG_CONTROL] >> 2) & 7);
+	int osh = oversampling (b->regs[REG_CONTROL_HUM] & 7);
+	uint32_t us = 1250;
+
+	if (ost) us += 2300 * ost;
+	if (osp) us += 2300 * osp + 575;
+	if (osh) us += 2300 * osh + 575;
+
+	return us;
+}
+
+// complete a measurement that finished by now
+static void bme280_update (uint64_t now)
+{
+	struct sim_bme280 *b = &sim->bme280;
+	uint8_t *r = b->regs + REG_PRESS;
+	int32_t t = ADC_T + sim_random (64) - 32;
+	int32_t p = ADC_P + sim_random (64) - 32;
+	int32_t h = ADC_H + sim_random (16) - 8;
+
+	if (0 == b->ready_at || now < b->ready_at)
+		return;
+	b->ready_at = 0;
+
+	if (!((b->regs[REG_CONTROL] >> 2) & 7)) p = 0x80000;
+	if (!((b->regs[REG_CONTROL] >> 5) & 7)) t = 0x80000;
+	if (!(b->regs[REG_CONTROL_HUM] & 7))    h = 0x8000;
+
+	r[0] = p >> 12; r[1] = p >> 4; r[2] = (p << 4) & 0xF0;
+	r[3] = t >> 12; r[4] = t >> 4; r[5] = (t << 4) & 0xF0;
+	r[6] = h >> 8;  r[7] = h;
+
+	b->regs[REG_CONTROL] &= ~3;	// back to sleep mode
+}
+
+static uint8_t bme280_read (uint8_t reg, uint64_t now)
+{
+	struct sim_bme280 *b = &sim->bme280;
+
+	bme280_update (now);
+	if (REG_STATUS == reg)
+		return b->ready_at ? 0x08 : 0x00;	// measuring
+
+	return b->regs[reg];
+}
+
+static void bme280_write (uint8_t reg, uint8_t val, uint64_t now)
+{
+	struct sim_bme280 *b = &sim->bme280;
+
+	bme280_update (now);
+	switch (reg) {
+	case REG_SOFTRESET:
+		if (0xB6 == val)
+			bme280_reset ();
+		break;
+	case REG_CONTROL_HUM:
+	case REG_CONFIG:
+		b->regs[reg] = val;
+		break;
+	case REG_CONTROL:
+		b->regs[reg] = val;
+		if (1 == (val & 3) || 2 == (val & 3))	// forced
+			b->ready_at = now + measurement_us ();
+		break;
+	default:
+		break;		// read only
+	}
+}
+
+void sim_i2c_init (int cold)
+{
+	memset (installed, 0, sizeof(installed));
+}
+
+esp_err_t i2c_param_config (i2c_port_t i2c_num, const i2c_config_t *i2c_conf)
+{
+	if (i2c_num < 0 || i2c_num > 1)
+		return ESP_ERR_INVALID_ARG;
+
+	clk_speed[i2c_num] = i2c_conf->master.clk_speed;
+	sim_advance (10);
+
+	return ESP_OK;
+}
+
+esp_err_t i2c_driver_install (i2c_port_t i2c_num, i2c_mode_t mode,
+	size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags)
+{
+	if (i2c_num < 0 || i2c_num > 1)
+		return ESP_ERR_INVALID_ARG;
+	if (installed[i2c_num])
+		return ESP_FAIL;
+
+	installed[i2c_num] = 1;
+	sim_advance (50);
+
+	return ESP_OK;
+}
+
+esp_err_t i2c_driver_delete (i2c_port_t i2c_num)
+{
+	if (i2c_num < 0 || i2c_num > 1)
+		return ESP_ERR_INVALID_ARG;
+
+	installed[i2c_num] = 0;
+
+	return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create (void)
+{
+	sim_advance (CMD_LINK_US);
+
+	return calloc (1, sizeof(struct sim_i2c_cmd));
+}
+
+void i2c_cmd_link_delete (i2c_cmd_handle_t cmd)
+{
+	if (NULL == cmd)
+		return;
+
+	sim_advance (CMD_LINK_US * (1 + cmd->nops));
+	free (cmd->ops);
+	free (cmd);
+}
+
+static esp_err_t add_op (i2c_cmd_handle_t cmd, int type, uint8_t *data, size_t len, int ack)
+{
+	struct sim_i2c_op *op;
+
+	if (NULL == cmd)
+		return ESP_ERR_INVALID_ARG;
+
+	if (cmd->nops >= cmd->size) {
+		int size = cmd->size ? 2*cmd->size : 8;
+
+		op = realloc (cmd->ops, size * sizeof(*op));
+		if (NULL == op)
+			return ESP_ERR_NO_MEM;
+		cmd->ops = op;
+		cmd->size = size;
+	}
+
+	op = &cmd->ops[cmd->nops++];
+	op->type = type;
+	op->data = data;
+	op->len = len;
+	op->ack = ack;
+	sim_advance (CMD_LINK_US);
+
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_start (i2c_cmd_handle_t cmd)
+{
+	return add_op (cmd, OP_START, NULL, 0, 0);
+}
+
+esp_err_t i2c_master_stop (i2c_cmd_handle_t cmd)
+{
+	return add_op (cmd, OP_STOP, NULL, 0, 0);
+}
+
+esp_err_t i2c_master_write_byte (i2c_cmd_handle_t cmd, uint8_t data, bool ack_en)
+{
+	esp_err_t ret = add_op (cmd, OP_WRITE, NULL, 1, ack_en);
+
+	if (ESP_OK == ret)
+		cmd->ops[cmd->nops-1].byte = data;
+	return ret;
+}
+
+esp_err_t i2c_master_write (i2c_cmd_handle_t cmd, uint8_t *data, size_t data_len, bool ack_en)
+{
+	return add_op (cmd, OP_WRITE, data, data_len, ack_en);
+}
+
+esp_err_t i2c_master_read_byte (i2c_cmd_handle_t cmd, uint8_t *data, int ack)
+{
+	return add_op (cmd, OP_READ, data, 1, ack);
+}
+
+esp_err_t i2c_master_read (i2c_cmd_handle_t cmd, uint8_t *data, size_t data_len, int ack)
+{
+	return add_op (cmd, OP_READ, data, data_len, ack);
+}
+
+// The BME280 takes register/value pairs when written to, and reads
+// auto-increment from the last register written.
+esp_err_t i2c_master_cmd_begin (i2c_port_t i2c_num, i2c_cmd_handle_t cmd, TickType_t ticks_to_wait)
+{
+	uint64_t now = sim_now ();
+	uint64_t bits = 0;
+	static uint8_t reg;		// the device's register pointer
+	int addressed = 0;		// next byte is an address
+	int selected = 0;
+	int nwritten = 0;
+	esp_err_t ret = ESP_OK;
+	int i;
+	size_t j;
+
+	if (i2c_num < 0 || i2c_num > 1 || NULL == cmd)
+		return ESP_ERR_INVALID_ARG;
+	if (!installed[i2c_num])
+		return ESP_FAIL;
+
+	for (i = 0; i < cmd->nops && ESP_OK == ret; ++i) {
+		struct sim_i2c_op *op = &cmd->ops[i];
+
+		switch (op->type) {
+		case OP_START:
+			bits += 2;
+			addressed = 1;
+			break;
+		case OP_STOP:
+			bits += 2;
+			selected = 0;
+			break;
+		case OP_WRITE:
+			for (j = 0; j < op->len; ++j) {
+				uint8_t b = op->data ? op->data[j] : op->byte;
+
+				bits += 9;
+				if (addressed) {
+					addressed = 0;
+					selected = sim->have_bme280 && BME280_ADDR == (b >> 1);
+					nwritten = 0;
+					if (!selected && op->ack) {
+						ret = ESP_FAIL;		// NACK
+						break;
+					}
+					continue;
+				}
+				if (!selected)
+					continue;
+				if (0 == nwritten++ % 2)
+					reg = b;
+				else
+					bme280_write (reg, b, now + bits * 1000000 / clk_speed[i2c_num]);
+			}
+			break;
+		case OP_READ:
+			for (j = 0; j < op->len; ++j) {
+				bits += 9;
+				op->data[j] = selected
+					? bme280_read (reg++, now + bits * 1000000 / clk_speed[i2c_num])
+					: 0xFF;
+			}
+			break;
+		}
+	}
+
+	sim_advance (CMD_BEGIN_US + bits * 1000000 / clk_speed[i2c_num]);
+
+	return ret;
+}
@@ -0,0 +1,286 @@
+/* The RMT peripheral, only as much as a 1-Wire bus needs.
+ *
+ * A TX channel plays its items on the 1-Wire bus. An RX channel on the
+ * same pin records the bus from the first edge until it sees no edge for
+ * the idle threshold, then hands the items to its ring buffer.
+*/
+
+#include "sim.h"
+
+#define RMT_CALL_US		15	// driver work before the first item goes out
+#define RMT_MAX_ITEMS		256
+#define RMT_MAX_EDGES		(2*RMT_MAX_ITEMS)
+#define RMT_MAX_US		100000	// give up recording after this
+
+struct sim_ringbuf {
+	int full;			// a frame waits for the reader
+	int taken;
+	uint64_t ready_at;		// when the RX idle ended the frame
+	size_t size;
+	rmt_item32_t items[RMT_MAX_ITEMS];
+};
+
+struct rmt_chan {
+	rmt_config_t conf;
+	int configured;
+	int installed;
+	int rx_on;
+	uint16_t idle;			// RX idle threshold, ticks
+	struct sim_ringbuf rb;
+};
+
+struct edge {
+	uint64_t when;
+	int low;
+};
+
+static struct rmt_chan chans[RMT_CHANNEL_MAX];
+
+static uint64_t ticks_to_us (const struct rmt_chan *ch, uint32_t ticks)
+{
+	return (uint64_t)ticks * ch->conf.clk_div / 80;		// APB is 80MHz
+}
+
+static uint32_t us_to_ticks (const struct rmt_chan *ch, uint64_t us)
+{
+	uint64_t ticks = us * 80 / ch->conf.clk_div;
+
+	return ticks > 0x7fff ? 0x7fff : ticks;
+}
+
+// a deep sleep resets the peripheral
+void sim_rmt_init (void)
+{
+	memset (chans, 0, sizeof(chans));
+}
+
+esp_err_t rmt_config (const rmt_config_t *rmt_param)
+{
+	struct rmt_chan *ch;
+
+	if (rmt_param->channel >= RMT_CHANNEL_MAX || 0 == rmt_param->clk_div)
+		return ESP_ERR_INVALID_ARG;
+	ch = &chans[rmt_param->channel];
+
+	ch->conf = *rmt_param;
+	ch->configured = 1;
+	if (RMT_MODE_RX == rmt_param->rmt_mode) {
+		ch->idle = rmt_param->rx_config.idle_threshold;
+		gpio_set_direction (rmt_param->gpio_num, GPIO_MODE_INPUT);
+		gpio_matrix_in (rmt_param->gpio_num, RMT_SIG_IN0_IDX + rmt_param->channel, 0);
+	} else {
+		gpio_matrix_out (rmt_param->gpio_num, RMT_SIG_OUT0_IDX + rmt_param->channel, 0, 0);
+		gpio_set_direction (rmt_param->gpio_num, GPIO_MODE_OUTPUT);
+	}
+	sim_advance (10);
+
+	return ESP_OK;
+}
+
+esp_err_t rmt_driver_install (rmt_channel_t channel, size_t rx_buf_size, int intr_alloc_flags)
+{
+	if (channel >= RMT_CHANNEL_MAX || !chans[channel].configured)
+		return ESP_ERR_INVALID_ARG;
+	if (chans[channel].installed)
+		return ESP_ERR_INVALID_STATE;
+
+	chans[channel].installed = 1;
+	sim_advance (30);
+
+	return ESP_OK;
+}
+
+esp_err_t rmt_get_ringbuf_handle (rmt_channel_t channel, RingbufHandle_t *buf_handle)
+{
+	if (channel >= RMT_CHANNEL_MAX || !chans[channel].installed)
+		return ESP_ERR_INVALID_ARG;
+
+	*buf_handle = &chans[channel].rb;
+
+	return ESP_OK;
+}
+
+esp_err_t rmt_set_rx_idle_thresh (rmt_channel_t channel, uint16_t thresh)
+{
+	if (channel >= RMT_CHANNEL_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	chans[channel].idle = thresh;
+
+	return ESP_OK;
+}
+
+esp_err_t rmt_rx_start (rmt_channel_t channel, bool rx_idx_rst)
+{
+	if (channel >= RMT_CHANNEL_MAX || !chans[channel].installed)
+		return ESP_ERR_INVALID_ARG;
+
+	chans[channel].rx_on = 1;
+
+	return ESP_OK;
+}
+
+esp_err_t rmt_rx_stop (rmt_channel_t channel)
+{
+	if (channel >= RMT_CHANNEL_MAX)
+		return ESP_ERR_INVALID_ARG;
+
+	chans[channel].rx_on = 0;
+
+	return ESP_OK;
+}
+
+static void rx_add (struct rmt_chan *rx, int *half, int level, uint32_t ticks)
+{
+	struct sim_ringbuf *rb = &rx->rb;
+	rmt_item32_t *item;
+
+	if (rb->size >= RMT_MAX_ITEMS)
+		return;		// overrun, the frame is cut short
+	item = &rb->items[rb->size];
+
+	if (0 == *half) {
+		item->val = 0;
+		item->level0 = level;
+		item->duration0 = ticks;
+		*half = 1;
+	} else {
+		item->level1 = level;
+		item->duration1 = ticks;
+		*half = 0;
+		++rb->size;
+	}
+}
+
+// drive the bus with the TX edges, record it if 'rx' is listening
+static uint64_t play (struct rmt_chan *rx, int pin, const struct edge *edges, int nedges)
+{
+	struct sim_ringbuf *rb;
+	uint64_t t, start, last = 0;
+	int level = 1, started = 0, half = 0;
+	int k = 0;
+
+	if (NULL == rx) {
+		for (k = 0; k < nedges; ++k)
+			sim_ow_drive (pin, edges[k].low, edges[k].when);
+		return 0;
+	}
+
+	rb = &rx->rb;
+	rb->size = 0;
+	start = edges[0].when;
+	for (t = start; t < start + RMT_MAX_US; ++t) {
+		int l;
+
+		for (; k < nedges && edges[k].when <= t; ++k)
+			sim_ow_drive (pin, edges[k].low, edges[k].when);
+
+		l = sim_ow_level (t);
+		if (l != level) {
+			if (started)
+				rx_add (rx, &half, level, us_to_ticks (rx, t - last));
+			started = 1;
+			last = t;
+			level = l;
+		} else if (started && t - last >= ticks_to_us (rx, rx->idle))
+			break;			// idle, the frame is done
+		else if (!started && k >= nedges)
+			break;			// nothing happened
+	}
+	for (; k < nedges; ++k)
+		sim_ow_drive (pin, edges[k].low, edges[k].when);
+
+	if (!started)
+		return 0;
+
+	rx_add (rx, &half, level, 0);	// the end marker
+	if (half)
+		rx_add (rx, &half, level, 0);
+	rb->size *= sizeof(rmt_item32_t);
+	rb->ready_at = t;
+	rb->full = 1;
+	rb->taken = 0;
+
+	return t;
+}
+
+esp_err_t rmt_write_items (rmt_channel_t channel, const rmt_item32_t *rmt_item,
+	int item_num, bool wait_tx_done)
+{
+	static struct edge edges[RMT_MAX_EDGES+1];
+	struct rmt_chan *tx, *rx = NULL;
+	uint64_t t, now;
+	int nedges = 0;
+	int i;
+
+	if (channel >= RMT_CHANNEL_MAX || !chans[channel].installed)
+		return ESP_ERR_INVALID_ARG;
+	tx = &chans[channel];
+	if (RMT_MODE_TX != tx->conf.rmt_mode || item_num > RMT_MAX_ITEMS)
+		return ESP_ERR_INVALID_ARG;
+
+	for (i = 0; i < RMT_CHANNEL_MAX; ++i)
+		if (chans[i].rx_on && chans[i].conf.gpio_num == tx->conf.gpio_num)
+			rx = &chans[i];
+
+	t = sim_now () + RMT_CALL_US;
+	for (i = 0; i < item_num; ++i) {
+		const rmt_item32_t *item = &rmt_item[i];
+
+		if (0 == item->duration0)
+			break;
+		edges[nedges].when = t;
+		edges[nedges++].low = !item->level0;
+		t += ticks_to_us (tx, item->duration0);
+
+		if (0 == item->duration1)
+			break;
+		edges[nedges].when = t;
+		edges[nedges++].low = !item->level1;
+		t += ticks_to_us (tx, item->duration1);
+	}
+	edges[nedges].when = t;		// back to idle
+	edges[nedges++].low = RMT_IDLE_LEVEL_LOW == tx->conf.tx_config.idle_level;
+
+	play (rx, tx->conf.gpio_num, edges, nedges);
+
+	now = sim_now ();
+	if (wait_tx_done && t > now)
+		sim_advance (t - now);		// the task blocks, others may run
+	else
+		sim_advance (RMT_CALL_US);
+
+	return ESP_OK;
+}
+
+void *xRingbufferReceive (RingbufHandle_t ringbuf, size_t *item_size, TickType_t ticks_to_wait)
+{
+	uint64_t now = sim_now ();
+	uint64_t timeout = (portMAX_DELAY == ticks_to_wait) ? RMT_MAX_US
+		: (uint64_t)ticks_to_wait * portTICK_PERIOD_MS * 1000;
+
+	if (!ringbuf->full || ringbuf->taken) {
+		sim_advance (timeout);
+		return NULL;
+	}
+
+	if (ringbuf->ready_at > now) {
+		if (ringbuf->ready_at - now > timeout) {
+			sim_advance (timeout);
+			return NULL;
+		}
+		sim_advance (ringbuf->ready_at - now);
+	}
+	sim_advance (5);
+
+	ringbuf->taken = 1;
+	*item_size = ringbuf->size;
+
+	return ringbuf->items;
+}
+
+void vRingbufferReturnItem (RingbufHandle_t ringbuf, void *item)
+{
+	ringbuf->full = 0;
+	ringbuf->taken = 0;
+}
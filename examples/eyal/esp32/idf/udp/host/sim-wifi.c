@@ -0,0 +1,555 @@
+/* WiFi, event loop, lwIP address helpers, the UDP socket and raw udp.
+ *
+ * System events are delivered from sim_at() timers, the handler runs in
+ * the event loop task's place. The durations are rough figures taken from
+ * the app's own Log() timestamps on an esp-32a.
+*/
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+
+#include "sim.h"
+
+#define EVENT_LOOP_US		1000
+#define TCPIP_INIT_US		1500
+#define NVS_INIT_US		12000
+#define NVS_READ_US		300	// find the entry, read and check it
+#define NVS_WRITE_US		8000	// write the entry, erase the old one
+#define NVS_HANDLES		4
+#define WIFI_INIT_US		35000
+#define WIFI_START_US		45000	// STA_START follows
+#define STATIC_IP_US		2000	// CONNECTED to GOT_IP without dhcp
+#define DISCONNECT_US		5000
+#define SENDTO_US		300	// copy into a pbuf and queue it
+#define TCPIP_CALL_US		50	// to the tcpip thread and back
+#define UDP_SENDTO_US		100	// headers onto the pbuf, queue it
+#define ASSOC_TX_US		3000	// radio TX time: auth, assoc, eapol
+#define DHCP_TX_US		2000	// discover, request
+#define SENDTO_TX_US		1000	// one frame, with retries
+#define ARP_US			2000	// the server's MAC, before the frame goes
+#define ARP_LEN			42
+#define SERVER_MAC		"\x00\x1b\x21\x0a\x0b\x0c"
+#define STA_MAC			"\x24\x0a\xc4\x01\x02\x03"
+#define SOCKET_FD		100	// not a real host fd
+
+#define AP_BSSID		"\x00\x11\x22\x33\x44\x55"
+#define AP_CHANNEL		6
+
+#define REASON_ASSOC_LEAVE	8
+#define REASON_NO_AP_FOUND	201
+
+static system_event_cb_t handler;
+static void *handler_ctx;
+static int started;
+static int connected;
+static int have_ip;
+static int dhcp = 1;
+static int attempts;
+static wifi_storage_t storage;
+static wifi_config_t sta_config;
+static wifi_txdone_cb_t txcb;
+static struct netif sta_netif;
+static struct dhcp sta_dhcp;
+static struct eth_addr arp_mac;		// the server's, when known
+static ip4_addr_t arp_ip;
+static int arp_known;
+
+static void post (system_event_id_t id, system_event_info_t *info)
+{
+	system_event_t event;
+
+	memset (&event, 0, sizeof(event));
+	event.event_id = id;
+	if (NULL != info)
+		event.event_info = *info;
+
+	if (NULL != handler)
+		handler (handler_ctx, &event);
+}
+
+static void sta_start (void *arg)
+{
+	post (SYSTEM_EVENT_STA_START, NULL);
+}
+
+static void got_ip (void *arg)
+{
+	system_event_info_t info;
+
+	if (!connected)
+		return;
+	have_ip = 1;
+	if (dhcp)
+		sim_radio_tx (DHCP_TX_US);
+
+	memset (&info, 0, sizeof(info));
+	ip4addr_aton ("192.168.2.62", &info.got_ip.ip_info.ip);
+	ip4addr_aton ("255.255.255.0", &info.got_ip.ip_info.netmask);
+	ip4addr_aton ("192.168.2.7", &info.got_ip.ip_info.gw);
+	sta_netif.ip_addr = info.got_ip.ip_info.ip;
+	sta_netif.netmask = info.got_ip.ip_info.netmask;
+	sta_netif.gw = info.got_ip.ip_info.gw;
+	memcpy (sta_netif.hwaddr, STA_MAC, 6);
+	sta_dhcp.offered_t0_lease = sim->lease_s;
+	sta_dhcp.offered_t1_renew = sim->lease_s / 2;
+	sta_netif.dhcp = dhcp ? &sta_dhcp : NULL;
+	post (SYSTEM_EVENT_STA_GOT_IP, &info);
+}
+
+static void sta_connected (void *arg)
+{
+	system_event_info_t info;
+
+	connected = 1;
+	sim_radio_tx (ASSOC_TX_US);
+
+	memset (&info, 0, sizeof(info));
+	memcpy (info.connected.ssid, sta_config.sta.ssid, sizeof(info.connected.ssid));
+	info.connected.ssid_len = strlen ((char *)sta_config.sta.ssid);
+	memcpy (info.connected.bssid, AP_BSSID, 6);
+	info.connected.channel = AP_CHANNEL;
+	post (SYSTEM_EVENT_STA_CONNECTED, &info);
+
+	sim_at (sim_now () + (dhcp ? sim->dhcp_ms * 1000 : STATIC_IP_US), got_ip, NULL);
+}
+
+static void sta_disconnected (void *arg)
+{
+	system_event_info_t info;
+
+	connected = have_ip = 0;
+
+	memset (&info, 0, sizeof(info));
+	info.disconnected.reason = (uint8_t)(intptr_t)arg;
+	post (SYSTEM_EVENT_STA_DISCONNECTED, &info);
+}
+
+void sim_wifi_init (void)
+{
+	handler = NULL;
+	txcb = NULL;
+	arp_known = 0;
+	started = connected = have_ip = 0;
+	dhcp = 1;
+	attempts = 0;
+}
+
+esp_err_t esp_event_loop_init (system_event_cb_t cb, void *ctx)
+{
+	if (NULL != handler)
+		return ESP_FAIL;
+
+	handler = cb;
+	handler_ctx = ctx;
+	sim_advance (EVENT_LOOP_US);
+
+	return ESP_OK;
+}
+
+void tcpip_adapter_init (void)
+{
+	sim_advance (TCPIP_INIT_US);
+}
+
+esp_err_t tcpip_adapter_dhcpc_stop (tcpip_adapter_if_t tcpip_if)
+{
+	dhcp = 0;
+	return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_dhcpc_start (tcpip_adapter_if_t tcpip_if)
+{
+	dhcp = 1;
+	return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_set_ip_info (tcpip_adapter_if_t tcpip_if, tcpip_adapter_ip_info_t *ip_info)
+{
+	return ESP_OK;
+}
+
+esp_err_t tcpip_adapter_get_netif (tcpip_adapter_if_t tcpip_if, void **netif)
+{
+	*netif = &sta_netif;
+	return ESP_OK;
+}
+
+static int nvs_ready = 0;
+static struct {
+	char ns[16];
+	nvs_open_mode mode;
+} nvs_open_ns[NVS_HANDLES];	// handle is the index + 1
+
+esp_err_t nvs_flash_init (void)
+{
+	sim_advance (NVS_INIT_US);
+	nvs_ready = 1;
+	return ESP_OK;
+}
+
+esp_err_t nvs_open (const char *name, nvs_open_mode open_mode, nvs_handle *out_handle)
+{
+	int i;
+
+	if (!nvs_ready)
+		return ESP_ERR_NVS_NOT_INITIALIZED;
+	for (i = 0; i < NVS_HANDLES; ++i)
+		if ('\0' == nvs_open_ns[i].ns[0]) {
+			snprintf (nvs_open_ns[i].ns, sizeof(nvs_open_ns[i].ns), "%s", name);
+			nvs_open_ns[i].mode = open_mode;
+			*out_handle = i + 1;
+			return ESP_OK;
+		}
+	return ESP_ERR_NO_MEM;
+}
+
+void nvs_close (nvs_handle handle)
+{
+	if (handle >= 1 && handle <= NVS_HANDLES)
+		nvs_open_ns[handle-1].ns[0] = '\0';
+}
+
+static struct sim_nvs *nvs_find (nvs_handle handle, const char *key, int create)
+{
+	const char *ns = nvs_open_ns[handle-1].ns;
+	int i;
+
+	for (i = 0; i < SIM_NVS_KEYS; ++i)
+		if (!strcmp (sim->nvs[i].ns, ns) && !strcmp (sim->nvs[i].key, key))
+			return &sim->nvs[i];
+	if (create)
+		for (i = 0; i < SIM_NVS_KEYS; ++i)
+			if ('\0' == sim->nvs[i].ns[0]) {
+				snprintf (sim->nvs[i].ns, sizeof(sim->nvs[i].ns), "%s", ns);
+				snprintf (sim->nvs[i].key, sizeof(sim->nvs[i].key), "%s", key);
+				return &sim->nvs[i];
+			}
+	return NULL;
+}
+
+esp_err_t nvs_get_blob (nvs_handle handle, const char *key, void *out_value, size_t *length)
+{
+	struct sim_nvs *e;
+
+	if (handle < 1 || handle > NVS_HANDLES || '\0' == nvs_open_ns[handle-1].ns[0])
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	sim_advance (NVS_READ_US);
+	if (NULL == (e = nvs_find (handle, key, 0)))
+		return ESP_ERR_NVS_NOT_FOUND;
+	if (NULL == out_value) {
+		*length = e->len;
+		return ESP_OK;
+	}
+	if (*length < e->len)
+		return ESP_ERR_NVS_INVALID_LENGTH;
+	memcpy (out_value, e->data, e->len);
+	*length = e->len;
+	return ESP_OK;
+}
+
+esp_err_t nvs_set_blob (nvs_handle handle, const char *key, const void *value, size_t length)
+{
+	struct sim_nvs *e;
+
+	if (handle < 1 || handle > NVS_HANDLES || '\0' == nvs_open_ns[handle-1].ns[0]
+	    || NVS_READWRITE != nvs_open_ns[handle-1].mode)
+		return ESP_ERR_NVS_INVALID_HANDLE;
+	if (length > SIM_NVS_BLOB || NULL == (e = nvs_find (handle, key, 1)))
+		return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+	sim_advance (NVS_WRITE_US);
+	memcpy (e->data, value, length);
+	e->len = length;
+	return ESP_OK;
+}
+
+esp_err_t nvs_commit (nvs_handle handle)
+{
+	return ESP_OK;		// nvs_set_blob() already wrote it
+}
+
+esp_err_t esp_wifi_init (const wifi_init_config_t *config)
+{
+	storage = WIFI_STORAGE_FLASH;
+	sta_config = sim->wifi_flash;
+	sim_advance (WIFI_INIT_US);
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_storage (wifi_storage_t s)
+{
+	storage = s;
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_set_mode (wifi_mode_t mode)
+{
+	return WIFI_MODE_STA == mode ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+// the flash copy outlives deep sleep, and costs a flash write
+esp_err_t esp_wifi_set_config (esp_interface_t interface, wifi_config_t *conf)
+{
+	sta_config = *conf;
+	if (WIFI_STORAGE_FLASH == storage) {
+		sim->wifi_flash = *conf;
+		sim_advance (500);
+	} else
+		sim_advance (20);
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_get_config (esp_interface_t interface, wifi_config_t *conf)
+{
+	*conf = sta_config;
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_internal_reg_txcb (wifi_txdone_cb_t fn)
+{
+	txcb = fn;
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_start (void)
+{
+	if (started)
+		return ESP_OK;
+
+	started = 1;
+	sim_radio_on ();
+	sim_advance (WIFI_START_US);
+	sim_at (sim_now (), sta_start, NULL);
+
+	return ESP_OK;
+}
+
+// A known bssid on the right channel needs no scan. A wrong one is
+// not found after a full scan.
+esp_err_t esp_wifi_connect (void)
+{
+	const wifi_sta_config_t *sta = &sta_config.sta;
+	uint64_t when = sim_now () + sim->assoc_ms * 1000;
+
+	if (!started)
+		return ESP_ERR_INVALID_STATE;
+
+	if (sta->bssid_set && 0 == memcmp (sta->bssid, AP_BSSID, 6) && AP_CHANNEL == sta->channel)
+		when = sim_now () + sim->direct_ms * 1000;
+
+	if (sta->bssid_set && 0 != memcmp (sta->bssid, AP_BSSID, 6))
+		sim_at (when, sta_disconnected, (void *)(intptr_t)REASON_NO_AP_FOUND);
+	else if (0 == attempts++ && sim->assoc_fail > 0 && 0 == sim->wake % sim->assoc_fail)
+		sim_at (when, sta_disconnected, (void *)(intptr_t)REASON_NO_AP_FOUND);
+	else
+		sim_at (when, sta_connected, NULL);
+
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_disconnect (void)
+{
+	if (!connected)
+		return ESP_OK;
+
+	sim_at (sim_now () + DISCONNECT_US, sta_disconnected, (void *)(intptr_t)REASON_ASSOC_LEAVE);
+
+	return ESP_OK;
+}
+
+esp_err_t esp_wifi_sta_get_ap_info (wifi_ap_record_t *ap_info)
+{
+	if (!connected)
+		return ESP_FAIL;
+
+	memset (ap_info, 0, sizeof(*ap_info));
+	memcpy (ap_info->bssid, AP_BSSID, 6);
+	memcpy (ap_info->ssid, sta_config.sta.ssid, sizeof(sta_config.sta.ssid));
+	ap_info->primary = AP_CHANNEL;
+	ap_info->rssi = -60 - sim_random (10);
+
+	return ESP_OK;
+}
+
+int ip4addr_aton (const char *cp, ip4_addr_t *addr)
+{
+	struct in_addr in;
+
+	if (0 == inet_aton (cp, &in))
+		return 0;
+
+	addr->addr = in.s_addr;
+	return 1;
+}
+
+char *ip4addr_ntoa_r (const ip4_addr_t *addr, char *buf, int buflen)
+{
+	struct in_addr in = {.s_addr = addr->addr};
+
+	return (char *)inet_ntop (AF_INET, &in, buf, buflen);
+}
+
+// the MAC is done with a frame, acked
+static void tx_done (void *arg)
+{
+	uint16_t len = (uint16_t)(intptr_t)arg;
+
+	if (NULL != txcb)
+		txcb (sim->msg, &len, true);
+}
+
+// the message is in sim->msg, hand it to the radio
+static void transmit (size_t len, uint32_t us)
+{
+	uint32_t done_us = SENDTO_TX_US;
+
+	sim->msg_len = len;
+	++sim->sent;
+	sim_advance (us);
+	sim_radio_tx (SENDTO_TX_US);
+
+	// without the server's MAC an ARP request goes first, the message
+	// when the reply is in
+	if (!arp_known) {
+		sim_at (sim_now () + SENDTO_TX_US / 4, tx_done, (void *)(intptr_t)ARP_LEN);
+		done_us += ARP_US;
+		memcpy (arp_mac.addr, SERVER_MAC, 6);
+		ip4addr_aton ("192.168.2.7", &arp_ip);
+		arp_known = 1;
+		++sim->arps;
+	}
+	if (0 == sim->txdone_lost || 0 != sim->wake % sim->txdone_lost)
+		sim_at (sim_now () + done_us, tx_done, (void *)(intptr_t)len);
+}
+
+/* These replace the libc socket calls for the whole program, the
+ * simulator itself does not use the network.
+ */
+int socket (int domain, int type, int protocol)
+{
+	if (AF_INET != domain || SOCK_DGRAM != type) {
+		errno = EAFNOSUPPORT;
+		return -1;
+	}
+
+	sim_advance (50);
+	return SOCKET_FD + sim->sockets++;
+}
+
+ssize_t sendto (int sockfd, const void *buf, size_t len, int flags,
+	const struct sockaddr *dest_addr, socklen_t addrlen)
+{
+	if (sockfd < SOCKET_FD || sockfd >= SOCKET_FD + sim->sockets) {
+		errno = EBADF;
+		return -1;
+	}
+	if (!have_ip) {
+		errno = EHOSTUNREACH;
+		return -1;
+	}
+	if (len > SIM_MSG_SIZE) {
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	memcpy (sim->msg, buf, len);
+	transmit (len, SENDTO_US);
+
+	return len;
+}
+
+/* lwIP raw udp, the pcb and pbufs are only what the app touches */
+struct udp_pcb {
+	int fd;
+};
+
+err_t tcpip_api_call (tcpip_api_call_fn fn, struct tcpip_api_call_data *call)
+{
+	sim_advance (TCPIP_CALL_US);
+	call->err = fn (call);
+	return call->err;
+}
+
+struct udp_pcb *udp_new (void)
+{
+	struct udp_pcb *pcb = calloc (1, sizeof(*pcb));
+
+	if (NULL != pcb)
+		pcb->fd = SOCKET_FD + sim->sockets++;
+	return pcb;
+}
+
+void udp_remove (struct udp_pcb *pcb)
+{
+	free (pcb);
+}
+
+struct netif *ip4_route (const ip4_addr_t *dest)
+{
+	return have_ip ? &sta_netif : NULL;
+}
+
+// Only an ARP reply to us is looked at, its sender goes into the ARP
+// table. A wrong MAC is taken, the message then goes nowhere.
+err_t ethernet_input (struct pbuf *p, struct netif *netif)
+{
+	const uint8_t *f = p->payload;
+
+	if (have_ip && p->len >= ARP_LEN
+	    && 0x08 == f[12] && 0x06 == f[13] && 0x02 == f[21]
+	    && !memcmp (f+38, &netif->ip_addr, 4)) {
+		memcpy (arp_mac.addr, f+22, 6);
+		memcpy (&arp_ip, f+28, 4);
+		arp_known = 1;
+	}
+	pbuf_free (p);
+	return ERR_OK;
+}
+
+int8_t etharp_find_addr (struct netif *netif, const ip4_addr_t *ipaddr,
+	struct eth_addr **eth_ret, const ip4_addr_t **ip_ret)
+{
+	if (!arp_known || arp_ip.addr != ipaddr->addr)
+		return -1;
+
+	*eth_ret = &arp_mac;
+	*ip_ret = &arp_ip;
+	return 0;
+}
+
+struct pbuf *pbuf_alloc (pbuf_layer layer, uint16_t length, pbuf_type type)
+{
+	struct pbuf *p = calloc (1, sizeof(*p) + (PBUF_REF == type ? 0 : length));
+
+	if (NULL == p)
+		return NULL;
+	p->payload = (PBUF_REF == type) ? NULL : p + 1;
+	p->tot_len = p->len = length;
+	p->type = type;
+	p->ref = 1;
+	return p;
+}
+
+uint8_t pbuf_free (struct pbuf *p)
+{
+	if (NULL == p || --p->ref > 0)
+		return 0;
+	free (p);
+	return 1;
+}
+
+err_t udp_sendto (struct udp_pcb *pcb, struct pbuf *p, const ip_addr_t *dst_ip, uint16_t dst_port)
+{
+	if (NULL == pcb || NULL == p || NULL == p->payload)
+		return ERR_ARG;
+	if (!have_ip)
+		return ERR_RTE;
+	if (p->tot_len > SIM_MSG_SIZE)
+		return ERR_MEM;
+
+	memcpy (sim->msg, p->payload, p->len);
+	transmit (p->len, UDP_SENDTO_US);
+
+	return ERR_OK;
+}
@@ -0,0 +1,778 @@
+/* Host (Linux) simulation of the udp app wake cycle.
+ *
+ * Each wake runs in a fresh child process, so that .data/.bss start out
+ * clean like after a deep sleep reset, while the RTC_DATA_ATTR section and
+ * the device models are carried over by the parent.
+ *
+ * Time is simulated. It only moves when the app waits (ets_delay_us,
+ * vTaskDelay, event groups, the uart draining) or when a modelled device
+ * or driver call takes time. Tasks are coroutines that each run on their
+ * own simulated core, the scheduler always runs the one furthest behind.
+*/
+
+#include <stdlib.h>
+#include <stdarg.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "sim.h"
+#include "msg.h"
+#include "msg-decode.h"
+
+#define TASK_STACK		(256*1024)	// host printf needs more than the app asks for
+#define MAX_TIMERS		16
+#define UART_FIFO		128		// bytes
+#define SLOW_CLK_HZ		150000		// RTC slow clock, nominal
+
+enum {
+	TASK_FREE = 0,
+	TASK_READY,
+	TASK_WAITING,
+	TASK_DELETED,
+};
+
+struct sim_event_group {
+	EventBits_t bits;
+};
+
+struct sim_task {
+	const char *name;
+	TaskFunction_t func;
+	void *param;
+	int state;
+	uint64_t now;			// this task's (core's) time
+	uint64_t wait_until;		// 0 = forever
+	EventGroupHandle_t group;
+	EventBits_t bits;
+	BaseType_t all;
+	BaseType_t clear;
+	EventBits_t result;
+	ucontext_t ctx;
+	char *stack;
+};
+
+struct sim_timer {
+	int used;
+	uint64_t when;
+	void (*func)(void *);
+	void *arg;
+};
+
+struct sim_shared *sim;
+
+extern uint8_t __start_rtc_data[];	// provided by the linker
+extern uint8_t __stop_rtc_data[];
+
+void app_main(void);
+
+static struct sim_task tasks[SIM_MAX_TASKS];
+static struct sim_task *current = NULL;	// NULL: scheduler or timer callback
+static ucontext_t sched_ctx;
+static uint64_t sched_now;
+static struct sim_timer timers[MAX_TIMERS];
+
+static double cpu_scale = 0;		// host cpu time to simulated time
+static uint64_t cpu_last;
+
+static uint64_t uart_idle_at;		// uart tx fifo will be empty
+static FILE *report;			// the simulator's own output
+
+/////////////////////////////// time ///////////////////////////////
+
+static uint64_t cpu_ns (void)
+{
+	struct timespec ts;
+
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &ts);
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void cpu_account (void)
+{
+	uint64_t ns;
+
+	if (cpu_scale <= 0 || NULL == current)
+		return;
+
+	ns = cpu_ns ();
+	current->now += (uint64_t)((ns - cpu_last) * cpu_scale / 1000);
+	cpu_last = ns;
+}
+
+uint64_t sim_now (void)
+{
+	cpu_account ();
+
+	return current ? current->now : sched_now;
+}
+
+static void sim_yield (void)
+{
+	struct sim_task *t;
+
+	if (NULL == current)
+		return;
+
+	cpu_account ();
+	t = current;
+	swapcontext (&t->ctx, &sched_ctx);
+	cpu_last = cpu_ns ();
+}
+
+// advance the time without letting anybody else run
+static void sim_busy (uint32_t us)
+{
+	if (current)
+		current->now += us;
+	else
+		sched_now += us;
+}
+
+void sim_advance (uint32_t us)
+{
+	sim_busy (us);
+	sim_yield ();
+}
+
+void sim_at (uint64_t when, void (*func)(void *), void *arg)
+{
+	int i;
+
+	for (i = 0; i < MAX_TIMERS; ++i) {
+		if (timers[i].used)
+			continue;
+		timers[i].used = 1;
+		timers[i].when = when;
+		timers[i].func = func;
+		timers[i].arg = arg;
+		return;
+	}
+	sim_fatal ("out of timers");
+}
+
+uint32_t sim_random (uint32_t range)
+{
+	sim->random = sim->random * 1103515245 + 12345;
+	return range ? (sim->random >> 8) % range : 0;
+}
+
+void sim_fatal (const char *fmt, ...)
+{
+	va_list ap;
+
+	fflush (stdout);
+	va_start (ap, fmt);
+	fprintf (report, "sim: wake %d at %.6f: ", sim->wake, sim_now() / 1000000.);
+	vfprintf (report, fmt, ap);
+	fprintf (report, "\n");
+	va_end (ap);
+	fflush (report);
+
+	_exit (1);
+}
+
+int gettimeofday (struct timeval *tv, void *tz)
+{
+	uint64_t now = sim_now ();
+
+	tv->tv_sec  = now / 1000000;
+	tv->tv_usec = now % 1000000;
+
+	return 0;
+}
+
+uint64_t gettimeofday_us (void)
+{
+	return sim_now ();
+}
+
+uint64_t get_time_since_boot_64 (void)
+{
+	return sim_now () - sim->boot_time;
+}
+
+void ets_delay_us (uint32_t us)
+{
+	sim_advance (us);
+}
+
+uint64_t rtc_time_get (void)
+{
+	return sim_now () * SLOW_CLK_HZ / 1000000;
+}
+
+// what the IDF measured at boot, off by 'rtc_ppm'
+uint32_t esp_clk_slowclk_cal_get (void)
+{
+	return (uint32_t)((1000000.0 / SLOW_CLK_HZ) * (1 << 19) / (1 + sim->rtc_ppm / 1e6));
+}
+
+uint64_t esp_clk_rtc_time (void)
+{
+	return (rtc_time_get () * esp_clk_slowclk_cal_get ()) >> 19;
+}
+
+/////////////////////////////// console ///////////////////////////////
+
+// The console uart sends one byte per 10 bit times. Writers only block
+// when the fifo is full.
+static ssize_t console_write (void *cookie, const char *buf, size_t size)
+{
+	uint64_t now = sim_now ();
+	uint64_t byte_ns = 10 * 1000000000ULL / CONFIG_CONSOLE_UART_BAUDRATE;
+	uint64_t backlog;
+
+	if (uart_idle_at < now)
+		uart_idle_at = now;
+	uart_idle_at += size * byte_ns / 1000;
+
+	backlog = uart_idle_at - now;
+	if (backlog > UART_FIFO * byte_ns / 1000)
+		sim_busy (backlog - UART_FIFO * byte_ns / 1000);
+
+	if (sim->verbose)
+		(void)write (1, buf, size);
+
+	return size;
+}
+
+void uart_tx_wait_idle (uint8_t uart_no)
+{
+	uint64_t now = sim_now ();
+
+	if (uart_idle_at > now)
+		sim_advance (uart_idle_at - now);
+}
+
+/////////////////////////////// system ///////////////////////////////
+
+void esp_chip_info (esp_chip_info_t *out_info)
+{
+	memset (out_info, 0, sizeof(*out_info));
+	out_info->model = CHIP_ESP32;
+	out_info->cores = 2;
+	out_info->revision = 1;
+}
+
+esp_err_t esp_efuse_mac_get_default (uint8_t *mac)
+{
+	static const uint8_t sim_mac[6] = {0x24, 0x0a, 0xc4, 0x51, 0x4d, 0x00};
+
+	memcpy (mac, sim_mac, 6);
+	return ESP_OK;
+}
+
+const char *esp_get_idf_version (void)
+{
+	return "v3.0-sim";
+}
+
+void esp_log_level_set (const char *tag, esp_log_level_t level)
+{
+}
+
+uint32_t rtc_get_wakeup_cause (void)
+{
+	return sim->wake ? TIMER_EXPIRE : NO_SLEEP;
+}
+
+RESET_REASON rtc_get_reset_reason (int cpu_no)
+{
+	return sim->wake ? DEEPSLEEP_RESET : POWERON_RESET;
+}
+
+void esp_deep_sleep (uint64_t time_in_us)
+{
+	size_t len = __stop_rtc_data - __start_rtc_data;
+
+	sim->now = sim_now ();
+	sim->sleep_us = time_in_us;
+	sim->slept = 1;
+
+	fflush (stdout);
+	memcpy (sim->rtc, __start_rtc_data, len);
+	sim->rtc_len = len;
+
+	_exit (0);
+}
+
+/////////////////////////////// freertos ///////////////////////////////
+
+static void task_start (void)
+{
+	current->func (current->param);
+	current->state = TASK_DELETED;	// FreeRTOS would abort here
+	swapcontext (&current->ctx, &sched_ctx);
+}
+
+BaseType_t xTaskCreatePinnedToCore (TaskFunction_t pvTaskCode, const char *pcName,
+	uint32_t usStackDepth, void *pvParameters, UBaseType_t uxPriority,
+	TaskHandle_t *pvCreatedTask, BaseType_t xCoreID)
+{
+	struct sim_task *t;
+	int i;
+
+	for (i = 0; i < SIM_MAX_TASKS; ++i)
+		if (TASK_FREE == tasks[i].state)
+			break;
+	if (SIM_MAX_TASKS == i)
+		return pdFALSE;
+
+	t = &tasks[i];
+	memset (t, 0, sizeof(*t));
+	t->name = pcName;
+	t->func = pvTaskCode;
+	t->param = pvParameters;
+	t->now = sim_now ();
+	t->stack = malloc (TASK_STACK);
+	if (NULL == t->stack)
+		return pdFALSE;
+
+	getcontext (&t->ctx);
+	t->ctx.uc_stack.ss_sp = t->stack;
+	t->ctx.uc_stack.ss_size = TASK_STACK;
+	t->ctx.uc_link = &sched_ctx;
+	makecontext (&t->ctx, task_start, 0);
+	t->state = TASK_READY;
+
+	if (NULL != pvCreatedTask)
+		*pvCreatedTask = t;
+
+	return pdPASS;
+}
+
+void vTaskDelete (TaskHandle_t xTaskToDelete)
+{
+	struct sim_task *t = xTaskToDelete ? xTaskToDelete : current;
+
+	t->state = TASK_DELETED;
+	if (t == current)
+		sim_yield ();
+}
+
+void vTaskDelay (TickType_t xTicksToDelay)
+{
+	sim_advance (xTicksToDelay * portTICK_PERIOD_MS * 1000);
+}
+
+EventGroupHandle_t xEventGroupCreate (void)
+{
+	return calloc (1, sizeof(struct sim_event_group));
+}
+
+static int bits_ok (EventBits_t have, EventBits_t want, BaseType_t all)
+{
+	return all ? (have & want) == want : 0 != (have & want);
+}
+
+EventBits_t xEventGroupWaitBits (EventGroupHandle_t xEventGroup,
+	EventBits_t uxBitsToWaitFor, BaseType_t xClearOnExit,
+	BaseType_t xWaitForAllBits, TickType_t xTicksToWait)
+{
+	EventBits_t bits = xEventGroup->bits;
+
+	if (bits_ok (bits, uxBitsToWaitFor, xWaitForAllBits)) {
+		if (xClearOnExit)
+			xEventGroup->bits &= ~uxBitsToWaitFor;
+		return bits;
+	}
+	if (0 == xTicksToWait || NULL == current)
+		return bits;
+
+	current->state = TASK_WAITING;
+	current->group = xEventGroup;
+	current->bits = uxBitsToWaitFor;
+	current->all = xWaitForAllBits;
+	current->clear = xClearOnExit;
+	current->wait_until = (portMAX_DELAY == xTicksToWait) ? 0
+		: current->now + (uint64_t)xTicksToWait * portTICK_PERIOD_MS * 1000;
+	sim_yield ();
+
+	return current->result;
+}
+
+EventBits_t xEventGroupSetBits (EventGroupHandle_t xEventGroup, EventBits_t uxBitsToSet)
+{
+	uint64_t now = sim_now ();
+	EventBits_t bits;
+	int i;
+
+	xEventGroup->bits |= uxBitsToSet;
+	bits = xEventGroup->bits;
+
+	for (i = 0; i < SIM_MAX_TASKS; ++i) {
+		struct sim_task *t = &tasks[i];
+
+		if (TASK_WAITING != t->state || t->group != xEventGroup)
+			continue;
+		if (!bits_ok (xEventGroup->bits, t->bits, t->all))
+			continue;
+		t->result = xEventGroup->bits;
+		if (t->clear)
+			xEventGroup->bits &= ~t->bits;
+		if (t->now < now)
+			t->now = now;
+		t->state = TASK_READY;
+	}
+
+	return bits;
+}
+
+EventBits_t xEventGroupClearBits (EventGroupHandle_t xEventGroup, EventBits_t uxBitsToClear)
+{
+	EventBits_t bits = xEventGroup->bits;
+
+	xEventGroup->bits &= ~uxBitsToClear;
+	return bits;
+}
+
+EventBits_t xEventGroupGetBits (EventGroupHandle_t xEventGroup)
+{
+	return xEventGroup->bits;
+}
+
+/////////////////////////////// esp_timer ///////////////////////////////
+
+// a periodic timer is a task that sleeps between the callbacks
+struct sim_esp_timer {
+	esp_timer_cb_t cb;
+	void *arg;
+	const char *name;
+	uint64_t period;
+	int running;
+	int alive;		// the task is there
+	int deleted;		// the task frees it
+};
+
+static void esp_timer_task (void *param)
+{
+	struct sim_esp_timer *timer = param;
+	uint64_t next = sim_now ();
+
+	for (;;) {
+		uint64_t now;
+
+		next += timer->period;
+		now = sim_now ();
+		if (now < next)
+			sim_advance (next - now);
+		if (!timer->running)
+			break;
+		timer->cb (timer->arg);
+	}
+
+	timer->alive = 0;
+	if (timer->deleted)
+		free (timer);
+	vTaskDelete (NULL);
+}
+
+esp_err_t esp_timer_create (const esp_timer_create_args_t *create_args, esp_timer_handle_t *out_handle)
+{
+	struct sim_esp_timer *timer;
+
+	if (NULL == create_args || NULL == create_args->callback || NULL == out_handle)
+		return ESP_ERR_INVALID_ARG;
+
+	timer = calloc (1, sizeof(*timer));
+	if (NULL == timer)
+		return ESP_ERR_NO_MEM;
+	timer->cb = create_args->callback;
+	timer->arg = create_args->arg;
+	timer->name = create_args->name ? create_args->name : "esp_timer";
+
+	*out_handle = timer;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic (esp_timer_handle_t timer, uint64_t period)
+{
+	if (timer->running || timer->alive)
+		return ESP_ERR_INVALID_STATE;
+
+	timer->period = period;
+	timer->running = 1;
+	if (pdPASS != xTaskCreatePinnedToCore (esp_timer_task, timer->name,
+			4096, timer, 22, NULL, 0)) {
+		timer->running = 0;
+		return ESP_ERR_NO_MEM;
+	}
+	timer->alive = 1;
+
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_stop (esp_timer_handle_t timer)
+{
+	if (!timer->running)
+		return ESP_ERR_INVALID_STATE;
+
+	timer->running = 0;
+	return ESP_OK;
+}
+
+esp_err_t esp_timer_delete (esp_timer_handle_t timer)
+{
+	if (timer->running)
+		return ESP_ERR_INVALID_STATE;
+
+	if (timer->alive)
+		timer->deleted = 1;
+	else
+		free (timer);
+	return ESP_OK;
+}
+
+int64_t esp_timer_get_time (void)
+{
+	return sim_now () - sim->boot_time;
+}
+
+/////////////////////////////// scheduler ///////////////////////////////
+
+static void sim_run (void)
+{
+	for (;;) {
+		struct sim_task *next = NULL;
+		struct sim_timer *timer = NULL;
+		uint64_t when = UINT64_MAX;
+		int i;
+
+		for (i = 0; i < SIM_MAX_TASKS; ++i) {
+			struct sim_task *t = &tasks[i];
+
+			if (TASK_READY == t->state && t->now < when) {
+				next = t;
+				when = t->now;
+			} else if (TASK_WAITING == t->state && t->wait_until
+					&& t->wait_until < when) {
+				next = t;
+				when = t->wait_until;
+			}
+		}
+
+		for (i = 0; i < MAX_TIMERS; ++i)
+			if (timers[i].used && timers[i].when <= when) {
+				timer = &timers[i];
+				when = timer->when;
+			}
+
+		if (NULL != timer) {
+			timer->used = 0;
+			if (sched_now < when)
+				sched_now = when;
+			timer->func (timer->arg);
+			continue;
+		}
+
+		if (NULL == next)
+			sim_fatal ("no task left to run and no deep sleep");
+
+		if (TASK_WAITING == next->state) {	// timed out
+			next->now = next->wait_until;
+			next->result = next->group->bits;
+			next->state = TASK_READY;
+		}
+		if (sched_now < next->now)
+			sched_now = next->now;
+
+		current = next;
+		cpu_last = cpu_ns ();
+		swapcontext (&sched_ctx, &next->ctx);
+		current = NULL;
+	}
+}
+
+static void main_task (void *param)
+{
+	app_main ();
+}
+
+// one wake, in the child
+static void sim_boot (void)
+{
+	static cookie_io_functions_t console = {
+		.write = console_write,
+	};
+
+	stdout = fopencookie (NULL, "w", console);
+	setvbuf (stdout, NULL, _IONBF, 0);
+
+	sched_now = sim->app_time;
+	uart_idle_at = 0;
+
+	sim_gpio_init ();
+	sim_rmt_init ();
+	sim_i2c_init (0 == sim->wake);
+	sim_wifi_init ();
+
+	xTaskCreatePinnedToCore (main_task, "main", 4096, NULL, 1, NULL, 0);
+	sim_run ();
+}
+
+/////////////////////////////// wake loop ///////////////////////////////
+
+static int printable (const uint8_t *msg, int len)
+{
+	int i;
+
+	for (i = 0; i < len; ++i)
+		if (msg[i] < ' ' || msg[i] > '~')
+			return 0;
+	return 1;
+}
+
+static void usage (const char *prog)
+{
+	fprintf (stderr,
+"usage: %s [options]\n"
+"  -n wakes   number of wakes to run (10)\n"
+"  -v         show the app's console output\n"
+"  -b ms      power up to app_main (%u)\n"
+"  -a ms      wifi association time, with a scan (%u)\n"
+"  -D ms      wifi association time, known bssid and channel (%u)\n"
+"  -d ms      dhcp time (%u)\n"
+"  -L s       dhcp lease (%u)\n"
+"  -f n       fail the first association every n wakes (0=never)\n"
+"  -t n       lose the TX done of the message every n wakes (0=never)\n"
+"  -e ppm     RTC slow clock error (0)\n"
+"  -l pin     hold input pin LOW, e.g. -l 15 silences the log\n"
+"  -o n       number of ds18b20 on the 1-Wire bus (%d)\n"
+"  -O pin     1-Wire bus pin (%d)\n"
+"  -B         no bme280\n"
+"  -x scale   add host cpu time times 'scale' to the simulated time (0)\n",
+		prog, sim->boot_us / 1000, sim->assoc_ms, sim->direct_ms, sim->dhcp_ms, sim->lease_s,
+		sim->nds18b20, sim->ow_pin);
+	exit (2);
+}
+
+int main (int argc, char *argv[])
+{
+	uint64_t active, active_min = UINT64_MAX, active_max = 0, active_total = 0;
+	int failed = 0;
+	int opt;
+
+	sim = mmap (NULL, sizeof(*sim), PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (MAP_FAILED == sim) {
+		perror ("mmap");
+		return 1;
+	}
+
+	sim->wakes = 10;
+	sim->boot_us = 160 * 1000;
+	sim->assoc_ms = 600;
+	sim->direct_ms = 150;
+	sim->dhcp_ms = 150;
+	sim->lease_s = 3600;
+	sim->ow_pin = 18;
+	sim->nds18b20 = 1;
+	sim->have_bme280 = 1;
+	sim->adc_mv[32] = 1650;		// 3.3v Vdd through 1:1
+	sim->adc_mv[33] = 1667;		// 5v battery through 1:2
+	sim->random = 1;
+
+	while (-1 != (opt = getopt (argc, argv, "n:vb:a:D:d:L:f:t:e:l:o:O:Bx:"))) {
+		switch (opt) {
+		case 'n': sim->wakes = atoi (optarg); break;
+		case 'v': sim->verbose = 1; break;
+		case 'b': sim->boot_us = atoi (optarg) * 1000; break;
+		case 'a': sim->assoc_ms = atoi (optarg); break;
+		case 'D': sim->direct_ms = atoi (optarg); break;
+		case 'd': sim->dhcp_ms = atoi (optarg); break;
+		case 'L': sim->lease_s = atoi (optarg); break;
+		case 'f': sim->assoc_fail = atoi (optarg); break;
+		case 't': sim->txdone_lost = atoi (optarg); break;
+		case 'e': sim->rtc_ppm = atoi (optarg); break;
+		case 'l':
+			if (atoi (optarg) < 0 || atoi (optarg) >= SIM_NUM_GPIO)
+				usage (argv[0]);
+			sim->low_pins[atoi (optarg)] = 1;
+			break;
+		case 'o': sim->nds18b20 = atoi (optarg); break;
+		case 'O': sim->ow_pin = atoi (optarg); break;
+		case 'B': sim->have_bme280 = 0; break;
+		case 'x': cpu_scale = atof (optarg); break;
+		default: usage (argv[0]);
+		}
+	}
+	if (sim->nds18b20 < 0 || sim->nds18b20 > SIM_MAX_OW)
+		usage (argv[0]);
+
+	if ((size_t)(__stop_rtc_data - __start_rtc_data) > sizeof(sim->rtc)) {
+		fprintf (stderr, "RTC data too large\n");
+		return 1;
+	}
+
+	report = stdout;
+	sim_ow_power_on ();
+	sim_bme280_power_on ();
+
+	for (sim->wake = 0; sim->wake < sim->wakes; ++sim->wake) {
+		pid_t pid;
+		int status;
+
+		if (sim->rtc_len > 0)
+			memcpy (__start_rtc_data, sim->rtc, sim->rtc_len);
+		sim->boot_time = sim->now;
+		sim->app_time = sim->now + sim->boot_us;
+		sim->slept = 0;
+		sim->sent = 0;
+		sim->sockets = 0;
+		sim->arps = 0;
+		sim->msg_len = 0;
+
+		fflush (NULL);
+		pid = fork ();
+		if (pid < 0) {
+			perror ("fork");
+			return 1;
+		}
+		if (0 == pid) {
+			sim_boot ();
+			_exit (1);
+		}
+		if (waitpid (pid, &status, 0) < 0 || !sim->slept) {
+			fprintf (report, "wake %3d: did not reach deep sleep\n", sim->wake);
+			++failed;
+			break;
+		}
+
+		active = sim->now - sim->boot_time;
+		if (active < active_min) active_min = active;
+		if (active > active_max) active_max = active;
+		active_total += active;
+
+		fprintf (report, "wake %3d: at %10.3fs app %8.3fms active %8.3fms sleep %8.3fs sent %d sockets %d arps %d len %d\n",
+			sim->wake,
+			sim->app_time / 1000000.,
+			(sim->now - sim->app_time) / 1000.,
+			active / 1000.,
+			sim->sleep_us / 1000000.,
+			sim->sent, sim->sockets, sim->arps, sim->msg_len);
+		if (sim->msg_len > 0 && printable (sim->msg, sim->msg_len))
+			fprintf (report, "  '%.*s'\n", sim->msg_len, sim->msg);
+		else if (sim->msg_len > 0 && MSG_MAGIC == sim->msg[0]) {
+			char text[1024];
+
+			if (msg_decode (sim->msg, sim->msg_len, "store", "sim",
+					text, sizeof(text)) < 0)
+				fprintf (report, "  bad binary message\n");
+			else
+				fprintf (report, "  '%s'\n", text);
+		}
+
+		sim->now += (uint64_t)(sim->sleep_us * (1 + sim->rtc_ppm / 1e6));
+	}
+
+	if (sim->wake > 0)
+		fprintf (report, "wakes %d failed %d active min %.3fms mean %.3fms max %.3fms\n",
+			sim->wake, failed,
+			active_min / 1000., active_total / 1000. / sim->wake, active_max / 1000.);
+
+	return failed ? 1 : 0;
+}
@@ -0,0 +1,96 @@
+/* Receive the app's messages and print them as text, one per line.
+ *
+ * Binary messages (BINARY_MSG) are decoded, text messages are passed
+ * through, so either firmware can feed the same server script:
+ *
+ *	udp-decode [-p port] [-a action] [-n name] | server-script
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#include "msg.h"
+#include "msg-decode.h"
+
+#define SVR_PORT		21883
+
+static void usage (const char *prog)
+{
+	fprintf (stderr,
+"usage: %s [options]\n"
+"  -p port    udp port to listen on (%d)\n"
+"  -a action  first word of a decoded message (store)\n"
+"  -n name    device name, default esp-<device id>\n",
+		prog, SVR_PORT);
+	exit (2);
+}
+
+int main (int argc, char *argv[])
+{
+	struct sockaddr_in addr;
+	const char *action = "store";
+	const char *name = NULL;
+	int port = SVR_PORT;
+	int sock;
+	int opt;
+
+	while (-1 != (opt = getopt (argc, argv, "p:a:n:"))) {
+		switch (opt) {
+		case 'p': port = atoi (optarg); break;
+		case 'a': action = optarg; break;
+		case 'n': name = optarg; break;
+		default: usage (argv[0]);
+		}
+	}
+
+	sock = socket (AF_INET, SOCK_DGRAM, 0);
+	if (sock < 0) {
+		perror ("socket");
+		return 1;
+	}
+
+	memset (&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons (port);
+	addr.sin_addr.s_addr = htonl (INADDR_ANY);
+	if (bind (sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+		perror ("bind");
+		return 1;
+	}
+
+	for (;;) {
+		uint8_t frame[1500];
+		char text[1024];
+		char dev[16];
+		int len;
+
+		len = recv (sock, frame, sizeof(frame), 0);
+		if (len < 0) {
+			perror ("recv");
+			return 1;
+		}
+		if (0 == len)
+			continue;
+
+		if (MSG_MAGIC != frame[0]) {
+			printf ("%.*s\n", len, frame);
+		} else {
+			const struct msg_header *h = (const struct msg_header *)frame;
+
+			if (NULL == name && len >= (int)sizeof(*h))
+				snprintf (dev, sizeof(dev), "esp-%u", h->device);
+			if (msg_decode (frame, len, action, name ? name : dev,
+					text, sizeof(text)) < 0)
+				fprintf (stderr, "bad message, %d bytes\n", len);
+			else
+				printf ("%s\n", text);
+		}
+		fflush (stdout);
+	}
+
+	return 0;
+}
@@ -12,11 +12,37 @@
 #include "esp_adc_cal.h"
 
 #include <driver/adc.h>
+#include <esp_attr.h>		// RTC_DATA_ATTR
+#include <esp_timer.h>
 
 #define ADC_ATTEN	ADC_ATTEN_6db
 #define ADC_ATTEN_RATIO	(4095. / 2)
 
-static adc_atten_t adc_width = ADC_WIDTH_12Bit;
+#ifndef ADC_SAMPLES
+#define ADC_SAMPLES	8	// raw readings per pin, 1 for a single one
+#endif
+#ifndef ADC_TRIM
+#define ADC_TRIM	2	// lowest and highest readings dropped, each end
+#endif
+#if ADC_SAMPLES <= 2*ADC_TRIM
+#error ADC_SAMPLES must be more than 2*ADC_TRIM
+#endif
+
+#define ADC_CAL_MAGIC	0x41444331	// "ADC1"
+#define ADC_CAL_MAX	4		// (atten, width, vref) combinations kept
+
+// the characteristics only change with these, keep them over deep sleep
+struct adc_cal {
+	uint32_t magic;
+	adc_atten_t atten;
+	adc_bits_width_t width;
+	int vref;
+	esp_adc_cal_characteristics_t chars;
+};
+RTC_DATA_ATTR static struct adc_cal adc_cals[ADC_CAL_MAX];
+RTC_DATA_ATTR static int adc_cal_next = 0;	// replaced when all are used
+
+static adc_bits_width_t adc_width = ADC_WIDTH_12Bit;
 static int adc_vref = 1199;
 
 esp_err_t adc_init (int width, int vref)
@@ -74,66 +100,230 @@ typedef enum {
 } adc2_channel_t;
 #endif
 
-esp_err_t adc_read (float *adc, uint8_t pin, int atten, float divider)
+static esp_err_t adc_channel (uint8_t pin, adc1_channel_t *channel)
 {
-	adc1_channel_t channel;
-	adc_atten_t adc_atten;
-
-	*adc = 0.0;
-
 	switch (pin) {
 	case  36:
-		channel = ADC1_GPIO36_CHANNEL;
+		*channel = ADC1_GPIO36_CHANNEL;
 		break;
 	case  37:
-		channel = ADC1_GPIO37_CHANNEL;
+		*channel = ADC1_GPIO37_CHANNEL;
 		break;
 	case  38:
-		channel = ADC1_GPIO38_CHANNEL;
+		*channel = ADC1_GPIO38_CHANNEL;
 		break;
 	case  39:
-		channel = ADC1_GPIO39_CHANNEL;
+		*channel = ADC1_GPIO39_CHANNEL;
 		break;
 	case  32:
-		channel = ADC1_GPIO32_CHANNEL;
+		*channel = ADC1_GPIO32_CHANNEL;
 		break;
 	case  33:
-		channel = ADC1_GPIO33_CHANNEL;
+		*channel = ADC1_GPIO33_CHANNEL;
 		break;
 	case  34:
-		channel = ADC1_GPIO34_CHANNEL;
+		*channel = ADC1_GPIO34_CHANNEL;
 		break;
 	case  35:
-		channel = ADC1_GPIO35_CHANNEL;
+		*channel = ADC1_GPIO35_CHANNEL;
 		break;
 	default:
 		LogR (ESP_FAIL, "bad ADC pin %d", pin);
 		break;
 	}
 
+	return ESP_OK;
+}
+
+static esp_err_t adc_atten (int atten, adc_atten_t *adc_atten)
+{
 	switch (atten) {
 	case 0:
-		adc_atten = ADC_ATTEN_0db;
+		*adc_atten = ADC_ATTEN_0db;
 		break;
 	case 2:
-		adc_atten = ADC_ATTEN_2_5db;
+		*adc_atten = ADC_ATTEN_2_5db;
 		break;
 	case 6:
-		adc_atten = ADC_ATTEN_6db;
+		*adc_atten = ADC_ATTEN_6db;
 		break;
 	case 11:
-		adc_atten = ADC_ATTEN_11db;
+		*adc_atten = ADC_ATTEN_11db;
 		break;
 	default:
 		LogR (ESP_FAIL, "bad ADC atten %d", atten);
 		break;
 	}
 
-	DbgR (adc1_config_channel_atten(channel, adc_atten));
-	esp_adc_cal_characteristics_t cal;
-	esp_adc_cal_get_characteristics(adc_vref, adc_atten, adc_width, &cal);
-	*adc = adc1_to_voltage(channel, &cal) / 1000. * divider;
+	return ESP_OK;
+}
+
+// computed once, then from RTC memory
+static const esp_adc_cal_characteristics_t *adc_cal_get (adc_atten_t atten)
+{
+	struct adc_cal *c;
+	int i;
+
+	for (i = 0; i < ADC_CAL_MAX; ++i) {
+		c = &adc_cals[i];
+		if (ADC_CAL_MAGIC == c->magic && atten == c->atten
+		    && adc_width == c->width && adc_vref == c->vref)
+			return &c->chars;
+	}
+
+	c = &adc_cals[adc_cal_next];
+	adc_cal_next = (adc_cal_next + 1) % ADC_CAL_MAX;
+
+	c->magic = 0;
+	c->atten = atten;
+	c->width = adc_width;
+	c->vref = adc_vref;
+	esp_adc_cal_get_characteristics(adc_vref, atten, adc_width, &c->chars);
+	c->magic = ADC_CAL_MAGIC;
+Log ("adc: calibrated atten %d width %d vref %d", atten, adc_width, adc_vref);
+
+	return &c->chars;
+}
+
+// the mean of the middle readings, a WiFi burst or a glitch is dropped
+static uint32_t adc_trimmed_mean (uint32_t *raw, int n)
+{
+	uint32_t sum = 0;
+	int i, j;
+
+	for (i = 1; i < n; ++i) {	// insertion sort, n is small
+		uint32_t v = raw[i];
+
+		for (j = i; j > 0 && raw[j-1] > v; --j)
+			raw[j] = raw[j-1];
+		raw[j] = v;
+	}
+
+	for (i = ADC_TRIM; i < n - ADC_TRIM; ++i)
+		sum += raw[i];
+	n -= 2*ADC_TRIM;
+
+	return (sum + n/2) / n;
+}
+
+// All the pins in one pass: the samples are interleaved so that each
+// pin is measured over the same time.
+esp_err_t adc_read_all (struct adc_pin *pins, int npins)
+{
+	adc1_channel_t channel[ADC_MAX_PINS];
+	const esp_adc_cal_characteristics_t *cal[ADC_MAX_PINS];
+	uint32_t raw[ADC_MAX_PINS][ADC_SAMPLES];
+	int i, k;
+
+	if (npins > ADC_MAX_PINS)
+		LogR (ESP_FAIL, "too many ADC pins %d", npins);
+
+	for (i = 0; i < npins; ++i) {
+		adc_atten_t atten;
+
+		*pins[i].v = 0.0;
+		DbgR (adc_channel (pins[i].pin, &channel[i]));
+		DbgR (adc_atten (pins[i].atten, &atten));
+		DbgR (adc1_config_channel_atten(channel[i], atten));
+		cal[i] = adc_cal_get (atten);
+	}
+
+	for (k = 0; k < ADC_SAMPLES; ++k)
+		for (i = 0; i < npins; ++i) {
+			int r = adc1_get_raw(channel[i]);
+
+			if (r < 0)
+				LogR (ESP_FAIL, "adc1_get_raw(%d) failed", channel[i]);
+			raw[i][k] = r;
+		}
+
+	for (i = 0; i < npins; ++i) {
+		uint32_t r = (ADC_SAMPLES > 1) ? adc_trimmed_mean (raw[i], ADC_SAMPLES) : raw[i][0];
+
+		*pins[i].v = esp_adc_cal_raw_to_voltage(r, cal[i]) / 1000. * pins[i].divider;
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t adc_read (float *adc, uint8_t pin, int atten, float divider)
+{
+	struct adc_pin p = {pin, atten, divider, adc};
+
+	return adc_read_all (&p, 1);
+}
+
+// One pin sampled at a fixed rate from an esp_timer, in the background.
+// Only the raw min and sum are kept, converted once at the end.
+static struct {
+	esp_timer_handle_t timer;
+	adc1_channel_t channel;
+	const esp_adc_cal_characteristics_t *cal;
+	float divider;
+	int64_t start_us;
+	uint32_t min_raw;
+	uint32_t min_us;
+	uint32_t sum;
+	uint16_t n;
+} droop;
+
+static void adc_droop_sample (void *arg)
+{
+	int r = adc1_get_raw(droop.channel);
+
+	if (r < 0 || 0xFFFF == droop.n)
+		return;
+	if (0 == droop.n || (uint32_t)r < droop.min_raw) {
+		droop.min_raw = r;
+		droop.min_us = (uint32_t)(esp_timer_get_time() - droop.start_us);
+	}
+	droop.sum += r;
+	++droop.n;
+}
+
+esp_err_t adc_droop_start (uint8_t pin, int atten, float divider, uint32_t period_us)
+{
+	esp_timer_create_args_t args = {
+		.callback = adc_droop_sample,
+		.name = "droop",
+	};
+	adc_atten_t a;
+
+	if (NULL != droop.timer)
+		LogR (ESP_FAIL, "adc droop already running");
+
+	DbgR (adc_channel (pin, &droop.channel));
+	DbgR (adc_atten (atten, &a));
+	DbgR (adc1_config_width(adc_width));
+	DbgR (adc1_config_channel_atten(droop.channel, a));
+	droop.cal = adc_cal_get (a);
+	droop.divider = divider;
+	droop.n = 0;
+	droop.sum = 0;
+	droop.start_us = esp_timer_get_time();
+
+	DbgR (esp_timer_create(&args, &droop.timer));
+	DbgR (esp_timer_start_periodic(droop.timer, period_us));
 
 	return ESP_OK;
 }
 
+void adc_droop_stop (struct adc_droop *d)
+{
+	memset (d, 0, sizeof(*d));
+	if (NULL == droop.timer)
+		return;
+
+	esp_timer_stop(droop.timer);
+	esp_timer_delete(droop.timer);
+	droop.timer = NULL;
+
+	if (0 == droop.n)
+		return;
+	d->n = droop.n;
+	d->min_us = droop.min_us;
+	d->min_mv = (uint16_t)(esp_adc_cal_raw_to_voltage(droop.min_raw, droop.cal)
+		* droop.divider + .5);
+	d->mean_mv = (uint16_t)(esp_adc_cal_raw_to_voltage((droop.sum + droop.n/2) / droop.n, droop.cal)
+		* droop.divider + .5);
+}
@@ -1,8 +1,28 @@
 #ifndef _ADC_H
 #define _ADC_H
 
+#define ADC_MAX_PINS	3		// read by one adc_read_all()
+
+struct adc_pin {
+	uint8_t pin;
+	int atten;			// 0, 2, 6 or 11 (db)
+	float divider;
+	float *v;			// result, volts at the divider input
+};
+
+// the battery while the radio is on, see adc_droop_start()
+struct adc_droop {
+	uint16_t min_mv;		// at the divider input
+	uint16_t mean_mv;
+	uint32_t min_us;		// when, since adc_droop_start()
+	uint16_t n;			// samples, 0 for none
+};
+
 /* adc.c */
 esp_err_t adc_init (int width, int vref);
 esp_err_t adc_read (float *adc, uint8_t pin, int atten, float divider);
+esp_err_t adc_read_all (struct adc_pin *pins, int npins);
+esp_err_t adc_droop_start (uint8_t pin, int atten, float divider, uint32_t period_us);
+void adc_droop_stop (struct adc_droop *d);
 
 #endif // _ADC_H
@@ -5,8 +5,12 @@
 #include "udp.h"
 #include "bme280.h"
 #include "bme280-cal.h"
+#include "onewire.h"		// onewire_crc8()
+#include "i2c-batch.h"
 
 #include <driver/i2c.h>
+#include <esp_attr.h>		// RTC_DATA_ATTR
+#include <esp_clk.h>		// esp_clk_rtc_time()
 
 #define I2C_NUM				I2C_NUM_1
 #define I2C_FREQ_HZ			1000000
@@ -38,17 +42,24 @@
 #define BME280_NORMAL_MODE		0x03
 #define BME280_SOFT_RESET_CODE		0xB6
 
-#define ACK_CHECK_EN			0x1
-#define ACK_VAL				0
-#define NAK_VAL				1
-
 #define BME280_SAMPLING_DELAY		113	// maximum measurement time in ms for maximum
 	// oversampling for all measures = 1.25 + 2.3*16 + 2.3*16 + 0.575 + 2.3*16 + 0.575 ms
 
-static struct bme280_data bme280_data;
+#define BME280_CAL_MAGIC		0xB2800001
+
+// kept over deep sleep, read again on a cold start or when the crc fails
+struct bme280_cal {
+	uint32_t magic;
+	uint8_t isbme;			// 1 if BME280, 0 if BMP280
+	struct bme280_data data;
+	uint8_t crc;			// of all the above
+};
+RTC_DATA_ATTR static struct bme280_cal bme280_cal;
+
+// when the measurement started last will be done, RTC time. 0 if none
+RTC_DATA_ATTR static uint64_t bme280_ready_us = 0;
 
 static i2c_port_t i2c_num = I2C_NUM;
-static uint8_t bme280_isbme = 0;	// 1 if BME280, 0 if BMP280
 static uint8_t bme280_mode = 0;		// stores oversampling settings
 static uint8_t bme280_ossh = 0;		// stores humidity oversampling settings
 static int have_bme280 = 0;
@@ -71,78 +82,68 @@ static esp_err_t i2c_master_init(uint8_t sda, uint8_t scl)
     return ESP_OK;
 }
 
-static esp_err_t i2c_master_address (
-	i2c_cmd_handle_t cmd, uint8_t id, int dir)
+// all BME280 access is batched, it takes reg/value pairs in one write
+static void i2c_bme280_batch (struct i2c_batch *b)
 {
-	DbgR (i2c_master_write_byte(cmd, (id << 1) | dir, ACK_CHECK_EN));
+	i2c_batch_begin (b, i2c_num, BME280_I2C_ADDR, 1);
+}
 
-	return ESP_OK;
+static int oversampling (uint8_t osrs)
+{
+	return osrs > 5 ? 16 : (1 << osrs) >> 1;	// 0,1,2,4,8,16
 }
 
-static esp_err_t i2c_read_bytes(
-	uint8_t addr, uint8_t reg, uint8_t *buf, size_t buflen)
+// See BME280 data sheet, Appendix B, 9.1 Measurement time, max.
+// 9.3ms with x1 for all, 113ms with x16 for all
+static uint32_t bme280_measurement_us (void)
 {
-        esp_err_t ret;
-	i2c_cmd_handle_t cmd;
-
-	if (buflen < 1)
-		return ESP_OK;
-
-// send address read request
-	cmd = i2c_cmd_link_create();
-
-	DbgR (i2c_master_start(cmd));
-	DbgR (i2c_master_address (cmd, addr, I2C_MASTER_WRITE));
-	DbgR (i2c_master_write_byte(cmd, reg, ACK_CHECK_EN));
-///	DbgR (i2c_master_stop(cmd));
-///	Dbg  (i2c_master_cmd_begin(i2c_num, cmd, 10 / portTICK_RATE_MS));
-///	i2c_cmd_link_delete(cmd);
-///	if (ESP_OK != ret) return ret;
-
-// receive data
-///	cmd = i2c_cmd_link_create();
-	DbgR (i2c_master_start(cmd));
-	DbgR (i2c_master_address (cmd, addr, I2C_MASTER_READ));
-	if (buflen > 1)
-		DbgR (i2c_master_read(cmd, buf, buflen-1, ACK_VAL));
-	DbgR (i2c_master_read_byte(cmd, buf+buflen-1, NAK_VAL));
-	DbgR (i2c_master_stop(cmd));
-
-	Dbg  (i2c_master_cmd_begin(i2c_num, cmd, 1000 / portTICK_RATE_MS));
-	i2c_cmd_link_delete(cmd);
-	if (ESP_OK != ret) return ret;
+	int ost = oversampling ((bme280_mode >> 5) & 0x07);
+	int osp = oversampling ((bme280_mode >> 2) & 0x07);
+	int osh = oversampling (bme280_ossh & 0x07);
+	uint32_t us = 1250;
 
-	return ret;
+	if (ost) us += 2300*ost;
+	if (osp) us += 2300*osp + 575;
+	if (osh && bme280_cal.isbme) us += 2300*osh + 575;
+
+	return us;
 }
 
-static esp_err_t i2c_write_byte(
-	uint8_t addr, uint8_t reg, uint8_t val)
+// Only waits if the sleep was shorter than the measurement
+static void bme280_wait_ready (void)
 {
-        esp_err_t ret;
-	i2c_cmd_handle_t cmd;
-
-	cmd = i2c_cmd_link_create();
-        DbgR (i2c_master_start(cmd));
-        DbgR (i2c_master_address(cmd, addr, I2C_MASTER_WRITE));
-        DbgR (i2c_master_write_byte(cmd, reg, ACK_CHECK_EN));
-        DbgR (i2c_master_write_byte(cmd, val, ACK_CHECK_EN));
-        DbgR (i2c_master_stop(cmd));
-	Dbg  (i2c_master_cmd_begin(i2c_num, cmd, 1000 / portTICK_RATE_MS));
-	i2c_cmd_link_delete(cmd);
+	uint64_t now = esp_clk_rtc_time ();
 
-	return ret;
+	if (bme280_ready_us > now) {
+		uint32_t us = (uint32_t)(bme280_ready_us - now);
+
+		Log ("bme280: waiting %uus for the measurement", us);
+		delay_us (us);
+	}
+}
+
+// queue the start of a forced measurement, both in one write
+static esp_err_t i2c_bme280_queue_start (struct i2c_batch *b)
+{
+	DbgR (i2c_batch_write (b, BME280_REGISTER_CONTROL_HUM, bme280_ossh));
+	DbgR (i2c_batch_write (b, BME280_REGISTER_CONTROL, (bme280_mode & 0xFC) | BME280_FORCED_MODE));
+
+	return ESP_OK;
 }
 
 static esp_err_t i2c_bme280_startreadout (int wait)
 {
-	DbgR (i2c_write_byte (BME280_I2C_ADDR, BME280_REGISTER_CONTROL_HUM, bme280_ossh));
-	DbgR (i2c_write_byte (BME280_I2C_ADDR, BME280_REGISTER_CONTROL, (bme280_mode & 0xFC) | BME280_FORCED_MODE));
+	struct i2c_batch b;
+
+	bme280_ready_us = 0;
+	i2c_bme280_batch (&b);
+	DbgR (i2c_bme280_queue_start (&b));
+	DbgR (i2c_batch_run (&b));
+	bme280_ready_us = esp_clk_rtc_time () + bme280_measurement_us ();
 
 	if (wait) {
 #if 001	// status reg does not work :-(
-// See BME280 data sheet, Appendix B, 11.1 Measurement time , max no oversampling.
-// comes out as 9.3ms
-		delay_us (1250 + (2300*1) + (2300*1 + 575) + (2300*1+575));
+		bme280_wait_ready ();
 #else
 		uint8_t status;
 		int us = 10*1000;	// 10ms timeout
@@ -151,7 +152,9 @@ static esp_err_t i2c_bme280_startreadout (int wait)
 		us -= 100;
 
 		for (;;) {
-			DbgR (i2c_read_bytes (BME280_I2C_ADDR, BME280_REGISTER_STATUS, &status, 1));
+			i2c_bme280_batch (&b);
+			DbgR (i2c_batch_read (&b, BME280_REGISTER_STATUS, &status, 1));
+			DbgR (i2c_batch_run (&b));
 			if (0 != status) break;
 			if ((us -= 100) <= 0) DbgR (ESP_FAIL);
 			delay_us (100);
@@ -163,16 +166,33 @@ Log ("startreadout waited %dus", 10*1000-us);
 	return ESP_OK;
 }
 
-static esp_err_t i2c_bme280_read (uint8_t *buf, size_t buflen)
+// read the measurement and start the next one in one transaction
+static esp_err_t i2c_bme280_read (uint8_t *buf, size_t buflen, int *started)
 {
-	DbgR (i2c_read_bytes (BME280_I2C_ADDR, BME280_REGISTER_PRESS, buf, buflen));
+	struct i2c_batch b;
+
+	*started = 0;
+	bme280_ready_us = 0;
+	i2c_bme280_batch (&b);
+	DbgR (i2c_batch_read (&b, BME280_REGISTER_PRESS, buf, buflen));
+	DbgR (i2c_bme280_queue_start (&b));
+	(void)i2c_batch_run (&b);
+
+	if (ESP_OK == b.ops[1].ret && ESP_OK == b.ops[2].ret) {
+		bme280_ready_us = esp_clk_rtc_time () + bme280_measurement_us ();
+		*started = 1;
+	}
 
-	return ESP_OK;
+	return b.ops[0].ret;
 }
 
 static esp_err_t i2c_bme280_soft_reset (void)
 {
-	DbgR (i2c_write_byte (BME280_I2C_ADDR, BME280_REGISTER_SOFTRESET, BME280_SOFT_RESET_CODE));
+	struct i2c_batch b;
+
+	i2c_bme280_batch (&b);
+	DbgR (i2c_batch_write (&b, BME280_REGISTER_SOFTRESET, BME280_SOFT_RESET_CODE));
+	DbgR (i2c_batch_run (&b));
 
 	return ESP_OK;
 }
@@ -183,13 +203,18 @@ esp_err_t bme280_read (int32_t alt, float *pT, float *pQFE, float *pH, float *pQ
 	uint8_t buf[8];		// registers are P[3], T[3], H[2]
 	int32_t adc_T, adc_P, adc_H;
 	int32_t T, qfe, H, qnh;
+	int started = 0;
 
 	if (!have_bme280) {
 		Dbg (ESP_FAIL);
 		T = BAD_TEMP*100+1;
+	} else if (0 == bme280_ready_us) {	// nothing measured
+		Dbg (ESP_FAIL);
+		T = BAD_TEMP*100+4;
 	} else {
+		bme280_wait_ready ();
 		memset (buf, 0, sizeof (buf));
-		Dbg (i2c_bme280_read (buf, sizeof(buf)));
+		Dbg (i2c_bme280_read (buf, sizeof(buf), &started));
 		if (ret != ESP_OK)
 			T = BAD_TEMP*100+2;
 		else
@@ -205,22 +230,22 @@ esp_err_t bme280_read (int32_t alt, float *pT, float *pQFE, float *pH, float *pQ
 			Dbg (ESP_FAIL);
 			T = BAD_TEMP*100+3;
 		} else
-			T = bme280_compensate_T(&bme280_data, adc_T);
+			T = bme280_compensate_T(&bme280_cal.data, adc_T);
 
 		if (0x8000 == adc_H) {
 			Dbg (ESP_FAIL);
 			H = BME280_BAD_HUMI*1000;
 		} else
-			H = bme280_compensate_H(&bme280_data, adc_H);
+			H = bme280_compensate_H(&bme280_cal.data, adc_H);
 
 		if (0x80000 == adc_P) {
 			Dbg (ESP_FAIL);
 			qfe = BME280_BAD_QFE*1000;
 		} else
-			qfe = bme280_compensate_P(&bme280_data, adc_P);
+			qfe = bme280_compensate_P(&bme280_cal.data, adc_P);
 
 		if (NULL != pQNH)
-			qnh = bme280_qfe2qnh(&bme280_data, qfe, alt);
+			qnh = bme280_qfe2qnh(&bme280_cal.data, qfe, alt);
 		else
 			qnh = 0;
 	} else {
@@ -228,7 +253,8 @@ esp_err_t bme280_read (int32_t alt, float *pT, float *pQFE, float *pH, float *pQ
 		qfe = H = qnh = 0;
 	}
 
-	/*Dbg*/ (i2c_bme280_startreadout (0));	// no delay
+	if (!started)
+		/*Dbg*/ (i2c_bme280_startreadout (0));	// no delay
 
 	Log("t=%.2f qfe=%.3f h=%.3f qnh=%.3f %x %x %x %02x%02x%02x %02x%02x%02x %02x%02x",
 		T/100., qfe / 1000., H / 1000., qnh / 1000.,
@@ -250,11 +276,74 @@ esp_err_t bme280_read (int32_t alt, float *pT, float *pQFE, float *pH, float *pQ
 	return ret;
 }
 
+static uint8_t bme280_cal_crc (void)
+{
+	return onewire_crc8 ((uint8_t *)&bme280_cal, offsetof(struct bme280_cal, crc));
+}
+
+// chip id and all the calibration in one burst
+static esp_err_t i2c_bme280_read_cal (void)
+{
+	uint8_t chipid = 0;
+	uint8_t cal00[26];	// 0x88-0xA1
+	uint8_t cal26[7];	// 0xE1-0xE7
+	struct i2c_batch b;
+	struct bme280_data *d = &bme280_cal.data;
+	uint8_t *reg;
+
+	memset (&bme280_cal, 0, sizeof(bme280_cal));	// also the padding
+	i2c_bme280_batch (&b);
+	DbgR (i2c_batch_read (&b, BME280_REGISTER_CHIPID, &chipid, 1));
+	DbgR (i2c_batch_read (&b, BME280_REGISTER_CAL00, cal00, sizeof(cal00)));
+	DbgR (i2c_batch_read (&b, BME280_REGISTER_CAL26, cal26, sizeof(cal26)));
+	DbgR (i2c_batch_run (&b));
+
+	bme280_cal.isbme = (chipid == 0x60);
+	Log("bme280: CHIPID=0x%2x", chipid);
+	
+#define r16uLE_buf(reg)	(uint16_t)((reg[1] << 8) | reg[0])
+#define r16sLE_buf(reg)	(int16_t)(r16uLE_buf(reg))
+
+	reg = cal00 + (BME280_REGISTER_DIG_T - BME280_REGISTER_CAL00);
+	d->dig_T1 = r16uLE_buf(reg); reg+=2;
+	d->dig_T2 = r16sLE_buf(reg); reg+=2;
+	d->dig_T3 = r16sLE_buf(reg);
+
+	reg = cal00 + (BME280_REGISTER_DIG_P - BME280_REGISTER_CAL00);
+	d->dig_P1 = r16uLE_buf(reg); reg+=2;
+	d->dig_P2 = r16sLE_buf(reg); reg+=2;
+	d->dig_P3 = r16sLE_buf(reg); reg+=2;
+	d->dig_P4 = r16sLE_buf(reg); reg+=2;
+	d->dig_P5 = r16sLE_buf(reg); reg+=2;
+	d->dig_P6 = r16sLE_buf(reg); reg+=2;
+	d->dig_P7 = r16sLE_buf(reg); reg+=2;
+	d->dig_P8 = r16sLE_buf(reg); reg+=2;
+	d->dig_P9 = r16sLE_buf(reg);
+
+	if (bme280_cal.isbme) {
+		d->dig_H1 = cal00[BME280_REGISTER_DIG_H1 - BME280_REGISTER_CAL00];
+
+		reg = cal26 + (BME280_REGISTER_DIG_H2 - BME280_REGISTER_CAL26);
+		d->dig_H2 = r16sLE_buf(reg); reg+=2;
+		d->dig_H3 = reg[0]; reg++;
+		d->dig_H4 = (int16_t)(reg[0]) << 4 | (reg[1] & 0x0F); reg+=1;	// H4[11:4 3:0] = 0xE4[7:0] 0xE5[3:0] 12-bit signed
+		d->dig_H5 = (int16_t)(reg[1]) << 4 | (reg[0] >> 4); reg+=2;	// H5[11:4 3:0] = 0xE6[7:0] 0xE5[7:4] 12-bit signed
+		d->dig_H6 = (int8_t)reg[0];
+	}
+#undef r16uLE_buf
+#undef r16sLE_buf
+
+	bme280_cal.magic = BME280_CAL_MAGIC;
+	bme280_cal.crc = bme280_cal_crc ();
+
+	return ESP_OK;
+}
+
 static esp_err_t i2c_bme280_setup(
 	uint8_t p1, uint8_t p2, uint8_t p3, uint8_t p4, uint8_t p5, uint8_t p6, uint8_t full_init)
 {
 	uint8_t config;
-	uint8_t	buf[18], *reg;
+	struct i2c_batch b;
 
 	uint8_t const bit3 = 0b111;
 	uint8_t const bit2 = 0b11;
@@ -269,62 +358,31 @@ static esp_err_t i2c_bme280_setup(
 	config = 
 		((p5&bit3) << 5) |	// 5-th parameter: inactive duration in normal mode
 		((p6&bit3) << 2);	// 6-th parameter: IIR filter
-	
-	DbgR (i2c_read_bytes (BME280_I2C_ADDR, BME280_REGISTER_CHIPID, buf, 1));
-	uint8_t chipid = (uint8_t)buf[0];
-	bme280_isbme = (chipid == 0x60);
-	Log("bme280: CHIPID=0x%2x", chipid);
-	
-#define r16uLE_buf(reg)	(uint16_t)((reg[1] << 8) | reg[0])
-#define r16sLE_buf(reg)	(int16_t)(r16uLE_buf(reg))
 
-	DbgR (i2c_read_bytes (BME280_I2C_ADDR, BME280_REGISTER_DIG_T, buf, 6));
-	reg = buf;
-	bme280_data.dig_T1 = r16uLE_buf(reg); reg+=2;
-	bme280_data.dig_T2 = r16sLE_buf(reg); reg+=2;
-	bme280_data.dig_T3 = r16sLE_buf(reg);
-
-	DbgR (i2c_read_bytes (BME280_I2C_ADDR, BME280_REGISTER_DIG_P, buf, 18));
-	reg = buf;
-	bme280_data.dig_P1 = r16uLE_buf(reg); reg+=2;
-	bme280_data.dig_P2 = r16sLE_buf(reg); reg+=2;
-	bme280_data.dig_P3 = r16sLE_buf(reg); reg+=2;
-	bme280_data.dig_P4 = r16sLE_buf(reg); reg+=2;
-	bme280_data.dig_P5 = r16sLE_buf(reg); reg+=2;
-	bme280_data.dig_P6 = r16sLE_buf(reg); reg+=2;
-	bme280_data.dig_P7 = r16sLE_buf(reg); reg+=2;
-	bme280_data.dig_P8 = r16sLE_buf(reg); reg+=2;
-	bme280_data.dig_P9 = r16sLE_buf(reg);
+	if (full_init
+	    || BME280_CAL_MAGIC != bme280_cal.magic
+	    || bme280_cal.crc != bme280_cal_crc ())
+		DbgR (i2c_bme280_read_cal ());
 	
-	if (full_init)
-		DbgR (i2c_write_byte (BME280_I2C_ADDR, BME280_REGISTER_CONFIG, config));
-
-	if (bme280_isbme) {
-		DbgR (i2c_read_bytes (BME280_I2C_ADDR, BME280_REGISTER_DIG_H1, buf, 1));
-		bme280_data.dig_H1 = buf[0];
-
-		DbgR (i2c_read_bytes (BME280_I2C_ADDR, BME280_REGISTER_DIG_H2, buf, 7));
-		reg = buf;
-		bme280_data.dig_H2 = r16sLE_buf(reg); reg+=2;
-		bme280_data.dig_H3 = reg[0]; reg++;
-		bme280_data.dig_H4 = (int16_t)(reg[0]) << 4 | (reg[1] & 0x0F); reg+=1;	// H4[11:4 3:0] = 0xE4[7:0] 0xE5[3:0] 12-bit signed
-		bme280_data.dig_H5 = (int16_t)(reg[1]) << 4 | (reg[0] >> 4); reg+=2;	// H5[11:4 3:0] = 0xE6[7:0] 0xE5[7:4] 12-bit signed
-		bme280_data.dig_H6 = (int8_t)reg[0];
-
-		if (full_init)
-			DbgR (i2c_write_byte (BME280_I2C_ADDR, BME280_REGISTER_CONTROL_HUM, bme280_ossh));
+	if (full_init) {
+		i2c_bme280_batch (&b);
+		DbgR (i2c_batch_write (&b, BME280_REGISTER_CONFIG, config));
+		if (bme280_cal.isbme)
+			DbgR (i2c_batch_write (&b, BME280_REGISTER_CONTROL_HUM, bme280_ossh));
+		DbgR (i2c_batch_write (&b, BME280_REGISTER_CONTROL, bme280_mode));
+		DbgR (i2c_batch_run (&b));
 	}
-#undef r16uLE_buf
-#undef r16sLE_buf
-
-	if (full_init)
-		DbgR (i2c_write_byte (BME280_I2C_ADDR, BME280_REGISTER_CONTROL, bme280_mode));
 	
 	return ESP_OK;
 }
 
-esp_err_t bme280_init (uint8_t sda, uint8_t scl, int full)
+esp_err_t bme280_init (uint8_t sda, uint8_t scl, int full,
+	const struct bme280_profile *profile)
 {
+    static const struct bme280_profile x1 = {1, 1, 1, 0};
+
+    if (NULL == profile)
+	profile = &x1;
     have_bme280 = 0;
 
     DbgR (i2c_master_init(sda, scl));
@@ -335,17 +393,17 @@ esp_err_t bme280_init (uint8_t sda, uint8_t scl, int full)
     }
 
     DbgR (i2c_bme280_setup (
-	1,			// oversampling x1 (read once)
-	1,			// oversampling x1 (read once)
-	1,			// oversampling x1 (read once)
+	profile->osrs_t,	// temperature oversampling
+	profile->osrs_p,	// pressure oversampling
+	profile->osrs_h,	// humidity oversampling
 	BME280_SLEEP_MODE,	// power mode
-	0,			// filter off
 	0,			// inactive_duration (not used)
+	profile->filter,	// IIR filter
 	full));			// init the chip too (we do on cold start)
 
     have_bme280 = 1;
 
-    if (full)
+    if (full || 0 == bme280_ready_us)
 	DbgR (i2c_bme280_startreadout(1));
 
     return ESP_OK;
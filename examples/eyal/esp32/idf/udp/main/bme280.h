@@ -1,8 +1,21 @@
 #ifndef _BME280_H
 #define _BME280_H
 
+/* Oversampling: 0=skip 1=x1 2=x2 3=x4 4=x8 5=x16
+ * IIR filter coefficient: 0=off 1=2 2=4 3=8 4=16
+ * The measurement is started at the end of a wake and read on the next,
+ * so more oversampling does not add to the wake time.
+ */
+struct bme280_profile {
+	uint8_t osrs_t;
+	uint8_t osrs_p;
+	uint8_t osrs_h;
+	uint8_t filter;
+};
+
 /* bme280.c */
-esp_err_t bme280_init (uint8_t sda, uint8_t scl, int full);
+esp_err_t bme280_init (uint8_t sda, uint8_t scl, int full,
+	const struct bme280_profile *profile);	// NULL for x1, no filter
 esp_err_t bme280_read (int32_t alt, float *pT, float *pQFE, float *pH, float *pQNH);
 
 #define BME280_BAD_HUMI	0
@@ -0,0 +1,205 @@
+/* Per board configuration.
+ *
+ * One record, versioned and with a crc, kept in NVS. It is read from flash
+ * on a cold start only and then kept in RTC memory, a wake from deep sleep
+ * uses that copy and does not touch the flash.
+ *
+ * An image built for a board (MY_HOST) stores its built in record when NVS
+ * has none, or when it differs from the stored one, so edits to the MY_HOST
+ * blocks take effect. A generic image (MY_HOST 0) uses the stored record
+ * and only falls back to its built in one, without storing it.
+ * So a board is set up by running an image built for it once, after that
+ * any image runs it with its own settings.
+ * Build with CONFIG_WRITE=1 to always store the built in record.
+*/
+
+#include "udp.h"
+#include "config.h"
+#include "onewire.h"		// onewire_crc16()
+
+#include <stddef.h>		// offsetof()
+#include <nvs_flash.h>
+#include <nvs.h>
+#include <esp_attr.h>		// RTC_DATA_ATTR
+
+#ifndef CONFIG_WRITE
+#define CONFIG_WRITE		0	// 1= always store the built in record
+#endif
+
+#define CONFIG_NAMESPACE	"udp"
+#define CONFIG_KEY		"config"
+
+#ifndef MY_NAME
+#define MY_NAME			"test"
+#endif
+
+#ifndef MY_HOST
+#define MY_HOST			0	// not a known board, set it up in NVS
+#endif
+
+// the built in record, from what used to be in udp.c
+#define FLAGS			CONFIG_DS18B20
+#define SLEEP_S			60	// seconds
+#define ADC_VREF		1100	// mV
+#define ACTION			"store"
+
+			// adc pins are 32-39
+#define VDD_PIN			32
+#define VDD_DIVIDER		2	// 1m.1m
+
+#define BAT_PIN			33
+#define BAT_DIVIDER		3	// 1m.2m
+#define BAT_VOLTAGE		3.3
+
+#define V1_PIN			CONFIG_NO_PIN	// 34
+#define V1_DIVIDER		1	// resistor network
+
+#if   62 == MY_HOST	// esp-32a
+#undef  FLAGS
+#define FLAGS			(CONFIG_BME280 | CONFIG_DS18B20)
+#undef  BAT_VOLTAGE
+#define BAT_VOLTAGE		5.0
+#undef  ADC_VREF
+#define ADC_VREF		1130	// measured
+#undef  SLEEP_S
+#define SLEEP_S			(10*60)	// 10m in seconds
+
+#elif 64 == MY_HOST	// esp-32b
+#undef  ADC_VREF
+#define ADC_VREF		1094	// measured when Vdd=3.313v
+#undef  VDD_DIVIDER
+#define VDD_DIVIDER		(2*1.016)
+#undef  SLEEP_S
+#define SLEEP_S			(1*60)	// 1m in seconds
+
+#elif 65 == MY_HOST	// esp-32c
+#undef  ADC_VREF
+#define ADC_VREF		1113	// measured when Vdd=3.272v
+#undef  SLEEP_S
+#define SLEEP_S			(5*60)	// 5m in seconds
+
+#elif 0 != MY_HOST
+#error unknown host MY_HOST
+#endif
+
+static const struct config config_default = {
+	.device		= MY_HOST,
+	.flags		= FLAGS,
+	.sleep_s	= SLEEP_S,
+	.adc_vref	= ADC_VREF,
+	.vdd_pin	= VDD_PIN,
+	.bat_pin	= BAT_PIN,
+	.v1_pin		= V1_PIN,
+	.vdd_divider	= VDD_DIVIDER,
+	.bat_divider	= BAT_DIVIDER,
+	.v1_divider	= V1_DIVIDER,
+	.bat_voltage	= BAT_VOLTAGE,
+	.name		= MY_NAME,
+	.action		= ACTION,
+};
+
+RTC_DATA_ATTR static struct config rtc_config;
+const struct config *config = &rtc_config;
+
+static uint16_t config_crc (const struct config *c)
+{
+	return onewire_crc16 ((const uint8_t *)c, offsetof(struct config, crc), 0);
+}
+
+static int config_good (const struct config *c)
+{
+	return CONFIG_MAGIC == c->magic
+	    && CONFIG_VERSION == c->version
+	    && sizeof(*c) == c->len
+	    && config_crc (c) == c->crc;
+}
+
+esp_err_t config_nvs_init (void)
+{
+	static int done = 0;
+
+	if (!done) {
+Log ("nvs_flash_init");
+		DbgR (nvs_flash_init());
+		done = 1;
+	}
+
+	return ESP_OK;
+}
+
+static esp_err_t config_read (struct config *c)
+{
+	esp_err_t ret;
+	nvs_handle h;
+	size_t len = sizeof(*c);
+
+	DbgR (config_nvs_init ());
+	DbgR (nvs_open (CONFIG_NAMESPACE, NVS_READONLY, &h));
+	ret = nvs_get_blob (h, CONFIG_KEY, c, &len);	// NOT_FOUND is not worth a log
+	nvs_close (h);
+
+	if (ESP_OK == ret && !config_good (c))
+		ret = ESP_ERR_INVALID_CRC;
+	return ret;
+}
+
+static esp_err_t config_write (const struct config *c)
+{
+	esp_err_t ret;
+	nvs_handle h;
+
+	DbgR (config_nvs_init ());
+	DbgR (nvs_open (CONFIG_NAMESPACE, NVS_READWRITE, &h));
+	Dbg (nvs_set_blob (h, CONFIG_KEY, c, sizeof(*c)));
+	if (ESP_OK == ret)
+		Dbg (nvs_commit (h));
+	nvs_close (h);
+
+	return ret;
+}
+
+esp_err_t config_load (void)
+{
+	struct config builtin;
+	esp_err_t ret;
+
+	if (woke_up && config_good (&rtc_config))
+		return ESP_OK;
+
+	memcpy (&builtin, &config_default, sizeof(builtin));
+	builtin.magic = CONFIG_MAGIC;
+	builtin.version = CONFIG_VERSION;
+	builtin.len = sizeof(builtin);
+	builtin.crc = config_crc (&builtin);
+
+	memset (&rtc_config, 0, sizeof(rtc_config));
+	ret = config_read (&rtc_config);
+	if (ESP_OK == ret && !CONFIG_WRITE
+	    && (0 == MY_HOST
+	     || !memcmp (&rtc_config, &builtin, offsetof(struct config, crc)))) {
+		Log ("config: device %d '%s' from flash",
+			rtc_config.device, rtc_config.name);
+		return ESP_OK;
+	}
+	if (ESP_OK == ret)
+		Log ("config: device %d '%s' in flash replaced by the built in one",
+			rtc_config.device, rtc_config.name);
+	else
+		Log ("config: none in flash (ret=%d), using the built in one", ret);
+
+	rtc_config = builtin;
+	if (0 == MY_HOST && !CONFIG_WRITE) {	// a placeholder, not worth keeping
+		Log ("config: device %d '%s' not stored, generic image",
+			rtc_config.device, rtc_config.name);
+		return ESP_OK;
+	}
+
+	Dbg (config_write (&rtc_config));	// runs anyway, next cold start tries again
+	if (ESP_OK == ret)
+		Log ("config: device %d '%s' stored", rtc_config.device, rtc_config.name);
+	else
+		Log ("config: device %d '%s' not stored (ret=%d)",
+			rtc_config.device, rtc_config.name, ret);
+
+	return ret;
+}
@@ -0,0 +1,39 @@
+#ifndef _CONFIG_H
+#define _CONFIG_H
+
+#define CONFIG_MAGIC		0x43464731	// "CFG1"
+#define CONFIG_VERSION		1		// bump when the layout changes
+
+#define CONFIG_BME280		0x0001		// a bme280 is connected
+#define CONFIG_DS18B20		0x0002		// ds18b20s on OW_PIN
+
+#define CONFIG_NO_PIN		-1
+
+// what used to be chosen with MY_HOST at build time
+struct config {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t len;			// sizeof(struct config)
+	uint16_t device;		// in the message header
+	uint16_t flags;			// CONFIG_*
+	uint32_t sleep_s;		// cycle length
+	uint16_t adc_vref;		// mV, measured
+	int8_t vdd_pin;			// adc pins, CONFIG_NO_PIN for none
+	int8_t bat_pin;
+	int8_t v1_pin;
+	uint8_t spare[3];
+	float vdd_divider;
+	float bat_divider;
+	float v1_divider;
+	float bat_voltage;		// reported when there is no bat_pin
+	char name[16];
+	char action[8];
+	uint16_t crc;			// of all the above
+};
+
+/* config.c */
+extern const struct config *config;
+esp_err_t config_nvs_init (void);
+esp_err_t config_load (void);
+
+#endif // _CONFIG_H
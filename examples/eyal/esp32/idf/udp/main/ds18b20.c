@@ -15,13 +15,17 @@
 
 /*
  no support for DS18S20
- no ow search
- Only reading temp (12 bits) supported
+ Resolution 9 to 12 bits, ds18b20_set_resolution()
  Does not deal with parasitic power properly
+
+ Devices are found with a ROM search, their ids are kept in RTC memory.
+ One CONVERT_T is broadcast to all, each is then read with MATCH_ROM
+ (SKIP_ROM when it is alone on the bus).
 */
 
 #include "driver/gpio.h"
 #include "rom/ets_sys.h"
+#include "esp_attr.h"		// RTC_DATA_ATTR
 
 #include "udp.h"
 #include "ds18b20.h"
@@ -43,9 +47,14 @@
 #define DS18B20_READ_POWER_SUPPLY	0xB4
 
 static int inited = 0;
-static uint8_t rom_id[8] = {0};
+static int match = 0;		// address each device by its id
+
+RTC_DATA_ATTR static int resolution = 12;	// bits, the power up default
+RTC_DATA_ATTR static int ndevs = 0;	// 0: not searched yet
+RTC_DATA_ATTR static uint8_t dev_ids[DS18B20_MAX_DEVICES][8];
 
-static esp_err_t ds18b20_send_command(uint8_t cmd)
+// id NULL: all devices
+static esp_err_t ds18b20_send_command(const uint8_t *id, uint8_t cmd)
 {
 	uint8_t	b[1];
 
@@ -53,10 +62,10 @@ static esp_err_t ds18b20_send_command(uint8_t cmd)
 
 	if (DS18B20_READ_ROM == cmd)
 		{}
-	else if (0 != rom_id[0]) {
+	else if (NULL != id) {
 		b[0] = DS18B20_MATCH_ROM;
 		DbgR (ow_write_byte(b));
-		DbgR (ow_write_bytes(8, rom_id));
+		DbgR (ow_write_bytes(8, (uint8_t *)id));
 	} else {
 		b[0] = DS18B20_SKIP_ROM;
 		DbgR (ow_write_byte(b));
@@ -68,13 +77,19 @@ static esp_err_t ds18b20_send_command(uint8_t cmd)
 	return ESP_OK;
 }
 
-static esp_err_t ds18b20_read_scratchpad(uint8_t *scratchpad)
+static const uint8_t *ds18b20_id (int i)
+{
+	return match ? dev_ids[i] : NULL;
+}
+
+static esp_err_t ds18b20_read_scratchpad(int i, uint8_t *scratchpad)
 {
 	uint8_t crc;
 
 	if(!inited) DbgR (ESP_FAIL);
+	if (i < 0 || i >= ndevs) DbgR (ESP_FAIL);
 
-	DbgR (ds18b20_send_command (DS18B20_READ_SCRATCHPAD));
+	DbgR (ds18b20_send_command (ds18b20_id (i), DS18B20_READ_SCRATCHPAD));
 	DbgR (ow_read_bytes (9, scratchpad));
 
 	if (scratchpad[8] != (crc = onewire_crc8(scratchpad, 8)))
@@ -84,35 +99,75 @@ static esp_err_t ds18b20_read_scratchpad(uint8_t *scratchpad)
 	return ESP_OK;
 }
 
-esp_err_t ds18b20_read_temp(float *temp)
+// device 'i' of ds18b20_count()
+esp_err_t ds18b20_read_temp(int i, float *temp)
 {
 	uint8_t scratchpad[9];
 	int16_t t;
 
 	*temp = BAD_TEMP;
-	DbgR (ds18b20_read_scratchpad(scratchpad));
+	DbgR (ds18b20_read_scratchpad(i, scratchpad));
 	t = ((int16_t)scratchpad[1]<<8) | scratchpad[0];
 	if (85*16 == t || 0x07ff == t) {	// common bad readings
 		*temp = BAD_TEMP + .01;
 		LogR (ESP_FAIL, "bad temp %.4f 0x%04x", t/16., t);
 	}
+	t &= ~((1 << (12 - resolution)) - 1);	// low bits undefined below 12 bits
 	*temp = t / 16.0;
 
 	return ESP_OK;
 }
 
+// worst case, rounded up: 94, 188, 375, 750
+int ds18b20_conversion_ms (void)
+{
+	return ((750000 >> (12 - resolution)) + 999) / 1000;
+}
+
+// 9 to 12 bits for all devices, the EEPROM is written only when it changes
+esp_err_t ds18b20_set_resolution (int bits)
+{
+	uint8_t scratchpad[9];
+	uint8_t b[3];
+	int i;
+
+	if(!inited) DbgR (ESP_FAIL);
+	if (bits < 9 || bits > 12)
+		LogR (ESP_FAIL, "bad resolution %d", bits);
+
+	for (i = 0; i < ndevs; ++i) {
+		DbgR (ds18b20_read_scratchpad(i, scratchpad));
+		b[0] = scratchpad[2];		// keep TH and TL
+		b[1] = scratchpad[3];
+		b[2] = ((bits - 9) << 5) | 0x1F;
+		if (b[2] == scratchpad[4])
+			continue;
+
+		DbgR (ds18b20_send_command (ds18b20_id (i), DS18B20_WRITE_SCRATCHPAD));
+		DbgR (ow_write_bytes (3, b));
+
+		DbgR (ds18b20_send_command (ds18b20_id (i), DS18B20_COPY_SCRATCHPAD));
+		delay_ms (10);			// EEPROM write
+Log ("ds18b20 %d set to %d bits", i, bits);
+	}
+	resolution = bits;
+
+	return ESP_OK;
+}
+
+// all devices at once, polling waits for the slowest
 esp_err_t ds18b20_convert (int wait)
 {
 	if(!inited) DbgR (ESP_FAIL);
 
-	DbgR (ds18b20_send_command (DS18B20_CONVERT_T));
+	DbgR (ds18b20_send_command (NULL, DS18B20_CONVERT_T));
 
 	if (wait) {
 		uint8_t ready;
-		int ms = 750;
+		int ms = ds18b20_conversion_ms ();
 
-		delay_ms (100);
-		ms -= 100;
+		delay_ms (ms/8);		// none is that quick
+		ms -= ms/8;
 
 		do {
 			if (ms-- <= 0) DbgR (ESP_FAIL);
@@ -135,7 +190,7 @@ esp_err_t ds18b20_read_id (uint8_t *id)
 {
 	uint8_t crc;
 
-	DbgR (ds18b20_send_command (DS18B20_READ_ROM));
+	DbgR (ds18b20_send_command (NULL, DS18B20_READ_ROM));
 	DbgR (ow_read_bytes (8, id));
 	if (id[7] != (crc = onewire_crc8(id, 7)))
 		LogR (ESP_FAIL, "bad id crc %02x, read %02x",
@@ -144,6 +199,52 @@ esp_err_t ds18b20_read_id (uint8_t *id)
 	return ESP_OK;
 }
 
+// find the devices, the ids are kept until ds18b20_forget()
+esp_err_t ds18b20_search (int *n)
+{
+	esp_err_t ret;
+	uint8_t id[8];
+
+	if(!inited) DbgR (ESP_FAIL);
+
+	ndevs = 0;
+	ow_search_reset ();
+	while (ndevs < DS18B20_MAX_DEVICES) {
+		ret = ow_search (id);
+		if (ESP_ERR_NOT_FOUND == ret)
+			break;
+		DbgR (ret);
+		if (DS18B20_DEVICE_ID != id[0])
+			continue;
+		memcpy (dev_ids[ndevs++], id, 8);
+	}
+	match = ndevs > 1;
+	*n = ndevs;
+
+	if (0 == ndevs)
+		LogR (ESP_FAIL, "no ds18b20 found");
+
+	return ESP_OK;
+}
+
+// 0 if not searched yet
+int ds18b20_count (void)
+{
+	return ndevs;
+}
+
+uint8_t *ds18b20_get_id (int i)
+{
+	return (i >= 0 && i < ndevs) ? dev_ids[i] : NULL;
+}
+
+// search again on the next wake
+void ds18b20_forget (void)
+{
+	ndevs = 0;
+}
+
+// id NULL: use ds18b20_search(), else only this device
 esp_err_t ds18b20_init (uint8_t pin, uint8_t *id)
 {
 	DbgR (ow_init (pin));
@@ -154,8 +255,11 @@ esp_err_t ds18b20_init (uint8_t pin, uint8_t *id)
 		if (id[0] != DS18B20_DEVICE_ID)	// not a ds18b20
 			LogR (ESP_FAIL, "device type %02x not a ds18b20 (%02x)",
 				id[0], DS18B20_DEVICE_ID);
-		memcpy (rom_id, id, 8);
-	}
+		memcpy (dev_ids[0], id, 8);
+		ndevs = 1;
+		match = 1;
+	} else
+		match = ndevs > 1;
 
 	inited = 1;
 
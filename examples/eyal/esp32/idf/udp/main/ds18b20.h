@@ -1,11 +1,19 @@
 #ifndef _DS18B20_H
 #define _DS18B20_H
 
+#define DS18B20_MAX_DEVICES	8	// on the bus
+
 /* ds18b20.c */
-esp_err_t ds18b20_read_temp (float *temp);
+esp_err_t ds18b20_read_temp (int i, float *temp);
 esp_err_t ds18b20_convert (int wait);
+int ds18b20_conversion_ms (void);
+esp_err_t ds18b20_set_resolution (int bits);
 esp_err_t ds18b20_depower (void);
 esp_err_t ds18b20_read_id (uint8_t *id);
+esp_err_t ds18b20_search (int *n);
+int ds18b20_count (void);
+uint8_t *ds18b20_get_id (int i);
+void ds18b20_forget (void);
 esp_err_t ds18b20_init (uint8_t pin, uint8_t *id);
 
 #endif	// _DS18B20_H
@@ -0,0 +1,172 @@
+/* Batched I2C register access.
+ *
+ * Queue a few register reads and writes, then run them as one command
+ * link in one i2c_master_cmd_begin(): repeated starts between ops, one
+ * stop at the end. Consecutive writes go in one write when the device
+ * takes reg/value pairs (the BME280 does).
+ *
+ * The command link is built in a static buffer where the IDF allows it
+ * (i2c_cmd_link_create_static), else it is one malloc'ed link a batch
+ * rather than one per register access.
+ *
+ * The bus gives one result for the lot. When it fails, each op is run
+ * again alone to find which ones did, so each op has its own 'ret'.
+*/
+
+#include "udp.h"
+#include "i2c-batch.h"
+
+#define ACK_CHECK_EN		0x1
+#define ACK_VAL			0
+#define NAK_VAL			1
+
+#define I2C_BATCH_TIMEOUT_MS	1000
+
+#ifdef I2C_LINK_RECOMMENDED_SIZE
+// a read is 7 items (start, address, register, start, address, 2 reads)
+static uint8_t link_buf[I2C_LINK_RECOMMENDED_SIZE(2*I2C_BATCH_MAX)];
+#endif
+
+void i2c_batch_begin (struct i2c_batch *b, i2c_port_t port, uint8_t addr, int pairs)
+{
+	b->port = port;
+	b->addr = addr;
+	b->pairs = pairs;
+	b->nops = 0;
+}
+
+static struct i2c_op *add_op (struct i2c_batch *b)
+{
+	struct i2c_op *op;
+
+	if (b->nops >= I2C_BATCH_MAX)
+		return NULL;
+
+	op = &b->ops[b->nops++];
+	memset (op, 0, sizeof(*op));
+	op->ret = ESP_ERR_INVALID_STATE;	// not run yet
+	return op;
+}
+
+esp_err_t i2c_batch_read (struct i2c_batch *b, uint8_t reg, uint8_t *buf, size_t len)
+{
+	struct i2c_op *op;
+
+	if (NULL == buf || len < 1)
+		return ESP_ERR_INVALID_ARG;
+	if (NULL == (op = add_op (b)))
+		LogR (ESP_ERR_NO_MEM, "i2c batch full");
+
+	op->reg = reg;
+	op->buf = buf;
+	op->len = len;
+
+	return ESP_OK;
+}
+
+esp_err_t i2c_batch_write (struct i2c_batch *b, uint8_t reg, uint8_t val)
+{
+	struct i2c_op *op;
+
+	if (NULL == (op = add_op (b)))
+		LogR (ESP_ERR_NO_MEM, "i2c batch full");
+
+	op->reg = reg;
+	op->val = val;
+
+	return ESP_OK;
+}
+
+static esp_err_t address (i2c_cmd_handle_t cmd, uint8_t addr, int dir)
+{
+	return i2c_master_write_byte (cmd, (addr << 1) | dir, ACK_CHECK_EN);
+}
+
+static esp_err_t build_ops (i2c_cmd_handle_t cmd, struct i2c_batch *b, int first, int n)
+{
+	int writing = 0;	// in a write, more pairs can follow
+	int i;
+
+	for (i = first; i < first+n; ++i) {
+		struct i2c_op *op = &b->ops[i];
+
+		if (NULL == op->buf) {
+			if (!writing || !b->pairs) {
+				DbgR (i2c_master_start (cmd));
+				DbgR (address (cmd, b->addr, I2C_MASTER_WRITE));
+			}
+			DbgR (i2c_master_write_byte (cmd, op->reg, ACK_CHECK_EN));
+			DbgR (i2c_master_write_byte (cmd, op->val, ACK_CHECK_EN));
+			writing = 1;
+			continue;
+		}
+
+// send address read request
+		writing = 0;
+		DbgR (i2c_master_start (cmd));
+		DbgR (address (cmd, b->addr, I2C_MASTER_WRITE));
+		DbgR (i2c_master_write_byte (cmd, op->reg, ACK_CHECK_EN));
+
+// receive data
+		DbgR (i2c_master_start (cmd));
+		DbgR (address (cmd, b->addr, I2C_MASTER_READ));
+		if (op->len > 1)
+			DbgR (i2c_master_read (cmd, op->buf, op->len-1, ACK_VAL));
+		DbgR (i2c_master_read_byte (cmd, op->buf+op->len-1, NAK_VAL));
+	}
+	DbgR (i2c_master_stop (cmd));
+
+	return ESP_OK;
+}
+
+// ops [first, first+n) as one transaction
+static esp_err_t run_ops (struct i2c_batch *b, int first, int n)
+{
+	i2c_cmd_handle_t cmd;
+	esp_err_t ret;
+
+#ifdef I2C_LINK_RECOMMENDED_SIZE
+	cmd = i2c_cmd_link_create_static (link_buf, sizeof(link_buf));
+#else
+	cmd = i2c_cmd_link_create ();
+#endif
+	if (NULL == cmd)
+		return ESP_ERR_NO_MEM;
+
+	Dbg (build_ops (cmd, b, first, n));
+	if (ESP_OK == ret)
+		Dbg (i2c_master_cmd_begin (b->port, cmd, I2C_BATCH_TIMEOUT_MS / portTICK_RATE_MS));
+
+#ifdef I2C_LINK_RECOMMENDED_SIZE
+	i2c_cmd_link_delete_static (cmd);
+#else
+	i2c_cmd_link_delete (cmd);
+#endif
+
+	return ret;
+}
+
+// Returns the first failure, 'ret' of each op tells which
+esp_err_t i2c_batch_run (struct i2c_batch *b)
+{
+	esp_err_t ret, first = ESP_OK;
+	int i;
+
+	if (b->nops < 1)
+		return ESP_OK;
+
+	ret = run_ops (b, 0, b->nops);
+	if (ESP_OK == ret || 1 == b->nops) {
+		for (i = 0; i < b->nops; ++i)
+			b->ops[i].ret = ret;
+		return ret;
+	}
+
+	for (i = 0; i < b->nops; ++i) {
+		b->ops[i].ret = run_ops (b, i, 1);
+		if (ESP_OK == first)
+			first = b->ops[i].ret;
+	}
+
+	return ESP_OK == first ? ret : first;
+}
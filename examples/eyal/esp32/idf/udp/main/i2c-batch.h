@@ -0,0 +1,30 @@
+#ifndef _I2C_BATCH_H
+#define _I2C_BATCH_H
+
+#include <driver/i2c.h>
+
+#define I2C_BATCH_MAX	6		// ops in one transaction
+
+struct i2c_op {
+	uint8_t reg;
+	uint8_t val;			// to write
+	uint8_t *buf;			// to read into, NULL for a write
+	size_t len;
+	esp_err_t ret;			// set by i2c_batch_run()
+};
+
+struct i2c_batch {
+	i2c_port_t port;
+	uint8_t addr;
+	uint8_t pairs;			// the device takes reg/value pairs in one write
+	int nops;
+	struct i2c_op ops[I2C_BATCH_MAX];
+};
+
+/* i2c-batch.c */
+void i2c_batch_begin (struct i2c_batch *b, i2c_port_t port, uint8_t addr, int pairs);
+esp_err_t i2c_batch_read (struct i2c_batch *b, uint8_t reg, uint8_t *buf, size_t len);
+esp_err_t i2c_batch_write (struct i2c_batch *b, uint8_t reg, uint8_t val);
+esp_err_t i2c_batch_run (struct i2c_batch *b);
+
+#endif // _I2C_BATCH_H
@@ -0,0 +1,424 @@
+/* Deferred logging.
+ *
+ * Log() only stores the format pointer, the arguments and the time in a
+ * ring, which costs a few us. The text is produced later by a low priority
+ * task, and whatever is left just before deep sleep, so the uart does not
+ * slow down (or time shift) the app when logging is on.
+ *
+ * The format must be a literal (it is kept as a pointer). %s strings are
+ * copied into the ring.
+ *
+ * With LOG_RTC the ring is in RTC memory, and lines not yet printed when
+ * the chip resets are printed after the restart. It needs RTC_NOINIT_ATTR,
+ * which IDF v3.0 does not have.
+*/
+
+#include "udp.h"
+
+#if LOG_DEFERRED
+
+#include <stdarg.h>
+#include <esp_attr.h>		// RTC_NOINIT_ATTR
+#include <rom/rtc.h>		// rtc_get_reset_reason()
+#include <freertos/task.h>
+
+#define LOG_MAGIC	0x4C4F4731	// "LOG1"
+#define LOG_MAX_STR	1024		// longer %s are cut
+#define LOG_TASK_MS	20		// how often the task looks
+#define LOG_TASK_STACK	(3*1024)
+#define LOG_TASK_CPU	0		// the readings run on the other core
+
+#if LOG_RTC
+#define LOG_SIZE	2048		// must be a power of 2
+#else
+#define LOG_SIZE	8192		// must be a power of 2
+#endif
+
+enum {
+	ARG_NONE = 0,	// %%
+	ARG_INT,
+	ARG_LONG,
+	ARG_LLONG,
+	ARG_DOUBLE,
+	ARG_PTR,
+	ARG_STR,	// uint16_t length (with the NUL), then the string
+};
+
+union log_val {
+	int i;
+	long l;
+	long long ll;
+	double d;
+	const void *p;
+};
+
+struct log_head {
+	uint32_t len;		// of the whole record, 0 = wrap to the start
+	const char *fmt;
+	uint64_t us;		// since app start
+};
+
+struct log_ring {
+	uint32_t magic;
+	uint32_t put;		// free running, mod LOG_SIZE
+	uint32_t got;
+	uint32_t lost;		// lines that did not fit
+	uint8_t buf[LOG_SIZE];
+};
+
+#if !LOG_RTC
+static struct log_ring ring;
+#elif defined(RTC_NOINIT_ATTR)
+RTC_NOINIT_ATTR static struct log_ring ring;	// survives any reset
+#else
+// RTC_DATA_ATTR is reloaded on every reset but deep sleep, and the ring is
+// empty before deep sleep, so there would never be anything to print.
+#error "LOG_RTC needs RTC_NOINIT_ATTR (IDF v3.1 or later)"
+#endif
+
+static portMUX_TYPE log_mux = portMUX_INITIALIZER_UNLOCKED;
+static int draining = 0;
+
+#define ALIGN4(n)	(((n) + 3) & ~3)
+
+static void log_reset (void)
+{
+	ring.put = ring.got = ring.lost = 0;
+	ring.magic = LOG_MAGIC;
+}
+
+// p is just after the '%', returns the end of the spec
+static const char *log_spec (const char *p, int *kind, int *stars)
+{
+	int longs = 0;
+
+	*stars = 0;
+	for (; *p && strchr ("-+ #0123456789.*", *p); ++p)
+		if ('*' == *p)
+			++*stars;
+	for (; *p && strchr ("hlLqjzt", *p); ++p)
+		if ('l' == *p || 'z' == *p || 't' == *p)
+			++longs;
+		else if ('q' == *p || 'j' == *p)
+			longs += 2;
+
+	switch (*p) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+		*kind = longs > 1 ? ARG_LLONG : longs ? ARG_LONG : ARG_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+		*kind = ARG_DOUBLE;
+		break;
+	case 'p':
+		*kind = ARG_PTR;
+		break;
+	case 's':
+		*kind = ARG_STR;
+		break;
+	case '\0':
+		*kind = ARG_NONE;
+		return p;
+	default:		// '%' and what we do not know
+		*kind = ARG_NONE;
+		break;
+	}
+
+	return p+1;
+}
+
+// Store the arguments at 'out', not more than 'room' bytes.
+// With out==NULL only returns the size needed.
+static uint32_t log_args (uint8_t *out, uint32_t room, const char *fmt, va_list ap)
+{
+	const char *p = fmt;
+	uint32_t n = 0;
+
+	while (*p) {
+		union log_val v;
+		int kind, stars;
+
+		if ('%' != *p++)
+			continue;
+		p = log_spec (p, &kind, &stars);
+
+		for (; stars > 0; --stars) {
+			v.i = va_arg (ap, int);
+			if (NULL != out && n + sizeof(v) <= room)
+				memcpy (out+n, &v, sizeof(v));
+			n += sizeof(v);
+		}
+
+		switch (kind) {
+		case ARG_NONE:
+			continue;
+		case ARG_INT:
+			v.i = va_arg (ap, int);
+			break;
+		case ARG_LONG:
+			v.l = va_arg (ap, long);
+			break;
+		case ARG_LLONG:
+			v.ll = va_arg (ap, long long);
+			break;
+		case ARG_DOUBLE:
+			v.d = va_arg (ap, double);
+			break;
+		case ARG_PTR:
+			v.p = va_arg (ap, const void *);
+			break;
+		case ARG_STR: {
+			const char *s = va_arg (ap, const char *);
+			uint16_t len;
+
+			if (NULL == s)
+				s = "(null)";
+			len = strnlen (s, LOG_MAX_STR);
+			if (NULL != out && n + sizeof(len) + len + 1 <= room) {
+				++len;
+				memcpy (out+n, &len, sizeof(len));
+				memcpy (out+n+sizeof(len), s, len-1);
+				out[n+sizeof(len)+len-1] = '\0';
+			} else
+				++len;
+			n += sizeof(len) + len;
+			continue;
+			}
+		}
+
+		if (NULL != out && n + sizeof(v) <= room)
+			memcpy (out+n, &v, sizeof(v));
+		n += sizeof(v);
+	}
+
+	return n;
+}
+
+void log_put (const char *fmt, ...)
+{
+	struct log_head h;
+	struct timeval now;
+	va_list ap, aq;
+	uint32_t at, rest, used;
+
+	get_time_tv (&now);
+	h.fmt = fmt;
+	h.us = (uint64_t)now.tv_sec * 1000000 + now.tv_usec;
+
+	va_start (ap, fmt);
+	va_copy (aq, ap);
+
+	portENTER_CRITICAL (&log_mux);
+	if (LOG_MAGIC != ring.magic)
+		log_reset ();
+
+	h.len = ALIGN4 (sizeof(h) + log_args (NULL, 0, fmt, aq));
+	at = ring.put % LOG_SIZE;
+	rest = LOG_SIZE - at;
+	used = ring.put - ring.got;
+	if (h.len > LOG_SIZE/2
+	    || used + h.len + (rest < h.len ? rest : 0) > LOG_SIZE) {
+		++ring.lost;
+	} else {
+		if (rest < h.len) {			// wrap to the start
+			memset (ring.buf+at, 0, sizeof(h.len));
+			ring.put += rest;
+			at = 0;
+		}
+		memcpy (ring.buf+at, &h, sizeof(h));
+		log_args (ring.buf+at+sizeof(h), h.len-sizeof(h), fmt, ap);
+		ring.put += h.len;
+	}
+	portEXIT_CRITICAL (&log_mux);
+
+	va_end (aq);
+	va_end (ap);
+}
+
+#define PR(v) \
+do { \
+	if (0 == stars) \
+		printf (spec, v); \
+	else if (1 == stars) \
+		printf (spec, star[0], v); \
+	else \
+		printf (spec, star[0], star[1], v); \
+} while (0)
+
+static void log_print (const uint8_t *rec)
+{
+	struct log_head h;
+	const uint8_t *a, *end;
+	const char *p, *q;
+	char spec[16];
+
+	memcpy (&h, rec, sizeof(h));
+	a = rec + sizeof(h);
+	end = rec + h.len;
+
+	printf ("%3lu.%06lu ", (unsigned long)(h.us / 1000000), (unsigned long)(h.us % 1000000));
+
+	for (p = h.fmt; *p; p = q) {
+		union log_val v;
+		int kind, stars, star[2] = {0, 0};
+		int i;
+
+		if ('%' != *p) {
+			for (q = p; *q && '%' != *q; ++q)
+				;
+			fwrite (p, 1, q-p, stdout);
+			continue;
+		}
+
+		q = log_spec (p+1, &kind, &stars);
+		for (i = 0; i < stars; ++i) {
+			if (a + sizeof(v) > end)
+				goto cut;
+			memcpy (&v, a, sizeof(v));
+			a += sizeof(v);
+			if (i < 2)
+				star[i] = v.i;
+		}
+		if (stars > 2 || (size_t)(q - p) >= sizeof(spec)) {
+			fwrite (p, 1, q-p, stdout);	// too odd, show it as is
+			if (ARG_NONE == kind)
+				continue;
+			kind = -kind;			// skip the value
+		} else {
+			memcpy (spec, p, q-p);
+			spec[q-p] = '\0';
+		}
+
+		if (ARG_NONE == kind) {
+			fputs ("%", stdout);
+			continue;
+		}
+		if (ARG_STR == kind || -ARG_STR == kind) {
+			uint16_t len;
+
+			if (a + sizeof(len) > end)
+				goto cut;
+			memcpy (&len, a, sizeof(len));
+			if (a + sizeof(len) + len > end)
+				goto cut;
+			if (ARG_STR == kind)
+				PR ((const char *)(a + sizeof(len)));
+			a += sizeof(len) + len;
+			continue;
+		}
+
+		if (a + sizeof(v) > end)
+			goto cut;
+		memcpy (&v, a, sizeof(v));
+		a += sizeof(v);
+
+		switch (kind) {
+		case ARG_INT:
+			PR (v.i);
+			break;
+		case ARG_LONG:
+			PR (v.l);
+			break;
+		case ARG_LLONG:
+			PR (v.ll);
+			break;
+		case ARG_DOUBLE:
+			PR (v.d);
+			break;
+		case ARG_PTR:
+			PR (v.p);
+			break;
+		}
+	}
+	printf ("\n");
+	return;
+cut:
+	printf ("...\n");
+}
+#undef PR
+
+static int log_claim (void)
+{
+	int ok;
+
+	portENTER_CRITICAL (&log_mux);
+	ok = !draining;
+	draining = 1;
+	portEXIT_CRITICAL (&log_mux);
+
+	return ok;
+}
+
+void log_drain (void)
+{
+	uint32_t lost;
+
+	while (!log_claim ())
+		vTaskDelay (1);		// the task is at it, wait for it
+
+	for (;;) {
+		const uint8_t *rec = NULL;
+		uint32_t len = 0;
+
+		portENTER_CRITICAL (&log_mux);
+		if (LOG_MAGIC == ring.magic && ring.got != ring.put) {
+			uint32_t at = ring.got % LOG_SIZE;
+
+			memcpy (&len, ring.buf+at, sizeof(len));
+			if (0 == len) {			// wrapped
+				ring.got += LOG_SIZE - at;
+				at = 0;
+				memcpy (&len, ring.buf, sizeof(len));
+			}
+			rec = ring.buf+at;
+		}
+		portEXIT_CRITICAL (&log_mux);
+		if (NULL == rec)
+			break;
+
+		log_print (rec);		// writers do not touch it
+
+		portENTER_CRITICAL (&log_mux);
+		ring.got += len;
+		portEXIT_CRITICAL (&log_mux);
+	}
+
+	portENTER_CRITICAL (&log_mux);
+	lost = ring.lost;
+	ring.lost = 0;
+	draining = 0;
+	portEXIT_CRITICAL (&log_mux);
+
+	if (lost)
+		printf ("log: %u lines lost\n", (unsigned)lost);
+	fflush (stdout);
+}
+
+static void log_task (void *param)
+{
+	for (;;) {
+		log_drain ();
+		vTaskDelay (LOG_TASK_MS / portTICK_PERIOD_MS);
+	}
+}
+
+void log_start (void)
+{
+#if LOG_RTC
+	if (LOG_MAGIC == ring.magic
+	    && ring.put - ring.got <= LOG_SIZE
+	    && POWERON_RESET != rtc_get_reset_reason (0)) {
+		if (ring.got != ring.put) {
+			printf ("log: from before the reset:\n");
+			log_drain ();
+		}
+	} else
+		log_reset ();
+#endif
+
+#if LOG_TASK
+	xTaskCreatePinnedToCore(log_task, "log", LOG_TASK_STACK, NULL,
+		tskIDLE_PRIORITY+1, NULL, LOG_TASK_CPU);
+#endif
+}
+
+#endif // LOG_DEFERRED
@@ -0,0 +1,140 @@
+#ifndef _MSG_H
+#define _MSG_H
+
+/* The binary message, sent instead of the text one when BINARY_MSG is set.
+ *
+ * All fields are little endian (both the esp32 and the usual server are).
+ * Times are in us unless noted, voltages in mV, temperatures in 1/128 C
+ * which keeps the ds18b20 1/16 steps exact.
+ *
+ * Bump MSG_VERSION when the layout changes.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MSG_MAGIC	0xE5	// not ASCII, a text message never starts with it
+#define MSG_VERSION	5	// 2: readings from wakes without radio, 3: stages, 4: sched, 5: droop
+#define MSG_MAX_TEMPS	10
+#define MSG_MAX_SAMPLES	16
+
+#define MSG_TEMP(t)	((int16_t)((t) * 128))
+#define MSG_TEMP_C(t)	((t) / 128.)
+
+/* flags */
+#define MSG_HAVE_DS18B20	0x01
+#define MSG_HAVE_BME280		0x02
+
+struct msg_header {
+	uint8_t  magic;
+	uint8_t  version;
+	uint16_t len;			// of the whole frame
+	uint16_t device;		// MY_HOST
+	uint16_t flags;
+	uint32_t runCount;
+} __attribute__((packed));
+
+struct msg {
+	struct msg_header h;
+
+	/* times= */
+	uint32_t sleep_us;		// D
+	uint32_t sleep_ticks;		// T
+	uint32_t app_start_us;		// s
+	uint32_t readings_us;		// r
+	uint32_t wifi_us;		// w
+	uint32_t now_us;		// t
+
+	/* prev= */
+	uint32_t last_us;		// L
+	uint32_t total_s;		// T
+	uint32_t cycle_us;		// c
+	uint32_t active_us;		// a
+
+	/* clocks= */
+	uint64_t rtc_us;		// R
+	uint64_t frc_us;		// F
+	uint64_t frc_raw_us;		// f
+	uint32_t slow_cal;		// C
+	uint64_t rtc_ticks;		// t
+	int32_t  grace_us;		// g
+
+	/* stats= */
+	uint16_t fail_soft;		// fs
+	uint16_t fail_hard;		// fh
+	uint16_t fail_read;		// fr
+	uint16_t fail_read_hard;	// fR
+	uint16_t ds18b20_failures;	// Dc
+	int16_t  ds18b20_reason;	// Dr
+	uint16_t bme280_failures;	// Bc
+	uint16_t wakeup_cause;		// c
+	uint8_t  reset_reason;		// r
+
+	/* v= */
+	uint16_t bat_mv;
+	uint16_t vdd_mv;
+	uint16_t v1_mv;
+
+	/* radio= */
+	int8_t   rssi;
+	uint8_t  channel;
+
+	/* w= */
+	int16_t  w_temp;
+	uint32_t w_qnh;			// Pa*10
+	uint16_t w_humi;		// %*100
+	uint8_t  w_fail;
+
+	uint8_t  ntemps;
+	int16_t  temps[MSG_MAX_TEMPS];	// only 'ntemps' are sent
+
+/* then, right after temps[ntemps]:
+ *	uint8_t nsamples;
+ *	struct msg_sample, nsamples times, oldest first
+ *	struct msg_stages (version 3)
+ *	struct msg_sched  (version 4)
+ *	struct msg_droop  (version 5)
+ */
+} __attribute__((packed));
+
+struct msg_sample {
+	uint32_t runCount;
+	uint32_t rtc_ms;		// RTC time of the reading
+	uint16_t bat_mv;
+	uint16_t vdd_mv;
+	int16_t  temps[];		// 'ntemps' of them, as in the message
+} __attribute__((packed));
+
+/* stages=, us since app start, in the order of STAGE_* in udp.h */
+struct msg_stages {
+	uint32_t read_start;		// rs
+	uint32_t read_end;		// re
+	uint32_t wifi_setup;		// ws
+	uint32_t connected;		// wc
+	uint32_t got_ip;		// wi
+	uint32_t send;			// tx
+} __attribute__((packed));
+
+/* sched=, zero when SLEEP_SCHED is off */
+struct msg_sched {
+	int32_t  ppm;			// p RTC rate error
+	uint32_t overhead_us;		// o sleep to app start
+	int32_t  error_us;		// e app start minus target
+} __attribute__((packed));
+
+/* droop=, the battery while the radio was on, the last radio wake */
+struct msg_droop {
+	uint16_t min_mv;		// m
+	uint16_t mean_mv;		// a
+	uint32_t min_us;		// t since the readings were done
+	uint16_t n;			// n samples, 0 for none
+} __attribute__((packed));
+
+#define MSG_LEN(ntemps)		(offsetof(struct msg, temps) + (ntemps)*sizeof(int16_t))
+#define MSG_SAMPLE_LEN(ntemps)	(sizeof(struct msg_sample) + (ntemps)*sizeof(int16_t))
+#define MSG_MAX_LEN		(MSG_LEN(MSG_MAX_TEMPS) + 1 + \
+				 MSG_MAX_SAMPLES*MSG_SAMPLE_LEN(MSG_MAX_TEMPS) + \
+				 sizeof(struct msg_stages) + sizeof(struct msg_sched) + \
+				 sizeof(struct msg_droop))
+
+#endif // _MSG_H
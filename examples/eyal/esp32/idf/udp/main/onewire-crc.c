@@ -0,0 +1,222 @@
+// The 1-Wire CRCs, split out of onewire.c.
+//
+// All the variants are here, onewire_crc8() and onewire_crc16() use the
+// configured one and the linker drops the others. host/crc-bench times them.
+//
+// The tables are generated by the compiler from the polynomial, rather
+// than typed in.
+//
+// Lifted from NodeMCU:
+// https://github.com/nodemcu/nodemcu-firmware/blob/dev-esp32/components/modules/ow.c
+// which is based on Maxim's code.
+//---------------------------------------------------------------------------
+// Copyright (C) 2000 Dallas Semiconductor Corporation, All Rights Reserved.
+//
+// Permission is hereby granted, free of charge, to any person obtaining a
+// copy of this software and associated documentation files (the "Software"),
+// to deal in the Software without restriction, including without limitation
+// the rights to use, copy, modify, merge, publish, distribute, sublicense,
+// and/or sell copies of the Software, and to permit persons to whom the
+// Software is furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included
+// in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+// OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+// MERCHANTABILITY,  FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.
+// IN NO EVENT SHALL DALLAS SEMICONDUCTOR BE LIABLE FOR ANY CLAIM, DAMAGES
+// OR OTHER LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE,
+// ARISING FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+// OTHER DEALINGS IN THE SOFTWARE.
+//
+// Except as contained in this notice, the name of Dallas Semiconductor
+// shall not be used except as stated in the Dallas Semiconductor
+// Branding Policy.
+//--------------------------------------------------------------------------
+
+#include "udp.h"
+#include "onewire.h"
+
+#define ONEWIRE_CRC		1	// do not disable
+#ifndef ONEWIRE_CRC8_TABLE
+#define ONEWIRE_CRC8_TABLE	1	// 0=bits, 1=256 byte table, 2=16 byte table
+#endif
+#define ONEWIRE_CRC16		1
+#ifndef ONEWIRE_CRC16_TABLE
+#define ONEWIRE_CRC16_TABLE	0	// 0=parity, 2=32 byte table
+#endif
+
+#if ONEWIRE_CRC
+// The 1-Wire CRC scheme is described in Maxim Application Note 27:
+// "Understanding and Using Cyclic Redundancy Checks with Maxim iButton Products"
+//
+
+#ifndef pgm_read_byte
+#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
+#endif
+
+// One step of a reflected CRC, the next data bit is already in bit 0.
+#define CRC8_1(c)	(((c) >> 1) ^ (((c) & 1) ? 0x8C : 0))	// x^8+x^5+x^4+1
+#define CRC8_4(c)	CRC8_1(CRC8_1(CRC8_1(CRC8_1(c))))
+#define CRC8_8(c)	CRC8_4(CRC8_4(c))
+
+#define CRC16_1(c)	(((c) >> 1) ^ (((c) & 1) ? 0xA001 : 0))	// x^16+x^15+x^2+1
+#define CRC16_4(c)	CRC16_1(CRC16_1(CRC16_1(CRC16_1(c))))
+
+#define T4(f,i)		f(i), f((i)+1), f((i)+2), f((i)+3)
+#define T16(f,i)	T4(f,i), T4(f,(i)+4), T4(f,(i)+8), T4(f,(i)+12)
+#define T64(f,i)	T16(f,i), T16(f,(i)+16), T16(f,(i)+32), T16(f,(i)+48)
+#define T256(f,i)	T64(f,i), T64(f,(i)+64), T64(f,(i)+128), T64(f,(i)+192)
+
+// Same as the table in the Dallas sample code.
+static const uint8_t dscrc_table[256] = { T256(CRC8_8, 0) };
+static const uint8_t dscrc_nibble[16] = { T16(CRC8_4, 0) };
+static const uint16_t crc16_nibble[16] = { T16(CRC16_4, 0) };
+
+//
+// Compute a Dallas Semiconductor 8 bit CRC. These show up in the ROM
+// and the registers.
+//
+uint8_t onewire_crc8_table(const uint8_t *addr, uint8_t len)
+{
+	uint8_t crc = 0;
+
+	while (len--) {
+		crc = pgm_read_byte(dscrc_table + (crc ^ *addr++));
+	}
+	return crc;
+}
+
+//
+// Half a byte at a time, a 16 byte table.
+//
+uint8_t onewire_crc8_nibble(const uint8_t *addr, uint8_t len)
+{
+	uint8_t crc = 0;
+
+	while (len--) {
+		crc ^= *addr++;
+		crc = (crc >> 4) ^ pgm_read_byte(dscrc_nibble + (crc & 0x0F));
+		crc = (crc >> 4) ^ pgm_read_byte(dscrc_nibble + (crc & 0x0F));
+	}
+	return crc;
+}
+
+//
+// Compute a Dallas Semiconductor 8 bit CRC directly.
+// this is much slower, but much smaller, than the lookup table.
+//
+uint8_t onewire_crc8_bits(const uint8_t *addr, uint8_t len)
+{
+	uint8_t crc = 0;
+
+	while (len--) {
+		uint8_t inbyte = *addr++;
+    uint8_t i;
+		for (i = 8; i; i--) {
+			uint8_t mix = (crc ^ inbyte) & 0x01;
+			crc >>= 1;
+			if (mix) crc ^= 0x8C;
+			inbyte >>= 1;
+		}
+	}
+	return crc;
+}
+
+uint8_t onewire_crc8(const uint8_t *addr, uint8_t len)
+{
+#if ONEWIRE_CRC8_TABLE == 1
+	return onewire_crc8_table(addr, len);
+#elif ONEWIRE_CRC8_TABLE == 2
+	return onewire_crc8_nibble(addr, len);
+#else
+	return onewire_crc8_bits(addr, len);
+#endif
+}
+
+#if ONEWIRE_CRC16
+// Compute a Dallas Semiconductor 16 bit CRC.  This is required to check
+// the integrity of data received from many 1-Wire devices.  Note that the
+// CRC computed here is *not* what you'll get from the 1-Wire network,
+// for two reasons:
+//   1) The CRC is transmitted bitwise inverted.
+//   2) Depending on the endian-ness of your processor, the binary
+//      representation of the two-byte return value may have a different
+//      byte order than the two bytes you get from 1-Wire.
+// @param input - Array of bytes to checksum.
+// @param len - How many bytes to use.
+// @param crc - The crc starting value (optional)
+// @return The CRC16, as defined by Dallas Semiconductor.
+uint16_t onewire_crc16_parity(const uint8_t* input, uint16_t len, uint16_t crc)
+{
+    static const uint8_t oddparity[16] =
+	{ 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0 };
+
+    uint16_t i;
+    for (i = 0 ; i < len ; i++) {
+      // Even though we're just copying a byte from the input,
+      // we'll be doing 16-bit computation with it.
+      uint16_t cdata = input[i];
+      cdata = (cdata ^ crc) & 0xff;
+      crc >>= 8;
+
+      if (oddparity[cdata & 0x0F] ^ oddparity[cdata >> 4])
+	crc ^= 0xC001;
+
+      cdata <<= 6;
+      crc ^= cdata;
+      cdata <<= 1;
+      crc ^= cdata;
+    }
+    return crc;
+}
+
+// Half a byte at a time, a 32 byte table.
+uint16_t onewire_crc16_nibble(const uint8_t* input, uint16_t len, uint16_t crc)
+{
+	while (len--) {
+		crc ^= *input++;
+		crc = (crc >> 4) ^ crc16_nibble[crc & 0x0F];
+		crc = (crc >> 4) ^ crc16_nibble[crc & 0x0F];
+	}
+	return crc;
+}
+
+uint16_t onewire_crc16(const uint8_t* input, uint16_t len, uint16_t crc)
+{
+#if ONEWIRE_CRC16_TABLE == 2
+	return onewire_crc16_nibble(input, len, crc);
+#else
+	return onewire_crc16_parity(input, len, crc);
+#endif
+}
+
+// Compute the 1-Wire CRC16 and compare it against the received CRC.
+// Example usage (reading a DS2408):
+    //    // Put everything in a buffer so we can compute the CRC easily.
+//    uint8_t buf[13];
+//    buf[0] = 0xF0;    // Read PIO Registers
+//    buf[1] = 0x88;    // LSB address
+//    buf[2] = 0x00;    // MSB address
+//    WriteBytes(net, buf, 3);    // Write 3 cmd bytes
+//    ReadBytes(net, buf+3, 10);  // Read 6 data bytes, 2 0xFF, 2 CRC16
+//    if (!CheckCRC16(buf, 11, &buf[11])) {
+//	// Handle error.
+//    }
+//
+// @param input - Array of bytes to checksum.
+// @param len - How many bytes to use.
+// @param inverted_crc - The two CRC16 bytes in the received data.
+//		This should just point into the received data,
+//		*not* at a 16-bit integer.
+// @param crc - The crc starting value (optional)
+// @return True, iff the CRC matches.
+bool onewire_check_crc16(const uint8_t* input, uint16_t len, const uint8_t* inverted_crc, uint16_t crc)
+{
+    crc = ~onewire_crc16(input, len, crc);
+    return (crc & 0xFF) == inverted_crc[0] && (crc >> 8) == inverted_crc[1];
+}
+#endif
+
+#endif
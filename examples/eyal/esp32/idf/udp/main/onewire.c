@@ -30,13 +30,14 @@
 #include "udp.h"
 #include "onewire.h"
 
+#ifndef ONEWIRE_RMT
+#define ONEWIRE_RMT		0	// 1=RMT peripheral, 0=bit-bang the GPIO
+#endif
 #define ONEWIRE_INTERNAL_PULLUP	1	// 0=using external pullup
 #define ONEWIRE_POWERED		0	// do not enable
 #define ONEWIRE_RECOVERY_US	2
 
-#define ONEWIRE_CRC		1	// do not disable
-#define ONEWIRE_CRC8_TABLE	1
-#define ONEWIRE_CRC16		1
+#define ONEWIRE_SEARCH		1	// 0 to leave out ow_search()
 
 #define OW_GO_INPUT() \
 do { \
@@ -48,6 +49,211 @@ do { \
 #define OW_NO_PIN		0xFF
 static uint8_t ow_pin = OW_NO_PIN;
 
+#if ONEWIRE_RMT
+/* The RMT shapes the time slots, the task sleeps while they go out and the
+ * other core is not held up by the bus. TX and RX channels share the pin,
+ * RX sees our own LOW pulses and what the devices add to them.
+ */
+#include "driver/rmt.h"
+#include "freertos/ringbuf.h"
+#include "rom/gpio.h"
+#include "soc/gpio_sig_map.h"
+
+#define OW_RMT_TX		RMT_CHANNEL_0
+#define OW_RMT_RX		RMT_CHANNEL_1
+#define OW_RMT_SLOTS		56	// per transfer, one 64 items memory block
+#define OW_RMT_READ_1_US	10	// a shorter LOW reads as a 1
+#define OW_RMT_IDLE_US		100	// no edge this long ends the slots
+#define OW_RMT_RESET_IDLE_US	500	// longer than the reset pulse
+#define OW_RMT_TIMEOUT_MS	20
+
+static RingbufHandle_t ow_rb = NULL;
+
+static void ow_rmt_item (rmt_item32_t *item, int low_us, int high_us)
+{
+	item->level0 = 0;
+	item->duration0 = low_us;
+	item->level1 = 1;
+	item->duration1 = high_us;
+}
+
+// send the items, if 'rx' then also return what the bus did
+static esp_err_t ow_rmt_xfer (rmt_item32_t *items, int n, int idle_us,
+	rmt_item32_t **rx, size_t *nrx)
+{
+	size_t size;
+	void *p;
+
+	items[n].val = 0;		// end marker
+
+	if (NULL != rx) {
+		while (NULL != (p = xRingbufferReceive (ow_rb, &size, 0)))
+			vRingbufferReturnItem (ow_rb, p);	// stale
+		DbgR (rmt_set_rx_idle_thresh (OW_RMT_RX, idle_us));
+		DbgR (rmt_rx_start (OW_RMT_RX, true));
+	}
+
+	DbgR (rmt_write_items (OW_RMT_TX, items, n+1, true));
+	if (NULL == rx)
+		return ESP_OK;
+
+	*rx = xRingbufferReceive (ow_rb, &size, OW_RMT_TIMEOUT_MS / portTICK_PERIOD_MS);
+	rmt_rx_stop (OW_RMT_RX);
+	if (NULL == *rx)
+		LogR (ESP_FAIL, "no RMT rx");
+	*nrx = size / sizeof(rmt_item32_t);
+
+	return ESP_OK;
+}
+
+// the LOW pulses on the bus, in us
+static int ow_rmt_lows (rmt_item32_t *rx, size_t nrx, uint16_t *lows, int max)
+{
+	size_t i;
+	int n = 0;
+
+	for (i = 0; i < nrx && n < max; ++i) {
+		if (0 == rx[i].duration0)
+			break;
+		if (0 == rx[i].level0)
+			lows[n++] = rx[i].duration0;
+
+		if (0 == rx[i].duration1)
+			break;
+		if (0 == rx[i].level1 && n < max)
+			lows[n++] = rx[i].duration1;
+	}
+
+	return n;
+}
+
+esp_err_t ow_write_bits (int nbits, uint8_t *data)
+{
+	rmt_item32_t items[OW_RMT_SLOTS+1];
+	int i, n;
+
+	if (OW_NO_PIN == ow_pin) DbgR (ESP_FAIL);
+	if (nbits < 0) DbgR (ESP_FAIL);
+
+	for (i = 0, n = 0; i < nbits; ++i) {
+		if ((data[i/8] >> (i%8)) & 1)
+			ow_rmt_item (&items[n++], 3, 60-3+ONEWIRE_RECOVERY_US);
+		else
+			ow_rmt_item (&items[n++], 60, ONEWIRE_RECOVERY_US);
+
+		if (OW_RMT_SLOTS == n || i == nbits-1) {
+			DbgR (ow_rmt_xfer (items, n, 0, NULL, NULL));
+			n = 0;
+		}
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t ow_read_bits (int nbits, uint8_t *data)
+{
+	rmt_item32_t items[OW_RMT_SLOTS+1], *rx;
+	uint16_t lows[OW_RMT_SLOTS];
+	size_t nrx;
+	int i, j, n, nlows;
+
+	if (OW_NO_PIN == ow_pin) DbgR (ESP_FAIL);
+	if (nbits < 0) DbgR (ESP_FAIL);
+
+	memset (data, 0, (nbits+7)/8);
+	for (i = 0; i < nbits; i += n) {
+		n = nbits - i;
+		if (n > OW_RMT_SLOTS)
+			n = OW_RMT_SLOTS;
+		for (j = 0; j < n; ++j)
+			ow_rmt_item (&items[j], 3, 60-3+ONEWIRE_RECOVERY_US);
+
+		DbgR (ow_rmt_xfer (items, n, OW_RMT_IDLE_US, &rx, &nrx));
+		nlows = ow_rmt_lows (rx, nrx, lows, n);
+		vRingbufferReturnItem (ow_rb, rx);
+		if (nlows != n)
+			LogR (ESP_FAIL, "read %d slots, saw %d", n, nlows);
+
+		for (j = 0; j < n; ++j)
+			if (lows[j] < OW_RMT_READ_1_US)
+				data[(i+j)/8] |= 1 << ((i+j)%8);
+	}
+
+	return ESP_OK;
+}
+
+esp_err_t ow_reset(void)
+{
+	rmt_item32_t items[2], *rx;
+	uint16_t lows[2];
+	size_t nrx;
+	int nlows;
+
+	if (OW_NO_PIN == ow_pin) DbgR (ESP_FAIL);
+
+	ow_rmt_item (&items[0], 480, 70);
+	DbgR (ow_rmt_xfer (items, 1, OW_RMT_RESET_IDLE_US, &rx, &nrx));
+	nlows = ow_rmt_lows (rx, nrx, lows, 2);
+	vRingbufferReturnItem (ow_rb, rx);
+	if (nlows < 2)			// our reset, then the presence pulse
+		LogR (ESP_FAIL, "reset timeout 1");
+
+	return ESP_OK;
+}
+
+esp_err_t ow_depower (void)
+{
+	if (OW_NO_PIN == ow_pin) DbgR (ESP_FAIL);
+
+	return ESP_OK;		// the RMT idles HIGH, the bus is released
+}
+
+// both channels on the one open drain pin, the driver once per boot
+static esp_err_t ow_rmt_init (void)
+{
+	rmt_config_t tx = {
+		.rmt_mode = RMT_MODE_TX,
+		.channel = OW_RMT_TX,
+		.gpio_num = ow_pin,
+		.clk_div = 80,		// 1us ticks
+		.mem_block_num = 1,
+		.tx_config = {
+			.loop_en = false,
+			.carrier_en = false,
+			.idle_level = RMT_IDLE_LEVEL_HIGH,
+			.idle_output_en = true,
+		},
+	};
+	rmt_config_t rx = {
+		.rmt_mode = RMT_MODE_RX,
+		.channel = OW_RMT_RX,
+		.gpio_num = ow_pin,
+		.clk_div = 80,
+		.mem_block_num = 1,
+		.rx_config = {
+			.filter_en = true,
+			.filter_ticks_thresh = 30,	// APB ticks, glitches
+			.idle_threshold = OW_RMT_IDLE_US,
+		},
+	};
+
+	if (NULL == ow_rb) {
+		DbgR (rmt_config (&tx));
+		DbgR (rmt_config (&rx));
+		DbgR (rmt_driver_install (OW_RMT_TX, 0, 0));
+		DbgR (rmt_driver_install (OW_RMT_RX, 512, 0));
+		DbgR (rmt_get_ringbuf_handle (OW_RMT_RX, &ow_rb));
+	}
+
+	gpio_matrix_out (ow_pin, RMT_SIG_OUT0_IDX + OW_RMT_TX, 0, 0);	// before the pin drives
+	DbgR (gpio_set_direction (ow_pin, GPIO_MODE_INPUT_OUTPUT_OD));
+	gpio_matrix_in (ow_pin, RMT_SIG_IN0_IDX + OW_RMT_RX, 0);
+
+	return ESP_OK;
+}
+
+#else // if ONEWIRE_RMT
+
 esp_err_t ow_write_bits (int nbits, uint8_t *data)
 {
 	int i, b;
@@ -161,6 +367,7 @@ esp_err_t ow_depower (void)
 
 	return ESP_OK;
 }
+#endif // else ONEWIRE_RMT
 
 static esp_err_t ow_wait_for_high (int us)
 {
@@ -187,6 +394,14 @@ esp_err_t ow_init (uint8_t pin)
 
 	(void)ow_wait_for_high (480);
 
+#if ONEWIRE_RMT
+	Dbg (ow_rmt_init ());
+	if (ESP_OK != ret) {
+		ow_pin = OW_NO_PIN;
+		return ESP_OK;
+	}
+#endif
+
 	Dbg (ow_reset());
 	if (ESP_OK != ret)
 		ow_pin = OW_NO_PIN;
@@ -194,137 +409,80 @@ esp_err_t ow_init (uint8_t pin)
 	return ESP_OK;
 }
 
-#if ONEWIRE_CRC
-// The 1-Wire CRC scheme is described in Maxim Application Note 27:
-// "Understanding and Using Cyclic Redundancy Checks with Maxim iButton Products"
-//
+#if ONEWIRE_SEARCH
+#define OW_SEARCH_ROM		0xF0
 
-#if ONEWIRE_CRC8_TABLE
-// This table comes from Dallas sample code where it is freely reusable,
-// though Copyright (C) 2000 Dallas Semiconductor Corporation
-static const uint8_t dscrc_table[] = {
-      0, 94,188,226, 97, 63,221,131,194,156,126, 32,163,253, 31, 65,
-    157,195, 33,127,252,162, 64, 30, 95,  1,227,189, 62, 96,130,220,
-     35,125,159,193, 66, 28,254,160,225,191, 93,  3,128,222, 60, 98,
-    190,224,  2, 92,223,129, 99, 61,124, 34,192,158, 29, 67,161,255,
-     70, 24,250,164, 39,121,155,197,132,218, 56,102,229,187, 89,  7,
-    219,133,103, 57,186,228,  6, 88, 25, 71,165,251,120, 38,196,154,
-    101, 59,217,135,  4, 90,184,230,167,249, 27, 69,198,152,122, 36,
-    248,166, 68, 26,153,199, 37,123, 58,100,134,216, 91,  5,231,185,
-    140,210, 48,110,237,179, 81, 15, 78, 16,242,172, 47,113,147,205,
-     17, 79,173,243,112, 46,204,146,211,141,111, 49,178,236, 14, 80,
-    175,241, 19, 77,206,144,114, 44,109, 51,209,143, 12, 82,176,238,
-     50,108,142,208, 83, 13,239,177,240,174, 76, 18,145,207, 45,115,
-    202,148,118, 40,171,245, 23, 73,  8, 86,180,234,105, 55,213,139,
-     87,  9,235,181, 54,104,138,212,149,203, 41,119,244,170, 72, 22,
-    233,183, 85, 11,136,214, 52,106, 43,117,151,201, 74, 20,246,168,
-    116, 42,200,150, 21, 75,169,247,182,232, 10, 84,215,137,107, 53};
-
-#ifndef pgm_read_byte
-#define pgm_read_byte(addr) (*(const uint8_t *)(addr))
-#endif
+static int ow_last_discrepancy = 0;
+static int ow_last_device = 0;
+static uint8_t ow_rom[8];
 
-//
-// Compute a Dallas Semiconductor 8 bit CRC. These show up in the ROM
-// and the registers.  (note: this might better be done without to
-// table, it would probably be smaller and certainly fast enough
-// compared to all those delayMicrosecond() calls.  But I got
-// confused, so I use this table from the examples.)
-//
-uint8_t onewire_crc8(const uint8_t *addr, uint8_t len)
+void ow_search_reset (void)
 {
-	uint8_t crc = 0;
-
-	while (len--) {
-		crc = pgm_read_byte(dscrc_table + (crc ^ *addr++));
-	}
-	return crc;
+	ow_last_discrepancy = 0;
+	ow_last_device = 0;
+	memset (ow_rom, 0, sizeof(ow_rom));
 }
-#else	// if ONEWIRE_CRC8_TABLE
-//
-// Compute a Dallas Semiconductor 8 bit CRC directly.
-// this is much slower, but much smaller, than the lookup table.
-//
-uint8_t onewire_crc8(const uint8_t *addr, uint8_t len)
+
+// The next device id into 'rom', Maxim AN187.
+// ESP_ERR_NOT_FOUND after the last one.
+esp_err_t ow_search (uint8_t *rom)
 {
-	uint8_t crc = 0;
-
-	while (len--) {
-		uint8_t inbyte = *addr++;
-    uint8_t i;
-		for (i = 8; i; i--) {
-			uint8_t mix = (crc ^ inbyte) & 0x01;
-			crc >>= 1;
-			if (mix) crc ^= 0x8C;
-			inbyte >>= 1;
+	uint8_t b, bits;
+	int i, dir, last_zero = 0;
+
+	if (OW_NO_PIN == ow_pin) DbgR (ESP_FAIL);
+	if (ow_last_device)
+		return ESP_ERR_NOT_FOUND;
+
+	if (ESP_OK != ow_reset ()) {
+		ow_search_reset ();
+		return ESP_ERR_NOT_FOUND;
+	}
+
+	b = OW_SEARCH_ROM;
+	DbgR (ow_write_byte (&b));
+
+	for (i = 1; i <= 64; ++i) {
+		uint8_t *p = &ow_rom[(i-1)/8];
+		uint8_t mask = 1 << ((i-1)%8);
+
+		bits = 0;
+		DbgR (ow_read_bits (2, &bits));	// the bit, then its complement
+		if (3 == bits) {		// nobody answered
+			ow_search_reset ();
+			LogR (ESP_ERR_NOT_FOUND, "search: no device at bit %d", i);
+		}
+
+		if (0 != bits)			// all agree
+			dir = bits & 1;
+		else {				// a discrepancy
+			if (i < ow_last_discrepancy)
+				dir = !!(*p & mask);
+			else
+				dir = i == ow_last_discrepancy;
+			if (!dir)
+				last_zero = i;
 		}
+
+		if (dir)
+			*p |= mask;
+		else
+			*p &= ~mask;
+
+		b = dir;
+		DbgR (ow_write_bits (1, &b));
 	}
-	return crc;
-}
-#endif	// else ONEWIRE_CRC8_TABLE
-
-#if ONEWIRE_CRC16
-// Compute a Dallas Semiconductor 16 bit CRC.  This is required to check
-// the integrity of data received from many 1-Wire devices.  Note that the
-// CRC computed here is *not* what you'll get from the 1-Wire network,
-// for two reasons:
-//   1) The CRC is transmitted bitwise inverted.
-//   2) Depending on the endian-ness of your processor, the binary
-//      representation of the two-byte return value may have a different
-//      byte order than the two bytes you get from 1-Wire.
-// @param input - Array of bytes to checksum.
-// @param len - How many bytes to use.
-// @param crc - The crc starting value (optional)
-// @return The CRC16, as defined by Dallas Semiconductor.
-uint16_t onewire_crc16(const uint8_t* input, uint16_t len, uint16_t crc)
-{
-    static const uint8_t oddparity[16] =
-	{ 0, 1, 1, 0, 1, 0, 0, 1, 1, 0, 0, 1, 0, 1, 1, 0 };
-
-    uint16_t i;
-    for (i = 0 ; i < len ; i++) {
-      // Even though we're just copying a byte from the input,
-      // we'll be doing 16-bit computation with it.
-      uint16_t cdata = input[i];
-      cdata = (cdata ^ crc) & 0xff;
-      crc >>= 8;
-
-      if (oddparity[cdata & 0x0F] ^ oddparity[cdata >> 4])
-	crc ^= 0xC001;
-
-      cdata <<= 6;
-      crc ^= cdata;
-      cdata <<= 1;
-      crc ^= cdata;
-    }
-    return crc;
-}
 
-// Compute the 1-Wire CRC16 and compare it against the received CRC.
-// Example usage (reading a DS2408):
-    //    // Put everything in a buffer so we can compute the CRC easily.
-//    uint8_t buf[13];
-//    buf[0] = 0xF0;    // Read PIO Registers
-//    buf[1] = 0x88;    // LSB address
-//    buf[2] = 0x00;    // MSB address
-//    WriteBytes(net, buf, 3);    // Write 3 cmd bytes
-//    ReadBytes(net, buf+3, 10);  // Read 6 data bytes, 2 0xFF, 2 CRC16
-//    if (!CheckCRC16(buf, 11, &buf[11])) {
-//	// Handle error.
-//    }
-//
-// @param input - Array of bytes to checksum.
-// @param len - How many bytes to use.
-// @param inverted_crc - The two CRC16 bytes in the received data.
-//		This should just point into the received data,
-//		*not* at a 16-bit integer.
-// @param crc - The crc starting value (optional)
-// @return True, iff the CRC matches.
-bool onewire_check_crc16(const uint8_t* input, uint16_t len, const uint8_t* inverted_crc, uint16_t crc)
-{
-    crc = ~onewire_crc16(input, len, crc);
-    return (crc & 0xFF) == inverted_crc[0] && (crc >> 8) == inverted_crc[1];
-}
-#endif
+	ow_last_discrepancy = last_zero;
+	if (0 == last_zero)
+		ow_last_device = 1;
 
-#endif
+	if (ow_rom[7] != onewire_crc8 (ow_rom, 7)) {
+		ow_search_reset ();
+		LogR (ESP_FAIL, "search: bad id crc");
+	}
+	memcpy (rom, ow_rom, sizeof(ow_rom));
+
+	return ESP_OK;
+}
+#endif // ONEWIRE_SEARCH
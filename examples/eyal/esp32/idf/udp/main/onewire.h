@@ -12,9 +12,19 @@ esp_err_t ow_read_bits (int nbits, uint8_t *data);
 esp_err_t ow_reset(void);
 esp_err_t ow_depower (void);
 esp_err_t ow_init (uint8_t pin);
+void ow_search_reset (void);
+esp_err_t ow_search (uint8_t *rom);
 
+/* onewire-crc.c */
 uint8_t onewire_crc8(const uint8_t *addr, uint8_t len);
 uint16_t onewire_crc16(const uint8_t* input, uint16_t len, uint16_t crc);
 bool onewire_check_crc16(const uint8_t* input, uint16_t len, const uint8_t* inverted_crc, uint16_t crc);
 
+/* the variants behind onewire_crc8() and onewire_crc16() */
+uint8_t onewire_crc8_bits(const uint8_t *addr, uint8_t len);
+uint8_t onewire_crc8_nibble(const uint8_t *addr, uint8_t len);
+uint8_t onewire_crc8_table(const uint8_t *addr, uint8_t len);
+uint16_t onewire_crc16_parity(const uint8_t* input, uint16_t len, uint16_t crc);
+uint16_t onewire_crc16_nibble(const uint8_t* input, uint16_t len, uint16_t crc);
+
 #endif // _ONEWIRE_H
@@ -0,0 +1,137 @@
+/* Sleep scheduler.
+ *
+ * Wake on fixed boundaries of true (crystal) time, every 'cycle_us' since
+ * power up, rather than sleeping a fixed time after each active period.
+ *
+ * The RTC slow clock is off by a per-board (and temperature) amount, and
+ * the boot time is not known in advance. Both are learnt here and kept in
+ * RTC memory:
+ *	- while awake the RTC ticks are compared with the FRC, which runs off
+ *	  the crystal, giving the true length of an RTC tick.
+ *	- after each sleep, the ticks past what we asked for are the overhead
+ *	  (entering sleep, waking, booting to app_main).
+ * The error (where we estimate we woke relative to the target) is reported.
+*/
+
+#include "udp.h"
+#include "sched.h"
+
+#include <esp_attr.h>		// RTC_DATA_ATTR
+#include <soc/rtc.h>		// rtc_time_get()
+#include <esp_clk.h>		// esp_clk_slowclk_cal_get()
+
+#define SCHED_MAGIC		0x53434831	// "SCH1"
+#define SCHED_OVERHEAD_US	200000		// first guess, learnt later
+#define SCHED_MAX_OVERHEAD_US	2000000		// more is not a plain timer wake
+#define SCHED_MIN_SLEEP_US	1000000		// else skip to the next boundary
+#define SCHED_LEARN_US		200000		// awake time before the ratio is used
+#define SCHED_WINDOW_US		60000000	// awake time the ratio is averaged over
+#define SCHED_GAIN		8		// overhead averaged over about 8 wakes
+
+uint64_t get_time_since_boot_64(void);		// FRC (raw)
+
+struct sched {
+	uint32_t magic;
+	uint32_t nover;		// overhead samples so far
+	uint64_t true_us;	// app start, since power up
+	uint64_t target_us;	// the app start we aimed for
+	uint64_t sleep_true_us;	// when we went to sleep
+	uint64_t sleep_ticks;	// rtc_time_get() then
+	uint64_t sleep_req;	// ticks asked for
+	uint64_t sum_us;	// awake time by the FRC
+	uint64_t sum_ticks;	// ... and by the RTC
+	uint32_t overhead_us;
+	int32_t error_us;
+};
+
+RTC_DATA_ATTR static struct sched s;
+
+static uint64_t wake_ticks;
+static uint64_t wake_frc;
+
+static uint64_t ticks_to_us (uint64_t ticks)
+{
+	if (s.sum_us < SCHED_LEARN_US)	// use what the IDF measured at boot
+		return (ticks * esp_clk_slowclk_cal_get ()) >> RTC_CLK_CAL_FRACT;
+	return ticks * s.sum_us / s.sum_ticks;
+}
+
+static uint64_t us_to_ticks (uint64_t us)
+{
+	if (s.sum_us < SCHED_LEARN_US)
+		return (us << RTC_CLK_CAL_FRACT) / esp_clk_slowclk_cal_get ();
+	return us * s.sum_ticks / s.sum_us;
+}
+
+// call early in app_main
+void sched_wake (bool woke_up)
+{
+	uint64_t slept;
+
+	wake_ticks = rtc_time_get ();
+	wake_frc = get_time_since_boot_64 ();
+
+	if (!woke_up || SCHED_MAGIC != s.magic) {
+		memset (&s, 0, sizeof(s));
+		s.magic = SCHED_MAGIC;
+		s.true_us = wake_frc;
+		s.target_us = wake_frc;
+		s.overhead_us = SCHED_OVERHEAD_US;
+		return;
+	}
+
+	slept = wake_ticks - s.sleep_ticks;
+	s.true_us = s.sleep_true_us + ticks_to_us (slept);
+	s.error_us = (int32_t)(s.true_us - s.target_us);
+
+	if (slept > s.sleep_req) {
+		uint64_t over = ticks_to_us (slept - s.sleep_req);
+
+		if (over < SCHED_MAX_OVERHEAD_US) {
+			int gain = ++s.nover < SCHED_GAIN ? s.nover : SCHED_GAIN;
+
+			s.overhead_us += ((int32_t)over - (int32_t)s.overhead_us) / gain;
+		}
+	}
+Log ("sched: slept %lluus error %dus overhead %uus",
+	ticks_to_us (slept), s.error_us, s.overhead_us);
+}
+
+// call just before esp_deep_sleep(), returns its argument
+uint64_t sched_sleep_us (uint64_t cycle_us)
+{
+	uint64_t ticks = rtc_time_get ();
+	uint64_t frc = get_time_since_boot_64 ();
+	uint64_t now, next;
+
+	s.sum_us += frc - wake_frc;
+	s.sum_ticks += ticks - wake_ticks;
+	if (s.sum_us > SCHED_WINDOW_US) {	// let old wakes fade
+		s.sum_us /= 2;
+		s.sum_ticks /= 2;
+	}
+
+	now = s.true_us + (frc - wake_frc);
+	next = (now + s.overhead_us + SCHED_MIN_SLEEP_US + cycle_us - 1) / cycle_us * cycle_us;
+
+	s.sleep_req = us_to_ticks (next - now - s.overhead_us);
+	s.sleep_ticks = ticks;
+	s.sleep_true_us = now;
+	s.target_us = next;
+
+	// the IDF turns this back into ticks with the same calibration
+	return (s.sleep_req * esp_clk_slowclk_cal_get ()) >> RTC_CLK_CAL_FRACT;
+}
+
+// ppm: how much slower the IDF calibrated RTC runs than the crystal
+void sched_info (int32_t *ppm, uint32_t *overhead_us, int32_t *error_us)
+{
+	if (s.sum_ticks > 0) {
+		double us = (double)s.sum_ticks * esp_clk_slowclk_cal_get ()
+				/ (1 << RTC_CLK_CAL_FRACT);
+		*ppm = (int32_t)((s.sum_us / us - 1) * 1000000);
+	} else
+		*ppm = 0;
+	*overhead_us = s.overhead_us;
+	*error_us = s.error_us;
+}
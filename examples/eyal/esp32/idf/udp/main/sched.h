@@ -0,0 +1,9 @@
+#ifndef _SCHED_H
+#define _SCHED_H
+
+/* sched.c */
+void sched_wake (bool woke_up);
+uint64_t sched_sleep_us (uint64_t cycle_us);
+void sched_info (int32_t *ppm, uint32_t *overhead_us, int32_t *error_us);
+
+#endif // _SCHED_H
@@ -9,6 +9,7 @@
 
 #include "udp.h"
 #include "wifi.h"
+#include "config.h"		// the board settings, config->
 
 #include <esp_log.h>
 #include <rom/rtc.h>
@@ -19,20 +20,23 @@
 #include <soc/rtc.h>
 #include <esp_clk.h>
 
-#ifndef MY_NAME
-#define MY_NAME			"test"
-#endif
-
 #define WAKEUP_MS		160	// ms from power up to app_main
-#define SLEEP_S			60	// seconds
 #define WIFI_GRACE_MS		50	// time to wait before deep sleep to drain wifi tx
+#define WIFI_TX_DONE		1	// 1= sleep once the message frame is out, WIFI_GRACE_MS is the timeout
 #define WIFI_TIMEOUT_MS		5000	// time to wait for WiFi connection
 #define WIFI_DISCONNECT_MS	100	// time to wait for WiFi disconnection
+#define READ_TIMEOUT_MS		3000	// time to wait for the readings task
+
+#define WIFI_ON_RATE		1	// WiFi on every n wakes, 1=always, 0=never
+#define RTC_SAMPLES		10	// readings kept for the next WiFi wake, 0=none
+#define DROOP_PERIOD_US		1000	// battery sampled this often while the radio is on, 0=never
 
 #define DISCONNECT		0	// 1= disconnect before deep sleep
+#define SLEEP_SCHED		1	// 1= wake every config->sleep_s on the dot (sched.c), 0= sleep that long
 #define PRINT_MSG		0	// 1= print sent message if logging is off
 
-#define APP_CPU_AFFINITY	1	// 0, 1 or tskNO_AFFINITY
+#define APP_CPU_AFFINITY	0	// 0, 1 or tskNO_AFFINITY
+#define READ_CPU_AFFINITY	1	// readings task, away from the WiFi on core 0
 
 // tskIDLE_PRIORITY + n
 // configMAX_PRIORITIES - n
@@ -47,62 +51,22 @@
 #define TOGGLE_PIN		16	// IN  pull low to disable toggle()
 #define DBG_PIN			15	// IN  pull low to silence Log()
 
-			// adc pins are 32-39
-#define VDD_PIN			32	// undef to disable
-#define VDD_DIVIDER		2	// 1m.1m
+			// adc pins and dividers are in the config
 #define VDD_ATTEN		6	// 6db
-
-#define BAT_PIN			33	// undef to disable
-#define BAT_DIVIDER		3	// 1m.2m
 #define BAT_ATTEN		6	// 6db
-
-#define V1_PIN			34	// undef to disable
-#define V1_DIVIDER		1	// resistor network
 #define V1_ATTEN		6	// 6db
 
 #define READ_TSENS		1	// read esp32 temperature sensor
 
-#if   62 == MY_HOST	// esp-32a
-#define READ_BME280		1	// enable if you have one connected
-#define READ_DS18B20		1	// enable if you have one connected
-#define BAT_VOLTAGE		5.0
-#undef  V1_PIN
-#define ADC_VREF		1130	// measured
-#undef SLEEP_S
-#define SLEEP_S			(10*60)	// 10m in seconds
-#define ACTION			"store"
-
-#elif 64 == MY_HOST	// esp-32b
-#define READ_BME280		0	// enable if you have one connected
-#define READ_DS18B20		1	// enable if you have one connected
-#define BAT_VOLTAGE		3.3
-#undef  V1_PIN
-#define ADC_VREF		1094	// measured when Vdd=3.313v
-#undef VDD_DIVIDER
-#define VDD_DIVIDER		(2*1.016)
-#undef SLEEP_S
-#define SLEEP_S			(1*60)	// 1m in seconds
-#define ACTION			"store"
-
-#elif 65 == MY_HOST	// esp-32c
-#define READ_BME280		0	// enable if you have one connected
-#define READ_DS18B20		1	// enable if you have one connected
-#define BAT_VOLTAGE		3.3
-#undef  V1_PIN
-#define ADC_VREF		1113	// measured when Vdd=3.272v
-#undef SLEEP_S
-#define SLEEP_S			(5*60)	// 5m in seconds
-#define ACTION			"store"
-
-#else
-#error unknown host MY_HOST
+// built in, config->flags tells if one is connected
+#ifndef READ_BME280
+#define READ_BME280		1
+#endif
+#ifndef READ_DS18B20
+#define READ_DS18B20		1
 #endif
 
-#define READ_ADC		(defined(VDD_PIN) || defined(BAT_PIN) || defined(V1_PIN))
-
-#if READ_ADC
 #include "adc.h"
-#endif
 
 #if OUT_PIN < 0
 #undef TOGGLE_PIN
@@ -112,11 +76,18 @@
 #if READ_BME280
 #include "bme280.h"
 RTC_DATA_ATTR static int bme280_failures = 0;
+
+// 0=skip 1=x1 2=x2 3=x4 4=x8 5=x16, measured while we sleep
+#define BME280_OSRS_T		2	// temperature oversampling x2
+#define BME280_OSRS_P		3	// pressure oversampling x4
+#define BME280_OSRS_H		2	// humidity oversampling x2
+#define BME280_FILTER		0	// IIR filter off, samples are minutes apart
 #endif
 
 #if READ_DS18B20
 #include "ds18b20.h"
-  #define ROM_ID		NULL	// when only one ow device connected, fastest
+#define DS18B20_BITS		12	// resolution, 9 (0.5C, 94ms) to 12 (0.0625C, 750ms)
+  #define ROM_ID		NULL	// search the bus, all devices are read
 //#define ROM_ID		(uint8_t *)"\x28\xdc\x01\x78\x06\x00\x00\x0f"	// esp-32a
 //#define ROM_ID		(uint8_t *)"\x28\xc5\x3e\x76\x06\x00\x00\x3c"	// esp-32b
 //#define ROM_ID		(uint8_t *)"\x28\xa9\x7f\x78\x06\x00\x00\xb3"	// esp-32c
@@ -127,6 +98,12 @@ RTC_DATA_ATTR static int ds18b20_failures = 0;
 #include "tsens.h"
 #endif
 
+#include "msg.h"			// MSG_TEMP(), and the binary message
+
+#if SLEEP_SCHED
+#include "sched.h"
+#endif
+
 int do_log = 1;
 uint64_t time_wifi_us = 0;
 int rssi = 0;
@@ -155,6 +132,7 @@ static uint64_t app_start_us = 0;
 static uint64_t app_start_ticks = 0;
 static int wakeup_cause;
 static int reset_reason;
+static uint32_t stage_us[STAGE_NUM];	// since app start
 
 #if 001
 // this is my simplified version of _gettimeofday_r(), added to time.c
@@ -170,6 +148,12 @@ uint64_t gettimeofday_us(void)
 }
 #endif
 
+void stage_mark (int stage)
+{
+	if (stage >= 0 && stage < STAGE_NUM)
+		stage_us[stage] = (uint32_t)(gettimeofday_us() - app_start_us);
+}
+
 void flush_uart (void)
 {
 	fflush(stdout);
@@ -248,26 +232,37 @@ static uint64_t get_time_us (void) {
 #endif
 
 #if READ_DS18B20
-static esp_err_t ds18b20_temp (float *temp)
+// read all devices, '*n' of them
+static esp_err_t ds18b20_temp (float *temp, int max, int *n)
 {
 	esp_err_t ret;
 	esp_err_t rval;		// return first failure
-	uint8_t id[8];
+	uint8_t *id;
+	int i;
 
-	*temp = 0.0;
+	*n = 0;
 	rval = ESP_OK;
 
 	DbgR (ds18b20_init (OW_PIN, ROM_ID));
 
-	if (!woke_up) {
-		DbgR (ds18b20_read_id (id));
-		Log("ds18b20 ROM id: %02x %02x %02x %02x %02x %02x %02x %02x",
-			id[0], id[1], id[2], id[3], id[4], id[5], id[6], id[7]);
+	if (!woke_up || 0 == ds18b20_count()) {	// ids are kept in RTC memory
+		if (NULL == ROM_ID)
+			DbgR (ds18b20_search (&i));
+		for (i = 0; NULL != (id = ds18b20_get_id (i)); ++i)
+			Log("ds18b20 ROM id: %02x %02x %02x %02x %02x %02x %02x %02x",
+				id[0], id[1], id[2], id[3], id[4], id[5], id[6], id[7]);
+		DbgR (ds18b20_set_resolution (DS18B20_BITS));
 
-		DbgR (ds18b20_convert (1));
+		DbgR (ds18b20_convert (1));	// one conversion for all
+	}
+
+	*n = ds18b20_count();
+	if (*n > max)
+		*n = max;
+	for (i = 0; i < *n; ++i) {
+		Dbg (ds18b20_read_temp (i, &temp[i]));
+		if (ESP_OK == rval) rval = ret;
 	}
-	Dbg (ds18b20_read_temp (temp));
-	if (ESP_OK == rval) rval = ret;
 
 	Dbg (ds18b20_convert (0));
 	if (ESP_OK == rval) rval = ret;
@@ -279,13 +274,72 @@ static esp_err_t ds18b20_temp (float *temp)
 }
 #endif // READ_DS18B20
 
-#define MAX_TEMPS		3
+#if READ_DS18B20
+#define MAX_TEMPS		(DS18B20_MAX_DEVICES+2)	// + tsens and bme280
+#else
+#define MAX_TEMPS		2
+#endif
+#if MAX_TEMPS > MSG_MAX_TEMPS
+#error MAX_TEMPS too large for the message
+#endif
 static int ntemps = 0;
 static float temps[MAX_TEMPS];
 static float bat, vdd, v1;
+#if BINARY_MSG
+static float w_temp, w_qnh, w_humi;
+static int w_fail;
+#else
 static char weather[40] = "";
+#endif
 static float ds18b20_failure_reason = 0;
 static uint64_t time_readings_us = 0;
+static int wifing = 1;			// radio on this wake
+RTC_DATA_ATTR static struct adc_droop droop;	// the last radio wake, sent with the next one
+
+#if RTC_SAMPLES > 0
+#if RTC_SAMPLES > MSG_MAX_SAMPLES
+#error RTC_SAMPLES too large for the message
+#endif
+// a reading from a wake without radio, sent with the next radio wake
+struct sample {
+	uint32_t runCount;
+	uint32_t rtc_ms;		// esp_clk_rtc_time(), wraps after 49 days
+	uint16_t bat_mv;
+	uint16_t vdd_mv;
+	int16_t  temps[MAX_TEMPS];	// MSG_TEMP()
+};
+RTC_DATA_ATTR static struct sample samples[RTC_SAMPLES];
+RTC_DATA_ATTR static int nsamples = 0;
+RTC_DATA_ATTR static int next_sample = 0;
+
+// the oldest reading is dropped when the ring is full
+static void save_sample (void)
+{
+	struct sample *s = &samples[next_sample];
+	int i;
+
+	s->runCount = runCount;
+	s->rtc_ms = (uint32_t)(esp_clk_rtc_time() / 1000);
+	s->bat_mv = (uint16_t)(bat * 1000 + .5);
+	s->vdd_mv = (uint16_t)(vdd * 1000 + .5);
+	for (i = 0; i < MAX_TEMPS; ++i)
+		s->temps[i] = (i < ntemps) ? MSG_TEMP(temps[i]) : 0;
+
+	next_sample = (next_sample + 1) % RTC_SAMPLES;
+	if (nsamples < RTC_SAMPLES)
+		++nsamples;
+Log ("saved reading %d", nsamples);
+}
+
+// i=0 is the oldest
+static struct sample *get_sample (int i)
+{
+	return &samples[(next_sample + RTC_SAMPLES - nsamples + i) % RTC_SAMPLES];
+}
+#else
+#define save_sample()
+#define nsamples	0
+#endif
 
 // save first failure in 'rval'
 //
@@ -304,21 +358,31 @@ static esp_err_t read_temps (void)
 	rval = ESP_OK;
 
 #if READ_DS18B20
-	if (ntemps < MAX_TEMPS) {
-		DbgRval (ds18b20_temp (&temp));
-		if (ret != ESP_OK || temp >= BAD_TEMP) {
+	if (config->flags & CONFIG_DS18B20) {
+		float t[DS18B20_MAX_DEVICES];
+		int i, n, bad;
+
+		DbgRval (ds18b20_temp (t, DS18B20_MAX_DEVICES, &n));
+		for (bad = -1, i = 0; i < n; ++i)
+			if (t[i] >= BAD_TEMP && bad < 0) bad = i;
+		if (ret != ESP_OK || 0 == n || bad >= 0) {
 			toggle_error();		// tell DSO
 			++ds18b20_failures;
-			ds18b20_failure_reason = temp;
-			DbgRval (ds18b20_temp (&temp));	// one retry
-			if (ret != ESP_OK || temp >= BAD_TEMP) {
+			ds18b20_failure_reason = bad >= 0 ? t[bad] : 0;
+			DbgRval (ds18b20_temp (t, DS18B20_MAX_DEVICES, &n));	// one retry
+			for (bad = -1, i = 0; i < n; ++i)
+				if (t[i] >= BAD_TEMP && bad < 0) bad = i;
+			if (ret != ESP_OK || 0 == n || bad >= 0) {
 				toggle_error();		// tell DSO
 				++failReadHard;
-				temp = BAD_TEMP;
+				ds18b20_forget ();	// search again next time
 			} else
 				++failRead;
 		}
-		temps[ntemps++] = temp;
+		if (0 == n)
+			t[n++] = BAD_TEMP;
+		for (i = 0; i < n && ntemps < MAX_TEMPS; ++i)
+			temps[ntemps++] = t[i] >= BAD_TEMP ? BAD_TEMP : t[i];
 	}
 #endif // READ_DS18B20
 
@@ -332,11 +396,14 @@ static esp_err_t read_temps (void)
 #endif
 
 #if READ_BME280
-	{
+	if (config->flags & CONFIG_BME280) {
 		float qfe, h, qnh;
 		int fail;
 
-		DbgRval (bme280_init(I2C_SDA, I2C_SCL, !woke_up));
+		static const struct bme280_profile profile = {
+			BME280_OSRS_T, BME280_OSRS_P, BME280_OSRS_H, BME280_FILTER};
+
+		DbgRval (bme280_init(I2C_SDA, I2C_SCL, !woke_up, &profile));
 
 		DbgRval (bme280_read (622, &temp, &qfe, &h, &qnh));
 		if (ret != ESP_OK || temp >= BAD_TEMP) {
@@ -350,9 +417,16 @@ static esp_err_t read_temps (void)
 		if (BME280_BAD_QFE  == qfe)  fail |= 0x02;
 		if (BME280_BAD_HUMI == h)    fail |= 0x04;
 
+#if BINARY_MSG
+		w_temp = temp;
+		w_qnh  = qnh;
+		w_humi = h;
+		w_fail = fail;
+#else
 		snprintf (weather, sizeof(weather),
 			" w=T%.2f,P%.3f,H%.3f,f%x",
 			temp, qnh, h, fail);
+#endif
 		if (ntemps < MAX_TEMPS) temps[ntemps++] = temp;
 	}
 #endif // READ_BME280
@@ -365,7 +439,9 @@ static esp_err_t do_readings (void)
 	esp_err_t ret;
 	esp_err_t rval;		// return first failure
 
+#if !LOG_DEFERRED	// else the log task prints on the other core
 	flush_uart ();		// avoid uart interruptions
+#endif
 
 	time_readings_us = gettimeofday_us();
 	ntemps = 0;
@@ -377,27 +453,25 @@ static esp_err_t do_readings (void)
 	if (0 == ntemps)
 		if (ntemps < MAX_TEMPS) temps[ntemps++] = 0;
 
-#if READ_ADC
-	DbgRval (adc_init (12, ADC_VREF));
-#endif
+    {
+	struct adc_pin pins[ADC_MAX_PINS];
+	int npins = 0;
 
-#ifdef VDD_PIN
-	DbgRval (adc_read (&vdd, VDD_PIN, VDD_ATTEN, VDD_DIVIDER));
-#else
 	vdd = 3.3;
-#endif
-
-#ifdef BAT_PIN
-	DbgRval (adc_read (&bat, BAT_PIN, BAT_ATTEN, BAT_DIVIDER));
-#else
-	bat = BAT_VOLTAGE;
-#endif
-
-#ifdef V1_PIN
-	DbgRval (adc_read (&v1, V1_PIN, V1_ATTEN, V1_DIVIDER));
-#else
+	bat = config->bat_voltage;
 	v1 = 0;
-#endif
+	if (config->vdd_pin >= 0)
+		pins[npins++] = (struct adc_pin){config->vdd_pin, VDD_ATTEN, config->vdd_divider, &vdd};
+	if (config->bat_pin >= 0)
+		pins[npins++] = (struct adc_pin){config->bat_pin, BAT_ATTEN, config->bat_divider, &bat};
+	if (config->v1_pin >= 0)
+		pins[npins++] = (struct adc_pin){config->v1_pin, V1_ATTEN, config->v1_divider, &v1};
+
+	if (npins > 0) {
+		DbgRval (adc_init (12, config->adc_vref));
+		DbgRval (adc_read_all (pins, npins));	// one pass for all
+	}
+    }
 
 	time_readings_us = gettimeofday_us() - time_readings_us;
 
@@ -446,6 +520,141 @@ typedef enum {
 } RESET_REASON;		// from rtc_get_reset_reason()
 #endif
 
+#if BINARY_MSG
+// same content as the text message, without any float formatting
+static int format_message (char *message, int mlen)
+{
+	struct msg *m = (struct msg *)message;
+	struct timeval now;
+	uint64_t cycle_us;		// prev cycle  time
+	uint64_t active_us;		// prev active time
+	int n = ntemps < MSG_MAX_TEMPS ? ntemps : MSG_MAX_TEMPS;
+	uint8_t *p;
+	int i, j;
+
+	if (mlen < (int)MSG_MAX_LEN)
+		LogR (0, "message buffer too small");
+	memset (m, 0, sizeof(*m));
+
+	m->h.magic    = MSG_MAGIC;
+	m->h.version  = MSG_VERSION;
+	m->h.len      = MSG_LEN(n) + 1 + nsamples*MSG_SAMPLE_LEN(n)
+			+ sizeof(struct msg_stages) + sizeof(struct msg_sched)
+			+ sizeof(struct msg_droop);
+	m->h.device   = config->device;
+	m->h.runCount = runCount;
+	if (READ_DS18B20 && (config->flags & CONFIG_DS18B20))
+		m->h.flags |= MSG_HAVE_DS18B20;
+	if (READ_BME280 && (config->flags & CONFIG_BME280))
+		m->h.flags |= MSG_HAVE_BME280;
+
+	get_time_tv (&now);
+
+	m->sleep_us     = (sleep_start_us > 0)    ? app_start_us    - sleep_start_us    : 0;
+	m->sleep_ticks  = (sleep_start_ticks > 0) ? app_start_ticks - sleep_start_ticks : 0;
+	m->app_start_us = app_start_us;
+	m->readings_us  = time_readings_us;
+	m->wifi_us      = time_wifi_us;
+	m->now_us       = now.tv_sec * 1000000 + now.tv_usec;
+
+	if (woke_up) {
+		cycle_us = app_start_us - prev_app_start_us;
+		active_us = cycle_us - sleep_length_us;
+	} else
+		cycle_us = active_us = 0;
+
+	m->last_us   = timeLast;
+	m->total_s   = timeTotal / 1000000;
+	m->cycle_us  = cycle_us;
+	m->active_us = active_us;
+
+	m->rtc_us     = esp_clk_rtc_time();
+	m->frc_us     = gettimeofday_us();
+	m->frc_raw_us = get_time_since_boot_64();
+	m->slow_cal   = esp_clk_slowclk_cal_get();
+	m->rtc_ticks  = rtc_time_get();
+	m->grace_us   = lastGrace;
+
+	m->fail_soft      = failSoft;
+	m->fail_hard      = failHard;
+	m->fail_read      = failRead;
+	m->fail_read_hard = failReadHard;
+#if READ_DS18B20
+	m->ds18b20_failures = ds18b20_failures;
+	m->ds18b20_reason   = MSG_TEMP(ds18b20_failure_reason);
+#endif
+#if READ_BME280
+	m->bme280_failures = bme280_failures;
+#endif
+	m->wakeup_cause = wakeup_cause;
+	m->reset_reason = reset_reason;
+
+	m->bat_mv = (uint16_t)(bat * 1000 + .5);
+	m->vdd_mv = (uint16_t)(vdd * 1000 + .5);
+	m->v1_mv  = (uint16_t)(v1  * 1000 + .5);
+
+	m->rssi    = rssi;
+	m->channel = channel;
+
+#if READ_BME280
+	m->w_temp = MSG_TEMP(w_temp);
+	m->w_qnh  = (uint32_t)(w_qnh  * 1000 + .5);
+	m->w_humi = (uint16_t)(w_humi *  100 + .5);
+	m->w_fail = w_fail;
+#endif
+
+	m->ntemps = n;
+	for (i = 0; i < n; ++i)
+		m->temps[i] = MSG_TEMP(temps[i]);
+
+	p = (uint8_t *)message + MSG_LEN(n);
+	*p++ = nsamples;
+#if RTC_SAMPLES > 0
+	for (i = 0; i < nsamples; ++i) {
+		struct sample *s = get_sample (i);
+		struct msg_sample *ms = (struct msg_sample *)p;
+
+		ms->runCount = s->runCount;
+		ms->rtc_ms   = s->rtc_ms;
+		ms->bat_mv   = s->bat_mv;
+		ms->vdd_mv   = s->vdd_mv;
+		for (j = 0; j < n; ++j)
+			ms->temps[j] = (j < MAX_TEMPS) ? s->temps[j] : 0;
+		p += MSG_SAMPLE_LEN(n);
+	}
+#endif
+
+	memcpy (p, stage_us, sizeof(struct msg_stages));
+	p += sizeof(struct msg_stages);
+
+    {
+	struct msg_sched *ms = (struct msg_sched *)p;
+	int32_t ppm = 0, error_us = 0;
+	uint32_t overhead_us = 0;
+
+#if SLEEP_SCHED
+	sched_info (&ppm, &overhead_us, &error_us);
+#endif
+	ms->ppm         = ppm;
+	ms->overhead_us = overhead_us;
+	ms->error_us    = error_us;
+	p += sizeof(struct msg_sched);
+    }
+
+    {
+	struct msg_droop *md = (struct msg_droop *)p;
+
+	md->min_mv  = droop.min_mv;
+	md->mean_mv = droop.mean_mv;
+	md->min_us  = droop.min_us;
+	md->n       = droop.n;
+    }
+
+	return m->h.len;
+}
+
+#else // BINARY_MSG
+
 static int format_message (char *message, int mlen)
 {
 	char *buf = message;
@@ -466,7 +675,7 @@ static int format_message (char *message, int mlen)
 
 	len = snprintf (buf, blen,
 		"%s %s %d",
-		ACTION, MY_NAME, runCount);
+		config->action, config->name, runCount);
 	if (len > 0) {
 		buf += len;
 		blen -= len;
@@ -486,6 +695,19 @@ static int format_message (char *message, int mlen)
 		blen -= len;
 	}
 
+	len = snprintf (buf, blen,
+		" stages=rs%.3f,re%.3f,ws%.3f,wc%.3f,wi%.3f,tx%.3f",
+		stage_us[STAGE_READ_START] / 1000000.,
+		stage_us[STAGE_READ_END]   / 1000000.,
+		stage_us[STAGE_WIFI_SETUP] / 1000000.,
+		stage_us[STAGE_CONNECTED]  / 1000000.,
+		stage_us[STAGE_GOT_IP]     / 1000000.,
+		stage_us[STAGE_SEND]       / 1000000.);
+	if (len > 0) {
+		buf += len;
+		blen -= len;
+	}
+
 	if (woke_up) {
 		cycle_us = app_start_us - prev_app_start_us;
 		active_us = cycle_us - sleep_length_us;
@@ -522,6 +744,22 @@ static int format_message (char *message, int mlen)
 	}
     }
 
+#if SLEEP_SCHED
+    {
+	int32_t ppm, error_us;
+	uint32_t overhead_us;
+
+	sched_info (&ppm, &overhead_us, &error_us);
+	len = snprintf (buf, blen,
+		" sched=p%d,o%.3f,e%.3f",
+		ppm, overhead_us / 1000., error_us / 1000.);
+	if (len > 0) {
+		buf += len;
+		blen -= len;
+	}
+    }
+#endif
+
 #if 000
     {
 	esp_err_t ret;
@@ -551,21 +789,25 @@ static int format_message (char *message, int mlen)
 		blen -= len;
 	}
 #if READ_DS18B20
-	len = snprintf (buf, blen,
-		",Dc%d,Dr%.4f",
-		ds18b20_failures, ds18b20_failure_reason);
-	if (len > 0) {
-		buf += len;
-		blen -= len;
+	if (config->flags & CONFIG_DS18B20) {
+		len = snprintf (buf, blen,
+			",Dc%d,Dr%.4f",
+			ds18b20_failures, ds18b20_failure_reason);
+		if (len > 0) {
+			buf += len;
+			blen -= len;
+		}
 	}
 #endif
 #if READ_BME280
-	len = snprintf (buf, blen,
-		",Bc%d",
-		bme280_failures);
-	if (len > 0) {
-		buf += len;
-		blen -= len;
+	if (config->flags & CONFIG_BME280) {
+		len = snprintf (buf, blen,
+			",Bc%d",
+			bme280_failures);
+		if (len > 0) {
+			buf += len;
+			blen -= len;
+		}
 	}
 #endif
 	len = snprintf (buf, blen,
@@ -584,6 +826,17 @@ static int format_message (char *message, int mlen)
 		blen -= len;
 	}
 
+	if (droop.n > 0) {
+		len = snprintf (buf, blen,
+			" droop=m%.3f,a%.3f,t%.3f,n%d",
+			droop.min_mv / 1000., droop.mean_mv / 1000.,
+			droop.min_us / 1000000., droop.n);
+		if (len > 0) {
+			buf += len;
+			blen -= len;
+		}
+	}
+
 	len = snprintf (buf, blen,
 		" radio=s%d,c%d",
 		-rssi, channel);
@@ -620,6 +873,32 @@ static int format_message (char *message, int mlen)
 		}
 	}
 
+#if RTC_SAMPLES > 0
+// " batch=runCount,rtc_ms,bat,vdd,temp...;..." oldest first
+	for (i = 0; i < nsamples; ++i) {
+		struct sample *s = get_sample (i);
+		int j;
+
+		len = snprintf (buf, blen,
+			"%s%u,%u,%.3f,%.3f",
+			(i ? ";" : " batch="), s->runCount, s->rtc_ms,
+			s->bat_mv / 1000., s->vdd_mv / 1000.);
+		if (len > 0) {
+			buf += len;
+			blen -= len;
+		}
+		for (j = 0; j < ntemps; ++j) {
+			len = snprintf (buf, blen,
+				",%.4f",
+				MSG_TEMP_C(s->temps[j]));
+			if (len > 0) {
+				buf += len;
+				blen -= len;
+			}
+		}
+	}
+#endif
+
 #if PRINT_MSG
 	if (!do_log)
 		LogF ("%s", message);
@@ -627,6 +906,7 @@ static int format_message (char *message, int mlen)
 
 	return mlen - blen;
 }
+#endif // BINARY_MSG
 
 static void do_grace (void)
 {
@@ -635,11 +915,22 @@ static void do_grace (void)
 
 #if defined(WIFI_GRACE_MS) && WIFI_GRACE_MS > 0
 	toggle(3);
-Log ("delay %dms", WIFI_GRACE_MS);
 	uint64_t grace_us = gettimeofday_us();
+#if WIFI_TX_DONE
+Log ("xEventGroupWaitBits(TX_DONE) up to %dms", WIFI_GRACE_MS);
+	EventBits_t bits = xEventGroupWaitBits(event_group, TX_DONE,
+		false, false, (WIFI_GRACE_MS + do_log*5) / portTICK_PERIOD_MS);
+	if (TX_DONE & bits)
+		Log ("TX done, %s", tx_acked ? "acked" : "not acked");
+	else
+		Log ("TX done timed out");
+#else
+Log ("delay %dms", WIFI_GRACE_MS);
 	delay_ms (WIFI_GRACE_MS + do_log*5);	// time to drain wifi queue
+#endif
 	lastGrace = (int)(gettimeofday_us() - grace_us);
 #endif
+	wifi_arp_learn ();
 }
 
 static void finish (void)
@@ -654,6 +945,9 @@ static void finish (void)
 	if (sent)
 		do_grace ();
 
+	if (wifing)
+		adc_droop_stop (&droop);	// nothing if it did not start
+
 #if DISCONNECT
 	DbgR (esp_disconnect());
 
@@ -662,7 +956,10 @@ Log ("xEventGroupWaitBits(NO_WIFI)");
 		false, false, WIFI_DISCONNECT_MS / portTICK_PERIOD_MS);
 #endif
 
-Log ("esp_deep_sleep %ds", SLEEP_S);
+Log ("esp_deep_sleep %ds", config->sleep_s);
+#if LOG_DEFERRED
+	log_drain ();
+#endif
 	flush_uart();
 	if (do_log)
 		delay_ms(5);	// or else we do not see final messages
@@ -673,37 +970,76 @@ Log ("esp_deep_sleep %ds", SLEEP_S);
 	prev_app_start_us = app_start_us;
 	timeLast = sleep_start_us - app_start_us;
 	timeTotal += timeLast;
-#if 000	// fixed cycle length
-	sleep_length_us = SLEEP_S*1000000 - sleep_start_us;
-	if (sleep_length_us <= 0)
-		sleep_length_us = 1;
+#if SLEEP_SCHED	// fixed cycle length
+	sleep_length_us = sched_sleep_us (config->sleep_s*1000000ULL);
 #else	// fixed sleep length
-	sleep_length_us = SLEEP_S*1000000;
+	sleep_length_us = config->sleep_s*1000000ULL;
 #endif
 	esp_deep_sleep(sleep_length_us);
 	vTaskDelete(NULL);
 }
 
+/* The battery under the radio load, from now to the deep sleep.
+ * Only after the readings are done, read_task uses ADC1 and the cal cache too.
+ */
+static void droop_start (void)
+{
+	esp_err_t ret;
+
+	if (DROOP_PERIOD_US <= 0 || config->bat_pin < 0)
+		return;
+
+	Dbg (adc_init (12, config->adc_vref));
+	if (ESP_OK == ret)
+		Dbg (adc_droop_start (config->bat_pin, BAT_ATTEN, config->bat_divider,
+			DROOP_PERIOD_US));
+}
+
+// on the other core, WiFi comes up meanwhile
+static void read_task (void *param)
+{
+Log("do_readings");
+	stage_mark (STAGE_READ_START);
+	(void)do_readings();
+	stage_mark (STAGE_READ_END);
+
+	xEventGroupSetBits(event_group, HAVE_READINGS);
+	vTaskDelete(NULL);
+}
+
 static esp_err_t app (void)
 {
 	EventBits_t bits;
-	char message[500];
+	char message[560 + MAX_TEMPS*10 + RTC_SAMPLES*(40 + MAX_TEMPS*10)];
 	int mlen;
 
-Log("do_readings");
-	(void)do_readings();
+Log("xEventGroupWaitBits(HAVE_READINGS)");
+	bits = xEventGroupWaitBits(event_group, HAVE_READINGS,
+		false, false, READ_TIMEOUT_MS / portTICK_PERIOD_MS);
+	if (!(HAVE_READINGS & bits))
+		LogR (ESP_FAIL, "readings timed out, aborting");
+
+	if (!wifing) {
+		save_sample ();
+		return ESP_OK;
+	}
+
+	droop_start ();
 
 Log("xEventGroupWaitBits(HAVE_WIFI|NO_WIFI)");
 	xEventGroupWaitBits(event_group, HAVE_WIFI|NO_WIFI,
 		false, false, WIFI_TIMEOUT_MS / portTICK_PERIOD_MS);
 	bits = xEventGroupGetBits (event_group);
-	if (0 == bits)
-		LogR (ESP_FAIL, "WiFi timed out, aborting");
-	if (!(HAVE_WIFI & bits))
+	if (!(HAVE_WIFI & bits)) {
+		save_sample ();		// try again next radio wake
+		if (0 == bits)
+			LogR (ESP_FAIL, "WiFi timed out, aborting");
 		LogR (ESP_FAIL, "no WiFi, aborting");
+	}
 Log ("have WiFi");
 
 // need to do this late to have wifi timing
+	stage_mark (STAGE_SEND);
 Log ("format_message");
 	mlen = format_message (message, sizeof(message));
 
@@ -711,6 +1047,9 @@ Log ("wifi_send_message");
 	wifi_send_message (message, mlen);
 Log ("sent message");
 	sent = 1;
+#if RTC_SAMPLES > 0
+	nsamples = 0;
+#endif
 
 	return ESP_OK;
 }
@@ -722,9 +1061,26 @@ static void main_task(void *param)
 Log ("xEventGroupCreate");
 	event_group = xEventGroupCreate();
 
-	Dbg (wifi_setup ());
+#if WIFI_ON_RATE > 0
+	wifing = 0 == runCount % WIFI_ON_RATE;
+#else
+	wifing = 0;
+#endif
+
+Log ("start read_task");
+	xTaskCreatePinnedToCore(read_task, "read", APP_TASK_STACK, NULL,
+		APP_TASK_PRIORITY, NULL, READ_CPU_AFFINITY);
+
+	if (wifing) {
+		Dbg (wifi_setup ());
+		stage_mark (STAGE_WIFI_SETUP);
+	} else
+		ret = ESP_OK;
 	if (ESP_OK == ret)
 		Dbg (app());
+	else if (HAVE_READINGS & xEventGroupWaitBits(event_group, HAVE_READINGS,
+			false, false, READ_TIMEOUT_MS / portTICK_PERIOD_MS))
+		save_sample ();		// try again next radio wake
 
 	finish ();
 
@@ -767,12 +1123,21 @@ void app_main ()
 	wakeup_cause = rtc_get_wakeup_cause();
 	reset_reason = rtc_get_reset_reason(0);
 	woke_up = reset_reason == DEEPSLEEP_RESET;
+#if SLEEP_SCHED
+	sched_wake (woke_up);
+#endif
+
+#if LOG_DEFERRED
+	log_start ();
+#endif
 
 	if (do_log && !woke_up)	// cold start
 		delay_ms (100);	// give 'screen' time to start
 
 	Log ("app built at %s %s", __DATE__, __TIME__);
 
+	(void)config_load ();	// from RTC memory after a deep sleep
+
 //Log ("app_main start portTICK_PERIOD_MS=%d sizeof(int)=%d sizeof(long)=%d",
 //	portTICK_PERIOD_MS, sizeof(int), sizeof(long));
 
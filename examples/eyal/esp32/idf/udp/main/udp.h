@@ -20,9 +20,40 @@ uint64_t gettimeofday_us(void);
 int do_log;
 bool woke_up;
 
+/* when each stage happened, sent in the message */
+enum {
+	STAGE_READ_START = 0,
+	STAGE_READ_END,
+	STAGE_WIFI_SETUP,	// esp_wifi_connect() issued
+	STAGE_CONNECTED,
+	STAGE_GOT_IP,
+	STAGE_SEND,
+	STAGE_NUM
+};
+void stage_mark (int stage);
+
 #define LOG_FLUSH	1	// 1= flush uart after each Log message
 #define LOG_ERRORS	1	// 1= always log errors
 
+#ifndef LOG_DEFERRED
+#define LOG_DEFERRED	1	// 1= Log into a ring, printed later (log.c)
+#endif
+#define LOG_TASK	1	// 1= print the ring from a low priority task, else only before sleep
+#define LOG_RTC		0	// 1= keep the ring in RTC memory, print it after a reset (IDF v3.1+)
+
+/* log.c */
+void log_put (const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+void log_drain (void);
+void log_start (void);
+
+#ifndef BINARY_MSG
+#define BINARY_MSG	0	// 1= send a binary message (msg.h) instead of text
+#endif
+
+#if LOG_DEFERRED
+#define LogF(fmt,...) \
+	log_put (fmt, ##__VA_ARGS__)
+#else
 #define LogF(fmt,...) \
 do { \
 	struct timeval now; \
@@ -31,6 +62,7 @@ do { \
 	printf ("%3lu.%06lu " fmt "\n", now.tv_sec, now.tv_usec, ##__VA_ARGS__); \
 	if (LOG_FLUSH) flush_uart (); \
 } while (0)
+#endif
 
 #define Log(...) \
 do { \
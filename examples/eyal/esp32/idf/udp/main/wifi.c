@@ -1,10 +1,18 @@
 #include "udp.h"
 #include "wifi.h"
+#include "config.h"		// config_nvs_init()
 
 #include <sys/socket.h>
 #include <esp_wifi.h>
+#include <esp_wifi_internal.h>	// esp_wifi_internal_reg_txcb()
 #include <esp_event_loop.h>	// esp_event_loop_init()
-#include <nvs_flash.h>
+#include <esp_attr.h>		// RTC_DATA_ATTR
+#include <lwip/udp.h>
+#include <lwip/ip4.h>		// ip4_route()
+#include <lwip/etharp.h>
+#include <lwip/dhcp.h>		// netif_dhcp_data()
+#include <netif/ethernet.h>		// ethernet_input()
+#include <lwip/priv/tcpip_priv.h>	// tcpip_api_call()
 
 // best to provide in CFLAGS: AP_SSID AP_PASS MY_IP
 #ifndef AP_SSID
@@ -38,24 +46,291 @@
 #define USE_DHCPC		1		// use dhcp
 #endif // ifndef MY_IP
 
+#define UDP_RAW			1	// 1= lwIP raw udp from the tcpip thread, 0= a socket
+#define WIFI_FAST		1	// 1= connect straight to the last AP, no scan
+#define WIFI_FAST_IP		1	// 1= also reuse the dhcp lease, until its renewal time
+
+#define ARP_FAST		1	// 1= reuse the server's MAC from the last wake, no ARP
+#define ARP_REFRESH		10	// wakes between real ARPs, in case the server changed
+#define ARP_FRAME_LEN		42	// ethernet header and ARP reply
+
+#define WIFI_CACHE_MAGIC	0x57494631	// "WIF1"
+#define ARP_CACHE_MAGIC		0x41525031	// "ARP1"
+
+// the last good association, kept over deep sleep
+struct wifi_cache {
+	uint32_t magic;
+	uint8_t bssid[6];
+	uint8_t channel;
+	tcpip_adapter_ip_info_t ip_info;
+	uint64_t lease_us;		// gettimeofday_us() when ip_info was leased
+	uint32_t lease_s;		// reused this long, the lease's T1 (0= not at all)
+};
+RTC_DATA_ATTR static struct wifi_cache wifi_cache;
+static int fast = 0;		// this connect uses wifi_cache
+static int fast_ip = 0;		// and its ip_info, no dhcp
+
+// the next hop (the server or the gateway) learnt after a send
+struct arp_cache {
+	uint32_t magic;
+	ip4_addr_t ip;
+	struct eth_addr mac;
+	uint16_t uses;			// wakes since it was learnt
+};
+RTC_DATA_ATTR static struct arp_cache arp_cache;
+static int arp_used = 0;	// put in this wake
+static err_t arp_err = ERR_OK;	// from arp_restore()
+static ip_addr_t svr_addr;
+
+static volatile int tx_armed = 0;	// waiting for the message frame
+static int tx_len;
+
+// In the WiFi task, for each frame the MAC is finished with, acked or out
+// of retries. Anything shorter than the message (the ARP before it) is
+// not ours.
+static void tx_done (uint8_t *data, uint16_t *len, bool txStatus)
+{
+	if (!tx_armed || *len < tx_len)
+		return;
+	tx_armed = 0;
+	tx_acked = txStatus;
+	xEventGroupSetBits(event_group, TX_DONE);
+}
+
+// In the tcpip thread, where the server is reached through
+static const ip4_addr_t *next_hop (struct netif **netif)
+{
+	const ip4_addr_t *svr = ip_2_ip4(&svr_addr);
+
+	*netif = ip4_route(svr);
+	if (NULL == *netif)
+		return NULL;
+	if (ip4_addr_netcmp(svr, netif_ip4_addr(*netif), netif_ip4_netmask(*netif)))
+		return svr;
+	return netif_ip4_gw(*netif);
+}
+
+// In the tcpip thread, before the first send. The kept MAC goes in as an
+// ARP reply from the next hop, an ordinary entry that a real reply still
+// replaces (a static one would not). ethernet_input() is called directly,
+// netif->input would queue the frame behind the send. If this fails lwIP
+// just ARPs.
+static void arp_restore (void)
+{
+#if ARP_FAST
+	struct netif *netif;
+	const ip4_addr_t *hop;
+	struct pbuf *p;
+	uint8_t *f;
+
+	if (arp_used || !woke_up || ARP_CACHE_MAGIC != arp_cache.magic
+	    || arp_cache.uses >= ARP_REFRESH)
+		return;
+
+	hop = next_hop (&netif);
+	if (NULL == hop || !ip4_addr_cmp(hop, &arp_cache.ip)) {
+		arp_err = ERR_RTE;	// the network changed
+		return;
+	}
+
+	p = pbuf_alloc(PBUF_RAW, ARP_FRAME_LEN, PBUF_RAM);
+	if (NULL == p) {
+		arp_err = ERR_MEM;
+		return;
+	}
+	f = p->payload;
+	memcpy (f+0, netif->hwaddr, 6);			// ethernet, to us
+	memcpy (f+6, arp_cache.mac.addr, 6);		// from the hop
+	f[12] = 0x08; f[13] = 0x06;			// ARP
+	f[14] = 0x00; f[15] = 0x01;			// ethernet
+	f[16] = 0x08; f[17] = 0x00;			// IPv4
+	f[18] = 6;    f[19] = 4;
+	f[20] = 0x00; f[21] = 0x02;			// reply
+	memcpy (f+22, arp_cache.mac.addr, 6);		// sender
+	memcpy (f+28, &arp_cache.ip, 4);
+	memcpy (f+32, netif->hwaddr, 6);		// target
+	memcpy (f+38, netif_ip4_addr(netif), 4);
+
+	arp_err = ethernet_input(p, netif);		// frees p
+	arp_used = (ERR_OK == arp_err);
+#endif
+}
+
+static err_t arp_learn_call (struct tcpip_api_call_data *call)
+{
+	struct netif *netif;
+	const ip4_addr_t *hop, *ip;
+	struct eth_addr *mac;
+
+	hop = next_hop (&netif);
+	if (NULL == hop)
+		return ERR_RTE;
+	if (etharp_find_addr(netif, hop, &mac, &ip) < 0)
+		return ERR_ARG;
+
+	arp_cache.ip = *hop;
+	arp_cache.mac = *mac;
+	arp_cache.uses = 0;
+	arp_cache.magic = ARP_CACHE_MAGIC;
+	return ERR_OK;
+}
+
+#if !UDP_RAW
+static err_t arp_restore_call (struct tcpip_api_call_data *call)
+{
+	arp_restore ();
+	return ERR_OK;
+}
+#endif
+
+#if UDP_RAW
+struct udp_send {
+	struct tcpip_api_call_data call;	// must be first
+	const char *message;
+	int mlen;
+};
+
+static struct udp_pcb *pcb = NULL;	// made on the first send, then kept
+
+// In the tcpip thread. The pbuf points at the message, lwIP adds its
+// headers in front and the driver copies it once into its TX buffer.
+static err_t udp_send_call (struct tcpip_api_call_data *call)
+{
+	struct udp_send *us = (struct udp_send *)call;
+	struct pbuf *p;
+	err_t err;
+
+	arp_restore ();
+
+	if (NULL == pcb) {
+		pcb = udp_new();
+		if (NULL == pcb)
+			return ERR_MEM;
+	}
+
+	p = pbuf_alloc(PBUF_TRANSPORT, us->mlen, PBUF_REF);
+	if (NULL == p)
+		return ERR_MEM;
+	p->payload = (void *)us->message;
+
+	err = udp_sendto(pcb, p, &svr_addr, SVR_PORT);
+	pbuf_free(p);
+
+	return err;
+}
+#else
+static int mysocket = -1;		// opened on the first send, then kept
+#endif
+
 void wifi_send_message (char * message, int mlen)
 {
-	int mysocket;
+#if UDP_RAW
+	struct udp_send us = {
+		.message = message,
+		.mlen = mlen,
+	};
+	err_t err;
+#else
+	struct tcpip_api_call_data call;
 	struct sockaddr_in remote_addr;
 
-	mysocket = socket(AF_INET, SOCK_DGRAM, 0);
+	if (mysocket < 0)
+		mysocket = socket(AF_INET, SOCK_DGRAM, 0);
 	remote_addr.sin_family = AF_INET;
 	remote_addr.sin_port = htons(SVR_PORT);
 	remote_addr.sin_addr.s_addr = inet_addr(SVR_IP);
+#endif
 
+#if BINARY_MSG
+Log ("sending %d bytes", mlen);
+#else
 Log ("sending '%s'", message);
+#endif
 	toggle(2);
+	tx_len = mlen;
+	tx_armed = 1;
+#if UDP_RAW
+	err = tcpip_api_call(udp_send_call, &us.call);
+	if (ERR_OK != err) {
+		tx_armed = 0;
+		Log ("udp_sendto failed err=%d", err);
+	}
+#else
+	tcpip_api_call(arp_restore_call, &call);
 	sendto(mysocket, message, mlen, 0,
 		(struct sockaddr *)&remote_addr, sizeof(remote_addr));
+#endif
+	if (arp_used)
+		Log ("ARP entry restored, %d wakes old", arp_cache.uses);
+	else if (ERR_OK != arp_err)
+		Log ("ARP entry not restored err=%d, ARPing", arp_err);
+}
+
+// after the send, keep the MAC that ARP found for the next wakes
+void wifi_arp_learn (void)
+{
+	struct tcpip_api_call_data call;
+	err_t err;
+
+	if (!ARP_FAST)
+		return;
+
+	if (arp_used) {
+		++arp_cache.uses;
+		return;
+	}
+
+	err = tcpip_api_call(arp_learn_call, &call);
+	if (ERR_OK == err)
+		Log ("ARP entry kept for next wake");
+	else
+		Log ("no ARP entry to keep, err=%d", err);
 }
 
+#if USE_DHCPC && WIFI_FAST_IP
+// In the tcpip thread, after the lease is bound
+static err_t lease_call (struct tcpip_api_call_data *call)
+{
+	struct netif *netif;
+	struct dhcp *dhcp;
+
+	if (ESP_OK != tcpip_adapter_get_netif(TCPIP_ADAPTER_IF_STA, (void **)&netif)
+	    || NULL == (dhcp = netif_dhcp_data(netif)))
+		return ERR_ARG;
+	wifi_cache.lease_s = dhcp->offered_t1_renew;
+	return ERR_OK;
+}
+
+static void lease_save (void)
+{
+	struct tcpip_api_call_data call;
+
+	wifi_cache.lease_us = gettimeofday_us();
+	wifi_cache.lease_s = 0;
+	(void)tcpip_api_call(lease_call, &call);
+Log ("dhcp lease reused for %us", wifi_cache.lease_s);
+}
+
+static int lease_good (void)
+{
+	return gettimeofday_us() - wifi_cache.lease_us
+		< wifi_cache.lease_s * 1000000ULL;
+}
+#endif
+
 static esp_err_t set_ip (void)
 {
+#if USE_DHCPC && WIFI_FAST_IP
+	fast_ip = fast && lease_good ();
+	if (fast_ip) {
+char ip[16];
+Log ("tcpip_adapter_set_ip_info cached ip=%s",
+	ip4addr_ntoa_r(&wifi_cache.ip_info.ip, ip, sizeof(ip)));
+		DbgR (tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA));
+		DbgR (tcpip_adapter_set_ip_info(TCPIP_ADAPTER_IF_STA, &wifi_cache.ip_info));
+	}
+#endif
+
 #if !USE_DHCPC
 Log ("tcpip_adapter_dhcpc_stop");
 	DbgR (tcpip_adapter_dhcpc_stop(TCPIP_ADAPTER_IF_STA));
@@ -72,6 +347,49 @@ Log ("tcpip_adapter_set_ip_info ip=%s nm=%s gw=%s", MY_IP, MY_NM, MY_GW);
 	return ESP_OK;
 }
 
+// directed: the AP from wifi_cache, else scan for AP_SSID
+static esp_err_t set_config (int directed)
+{
+	wifi_config_t wifi_config = {
+		.sta = {
+			.ssid     = AP_SSID,
+			.password = AP_PASS,
+			.bssid_set = 0,
+			.channel = 6
+		},
+	};
+
+	if (directed) {
+		wifi_config.sta.bssid_set = 1;
+		memcpy (wifi_config.sta.bssid, wifi_cache.bssid, sizeof(wifi_config.sta.bssid));
+		wifi_config.sta.channel = wifi_cache.channel;
+	}
+Log ("esp_wifi_set_config(ESP_IF_WIFI_STA) ap='%s' ch=%d bssid_set=%d",
+	wifi_config.sta.ssid, wifi_config.sta.channel, wifi_config.sta.bssid_set);
+	DbgR (esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+
+	return ESP_OK;
+}
+
+// the cached AP did not answer, forget it and scan
+static esp_err_t fast_fallback (void)
+{
+	fast = 0;
+	wifi_cache.magic = 0;
+	arp_cache.magic = 0;		// a new network maybe
+
+	DbgR (set_config (0));
+#if USE_DHCPC && WIFI_FAST_IP
+	if (fast_ip) {
+		fast_ip = 0;
+Log ("tcpip_adapter_dhcpc_start");
+		DbgR (tcpip_adapter_dhcpc_start(TCPIP_ADAPTER_IF_STA));
+	}
+#endif
+
+	return ESP_OK;
+}
+
 static esp_err_t event_handler (void *ctx, system_event_t *event)
 {
 Log("event_handler: SYSTEM_EVENT %d", event->event_id);
@@ -82,6 +400,7 @@ Log ("SYSTEM_EVENT_STA_START");
 		break;
 	case SYSTEM_EVENT_STA_CONNECTED:
 		toggle(1);
+		stage_mark (STAGE_CONNECTED);
 		time_wifi_us = gettimeofday_us() - time_wifi_us;
 {
 		wifi_ap_record_t wifidata;
@@ -89,10 +408,13 @@ Log ("SYSTEM_EVENT_STA_START");
 		rssi = wifidata.rssi;
 		channel = event->event_info.connected.channel;
 Log("SYSTEM_EVENT_STA_CONNECTED rssi=%d channel=%d", rssi, channel);
+		memcpy (wifi_cache.bssid, event->event_info.connected.bssid, sizeof(wifi_cache.bssid));
+		wifi_cache.channel = channel;
 }
 		break;
 	case SYSTEM_EVENT_STA_GOT_IP:
 		toggle(1);
+		stage_mark (STAGE_GOT_IP);
 {
 char ip[16], nm[16], gw[16];
 Log ("SYSTEM_EVENT_STA_GOT_IP ip=%s nm=%s gw=%s",
@@ -100,6 +422,12 @@ Log ("SYSTEM_EVENT_STA_GOT_IP ip=%s nm=%s gw=%s",
 	ip4addr_ntoa_r(&event->event_info.got_ip.ip_info.netmask, nm, sizeof(nm)),
 	ip4addr_ntoa_r(&event->event_info.got_ip.ip_info.gw, gw, sizeof(gw)));
 }
+		wifi_cache.ip_info = event->event_info.got_ip.ip_info;
+		wifi_cache.magic = WIFI_CACHE_MAGIC;
+#if USE_DHCPC && WIFI_FAST_IP
+		if (!fast_ip)
+			lease_save ();
+#endif
 Log("xEventGroupSetBits");
 		xEventGroupSetBits(event_group, HAVE_WIFI);
 		break;
@@ -111,6 +439,8 @@ Log ("SYSTEM_EVENT_STA_DISCONNECTED reason %d", event->event_info.disconnected.r
 		if (sent || ++retry_count > 1)
 			xEventGroupSetBits(event_group, NO_WIFI);
 		else {
+			if (fast)
+				DbgR (fast_fallback ());
 Log ("esp_wifi_connect retry");
 			DbgR (esp_wifi_connect());	// try once again
 		}
@@ -130,39 +460,39 @@ Log ("esp_phy_load_cal_and_init");
 	esp_phy_load_cal_and_init();	// no effect
 #endif
 
+	ipaddr_aton(SVR_IP, &svr_addr);
+
 Log ("esp_event_loop_init");
 	DbgR (esp_event_loop_init(event_handler, NULL));
 
 Log ("tcpip_adapter_init");
 	tcpip_adapter_init();
 
-Log ("nvs_flash_init");
-	DbgR (nvs_flash_init());
+	DbgR (config_nvs_init());	// maybe done already by config_load()
 
 	wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT();
 Log ("esp_wifi_init");
 	DbgR (esp_wifi_init(&cfg));
 
+Log ("esp_wifi_internal_reg_txcb");
+	DbgR (esp_wifi_internal_reg_txcb(tx_done));
+
+	fast = WIFI_FAST && woke_up && WIFI_CACHE_MAGIC == wifi_cache.magic;
+
 	DbgR (set_ip());
 
-	if (!woke_up) {	// otherwise this was saved in flash
+	if (fast) {	// for this wake only, do not wear the flash
+Log ("esp_wifi_set_storage(WIFI_STORAGE_RAM)");
+		DbgR (esp_wifi_set_storage(WIFI_STORAGE_RAM));
+		DbgR (set_config (1));
+	} else if (!woke_up) {	// otherwise this was saved in flash
 Log ("esp_wifi_set_storage(WIFI_STORAGE_FLASH)");
 		DbgR (esp_wifi_set_storage(WIFI_STORAGE_FLASH));
 
 Log ("esp_wifi_set_mode(WIFI_MODE_STA)");
 		DbgR (esp_wifi_set_mode(WIFI_MODE_STA));
 
-		wifi_config_t wifi_config = {
-			.sta = {
-				.ssid     = AP_SSID,
-				.password = AP_PASS,
-				.bssid_set = 0,
-				.channel = 6
-			},
-		};
-Log ("esp_wifi_set_config(ESP_IF_WIFI_STA) ap='%s' ch=%d",
-	wifi_config.sta.ssid, wifi_config.sta.channel);
-		DbgR (esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
+		DbgR (set_config (0));
 
 //Log ("esp_wifi_set_auto_connect(true)");
 //		DbgR (esp_wifi_set_auto_connect(true));
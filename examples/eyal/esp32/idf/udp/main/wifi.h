@@ -7,13 +7,17 @@ int retry_count;
 uint64_t time_wifi_us;
 int rssi;
 int channel;
+int tx_acked;
 EventGroupHandle_t event_group;
 #define HAVE_WIFI       BIT0
 #define NO_WIFI         BIT1
+#define HAVE_READINGS   BIT2
+#define TX_DONE         BIT3
 
 /* wifi.c */
 void wifi_send_message (char * message, int mlen);
 esp_err_t wifi_setup (void);
 esp_err_t wifi_disconnect (void);
+void wifi_arp_learn (void);
 
 #endif // _WIFI_H
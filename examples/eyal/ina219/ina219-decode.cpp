@@ -0,0 +1,196 @@
+/*
+ * Decode the REPORT_BINARY stream of ina219.ino into CSV.
+ *
+ *	g++ -O2 -o ina219-decode ina219-decode.cpp
+ *	ina219-decode [-s] [file|/dev/ttyUSB0] > samples.csv
+ *
+ * The serial port must already be set up (stty -F /dev/ttyUSB0 230400 raw).
+ * Anything between frames (text, noise) is skipped, a bad frame is dropped
+ * and the search for the next one resumes after its sync.
+ *
+ * Output columns: t_us (since the first sample, micros() unwrapped),
+ * seq, current_mA and, when sent, bus_V.
+ * -s prints only the summary, which always goes to stderr.
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+
+#define FRAME_SYNC0	0xA5
+#define FRAME_SYNC1	0x5A
+#define FRAME_HEAD	12
+
+static uint16_t get16(const uint8_t *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static uint32_t get32(const uint8_t *p)
+{
+	return get16(p) | ((uint32_t)get16(p+2) << 16);
+}
+
+static uint16_t crc16(const uint8_t *p, size_t len, uint16_t crc)
+{
+	while (len-- > 0) {
+		crc ^= *p++;
+		for (int i = 0; i < 8; ++i)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+	}
+	return crc;
+}
+
+struct Stats {
+	unsigned long frames = 0;
+	unsigned long bad = 0;		// crc
+	unsigned long lost_frames = 0;	// seq gaps
+	unsigned long drops = 0;	// samples the device lost
+	unsigned long skipped = 0;	// bytes outside frames
+	unsigned long samples = 0;
+	double charge_mAus = 0;
+	double peak_mA = 0;
+	uint64_t first_us = 0, last_us = 0;
+};
+
+class Decoder {
+public:
+	Decoder(bool csv) : csv(csv) {}
+
+	void feed(const uint8_t *p, size_t len)
+	{
+		buf.insert(buf.end(), p, p + len);
+
+		size_t i = 0;
+		while (buf.size() - i >= FRAME_HEAD) {
+			if (buf[i] != FRAME_SYNC0 || buf[i+1] != FRAME_SYNC1) {
+				++i;
+				++st.skipped;
+				continue;
+			}
+			const uint8_t *f = &buf[i];
+			size_t len = frame_len(f);
+			if (buf.size() - i < len)
+				break;		// wait for the rest
+			if (crc16(f+2, len-4, 0) != get16(f+len-2)) {
+				++st.bad;
+				i += 2;		// not a frame after all, or damaged
+				st.skipped += 2;
+				continue;
+			}
+			frame(f);
+			i += len;
+		}
+		buf.erase(buf.begin(), buf.begin() + i);
+	}
+
+	const Stats &stats() const { return st; }
+
+private:
+	static size_t frame_len(const uint8_t *f)
+	{
+		return FRAME_HEAD + f[3] * ((f[2] & 1) ? 6 : 4) + 2;
+	}
+
+	void frame(const uint8_t *f)
+	{
+		bool bus = f[2] & 1;
+		unsigned n = f[3];
+		uint16_t seq = get16(f+4);
+		unsigned divider = f[6] ? f[6] : 1;
+		uint32_t t = get32(f+8);
+		const uint8_t *s = f + FRAME_HEAD;
+
+		if (st.frames > 0)
+			st.lost_frames += (uint16_t)(seq - last_seq - 1);
+		last_seq = seq;
+		st.drops += f[7];
+		++st.frames;
+
+		for (unsigned k = 0; k < n; ++k, s += bus ? 6 : 4) {
+			uint16_t dt = get16(s);
+			int16_t raw = (int16_t)get16(s+2);
+			double mA = (double)raw / divider;
+
+			if (k > 0)
+				t += dt;
+			if (0 == st.samples)
+				st.first_us = now_us = t;
+			else
+				now_us += (uint32_t)(t - (uint32_t)now_us);	// unwrap
+			t = (uint32_t)now_us;
+
+			if (st.samples > 0 && mA > 0)
+				st.charge_mAus += mA * (now_us - st.last_us);
+			if (st.peak_mA < mA)
+				st.peak_mA = mA;
+			st.last_us = now_us;
+			++st.samples;
+
+			if (!csv)
+				continue;
+			if (!header) {
+				printf("t_us,seq,current_mA%s\n", bus ? ",bus_V" : "");
+				header = true;
+			}
+			printf("%llu,%u,%.3f",
+				(unsigned long long)(now_us - st.first_us), seq, mA);
+			if (bus)
+				printf(",%.3f", ((get16(s+4) >> 3) * 4) / 1000.0);
+			printf("\n");
+		}
+	}
+
+	bool csv;
+	bool header = false;
+	std::vector<uint8_t> buf;
+	Stats st;
+	uint16_t last_seq = 0;
+	uint64_t now_us = 0;
+};
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-s] [file]\n", prog);
+	exit(2);
+}
+
+int main(int argc, char *argv[])
+{
+	bool summary = false;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "sh")) != -1) {
+		switch (opt) {
+		case 's': summary = true; break;
+		default: usage(argv[0]);
+		}
+	}
+
+	FILE *in = stdin;
+	if (optind < argc && NULL == (in = fopen(argv[optind], "rb"))) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	Decoder d(!summary);
+
+	uint8_t buf[4096];
+	size_t len;
+	while ((len = fread(buf, 1, sizeof(buf), in)) > 0)
+		d.feed(buf, len);
+
+	const Stats &st = d.stats();
+	double us = st.last_us - st.first_us;
+	fprintf(stderr, "frames %lu (bad %lu, lost %lu), samples %lu, device drops %lu, skipped %lu bytes\n",
+		st.frames, st.bad, st.lost_frames, st.samples, st.drops, st.skipped);
+	if (st.samples > 1)
+		fprintf(stderr, "%.6fs, %.1f samples/s, mean %.3fmA, peak %.3fmA, %.6fmAh\n",
+			us / 1e6, (st.samples - 1) / us * 1e6,
+			st.charge_mAus / us, st.peak_mA, st.charge_mAus / 3600e6);
+
+	return 0;
+}
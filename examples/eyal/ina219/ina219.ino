@@ -18,6 +18,28 @@ Adafruit_INA219 ina219;
 
 #define REPORT_PERIOD_MS  1000   // report every so many ms (0= always)
 
+// Sample on a timer, at the ADC conversion time, rather than as fast as loop() goes.
+// Current only. The timer interrupt paces, loop() reads, integrates and reports.
+#define SAMPLE_STREAM     1
+#if SAMPLE_STREAM
+#define REPORT_BINARY     0       // every sample, framed, see ina219-decode.cpp
+#define BINARY_BUS        0       // also the bus voltage, halves the rate
+#if !REPORT_BINARY
+#undef  BINARY_BUS
+#define BINARY_BUS        0
+#else
+#undef  REPORT_VERY_SHORT
+#define REPORT_VERY_SHORT 0       // nothing else on the line
+#undef  REPORT_FAST
+#define REPORT_FAST       0
+#endif
+#undef  REPORT_CURRENT_ONLY
+#define REPORT_CURRENT_ONLY !BINARY_BUS
+#define SAMPLE_ADC        INA219_CONFIG_SADCRES_12BIT_1S_532US
+#define SAMPLE_US         (532 * (1+BINARY_BUS)) // the conversion time of SAMPLE_ADC (and the bus)
+#define I2C_CLOCK         400000  // a read is then about 100us
+#endif
+
 // getCurrent_mA      is the standard function.
 // getCurrentFast_mA  is faster, does not reset the calibration register.
 // setCalibration_16V_400mA     is the standard function, continuous voltage and current.
@@ -36,6 +58,136 @@ static unsigned long print_next_ms = 0;
 
 static HardwareSerial& serial = Serial1;   // Serial1 when commissioned
 
+#if SAMPLE_STREAM
+// The interrupt only marks that a conversion is done, loop() does the I2C
+// read. Wire is in flash and not reentrant, so it stays out of interrupts.
+static volatile uint32_t ticks      = 0;  // conversions done
+static volatile uint32_t tick_us    = 0;  // micros() at the last one
+static uint32_t          ticks_read = 0;
+static uint32_t          drops      = 0;  // conversions not read, loop() was too slow
+
+static void ICACHE_RAM_ATTR sample_isr(void)
+{
+  tick_us = micros();
+  ++ticks;
+}
+
+// The chip points at the current register, so a sample is just the 2 byte read.
+// Returns the conversions since the last read (0 for none), the ones that were
+// missed are taken to be like this one.
+static uint32_t sample(int16_t *raw, uint32_t *t_us, uint16_t *bus)
+{
+  uint32_t due = ticks;
+  uint32_t n = due - ticks_read;
+
+  if (0 == n)
+    return 0;
+  *t_us = tick_us;
+  drops += n - 1;
+  ticks_read = due;
+
+  *raw = ina219.readStream_raw();
+#if BINARY_BUS
+  ina219.startStream(INA219_REG_BUSVOLTAGE);
+  *bus = ina219.readStream_raw();
+  ina219.startStream(INA219_REG_CURRENT);
+#else
+  *bus = 0;
+#endif
+  return n;
+}
+#endif
+
+#if REPORT_BINARY
+/*
+ * Samples go out in frames, all little endian:
+ *    0 A5 5A     sync
+ *    2 flags     bit0: a bus voltage register in each sample
+ *    3 n         samples
+ *    4 seq       uint16, frame number
+ *    6 divider   raw current per mA
+ *    7 drops     samples lost since the last frame (up to 255)
+ *    8 t_us      uint32, micros() at the first sample
+ *   12 samples   n times: uint16 dt_us (from the previous), int16 current [, uint16 bus]
+ *      crc       uint16, CRC-16 (0xA001) of flags..samples
+ * A gap too long for dt_us starts a new frame.
+ */
+#define FRAME_SYNC0     0xA5
+#define FRAME_SYNC1     0x5A
+#define FRAME_SAMPLES   32
+#define FRAME_HEAD      12
+#define SAMPLE_BYTES    (4 + 2*BINARY_BUS)
+
+static uint8_t  frame[FRAME_HEAD + FRAME_SAMPLES*SAMPLE_BYTES + 2];
+static uint8_t  frame_n = 0;
+static uint16_t frame_seq = 0;
+static uint32_t frame_drops = 0;  // drops at the last frame
+static uint32_t frame_last_us;
+
+static uint8_t *put16(uint8_t *p, uint16_t v)
+{
+  *p++ = v;
+  *p++ = v >> 8;
+  return p;
+}
+
+static uint16_t crc16(const uint8_t *p, int len, uint16_t crc)
+{
+  while (len-- > 0) {
+    crc ^= *p++;
+    for (int i = 0; i < 8; ++i)
+      crc = (crc & 1) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+static void frame_send(void)
+{
+  uint8_t *p = frame + FRAME_HEAD + frame_n*SAMPLE_BYTES;
+  uint32_t lost = drops - frame_drops;
+
+  if (0 == frame_n) return;
+
+  frame[0] = FRAME_SYNC0;
+  frame[1] = FRAME_SYNC1;
+  frame[2] = BINARY_BUS;
+  frame[3] = frame_n;
+  put16(frame+4, frame_seq++);
+  frame[6] = ina219.getCurrentDivider_mA();
+  frame[7] = lost > 255 ? 255 : lost;
+  frame_drops += lost;
+  p = put16(p, crc16(frame+2, p - (frame+2), 0));
+
+  serial.write(frame, p - frame);
+  frame_n = 0;
+}
+
+static void frame_add(uint32_t t_us, int16_t raw, uint16_t bus)
+{
+  uint32_t dt = t_us - frame_last_us;
+
+  if (frame_n > 0 && dt > 0xffff)
+    frame_send();
+  if (0 == frame_n) {
+    frame[8]  = t_us;
+    frame[9]  = t_us >> 8;
+    frame[10] = t_us >> 16;
+    frame[11] = t_us >> 24;
+    dt = 0;
+  }
+  frame_last_us = t_us;
+
+  uint8_t *p = frame + FRAME_HEAD + frame_n*SAMPLE_BYTES;
+  p = put16(p, dt);
+  p = put16(p, raw);
+#if BINARY_BUS
+  p = put16(p, bus);
+#endif
+  if (++frame_n >= FRAME_SAMPLES)
+    frame_send();
+}
+#endif
+
 void setup(void) 
 {
   micros_start = micros();
@@ -58,11 +210,80 @@ void setup(void)
   // Or to use a lower 16V, 400mA range (higher precision on volts and amps):
   ina219.SET_CALIBRATION();
 
+#if SAMPLE_STREAM
+#if REPORT_BINARY
+  serial.println("Binary frames follow");
+#endif
+  Wire.setClock(I2C_CLOCK);
+  ina219.setShuntADC(SAMPLE_ADC);
+  ina219.startStream(INA219_REG_CURRENT);
+
+  timer1_attachInterrupt(sample_isr);
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+  timer1_write(SAMPLE_US * (80 / 16));  // 5 ticks/us
+#endif
+
   serial.println("Measuring voltage and current with INA219 ...");
 
   print_next_ms = millis();
 }
 
+#if SAMPLE_STREAM
+void loop(void)
+{
+  static uint32_t count     = 0;    // samples, each SAMPLE_US long
+  static uint32_t old_count = 0;
+  static int64_t  charge    = 0;    // sum of raw samples, charge is charge*SAMPLE_US/divider [mA us]
+  static int64_t  old_charge = 0;
+  static int16_t  peak      = 0;    // in this report period
+  int16_t  raw;
+  uint32_t t_us;
+  uint16_t bus;
+  uint32_t nticks;
+
+  if ((nticks = sample(&raw, &t_us, &bus)) > 0) {
+#if REPORT_BINARY
+    frame_add(t_us, raw, bus);
+#endif
+
+    if (raw < 0) raw = 0;
+    charge += (int64_t)raw * nticks;     // the missed intervals count too, count is the clock
+    if (peak < raw) peak = raw;
+    count += nticks;
+
+#if REPORT_FAST     // will drop samples, serial is too slow for this
+    serial.print(count); serial.print(" "); serial.println(raw);
+#endif
+  }
+
+  if (millis() >= print_next_ms) {
+    print_next_ms += REPORT_PERIOD_MS;
+    ina219.reCalibrate();           // this moves the register pointer
+    ina219.startStream(INA219_REG_CURRENT);
+
+#if REPORT_VERY_SHORT
+    uint32_t divider = ina219.getCurrentDivider_mA();
+    uint64_t now_us = (uint64_t)count * SAMPLE_US;
+    uint32_t n = count - old_count;
+    char str[100];
+
+    sprintf (str, "%lu.%06lu %lu %.3f - %.3fmA max %.3fmA drops %lu",
+      (unsigned long)(now_us / 1000000), (unsigned long)(now_us % 1000000),
+      n,
+      (double)charge * SAMPLE_US / divider / HOUR_US,     // mAh
+      n ? (double)(charge - old_charge) / n / divider : 0.0,
+      (double)peak / divider,
+      drops);
+    serial.println(str);
+#endif
+
+    old_count = count;
+    old_charge = charge;
+    peak = 0;
+  }
+}
+#else
+
 void loop(void) 
 {
   unsigned long micros_now;         // micros()
@@ -207,3 +428,4 @@ void loop(void)
   serial.print(now_us); serial.print(" "); serial.println(current_mA);
 #endif
 }
+#endif // SAMPLE_STREAM
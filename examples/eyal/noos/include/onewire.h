@@ -26,8 +26,9 @@
 // Select the table-lookup method of computing the 8-bit CRC
 // by setting this to 1.  The lookup table enlarges code size by
 // about 250 bytes.  It does NOT consume RAM (but did in very
-// old versions of OneWire).  If you disable this, a slower
-// but very compact algorithm is used.
+// old versions of OneWire).  If you set it to 0, a slower
+// but very compact algorithm is used.  2 looks up half a byte
+// at a time in a 16 byte table, most of the speed for little space.
 #ifndef ONEWIRE_CRC8_TABLE
 #define ONEWIRE_CRC8_TABLE 0
 #endif
@@ -38,6 +39,24 @@
 #define ONEWIRE_CRC16 1
 #endif
 
+// The 16-bit CRC uses a parity trick (0) or a 32 byte table (2).
+#ifndef ONEWIRE_CRC16_TABLE
+#define ONEWIRE_CRC16_TABLE 0
+#endif
+
+// You can drive several buses in lockstep (onewire_multi_*) by
+// defining this to 1.  A slot on all of them takes as long as on one.
+#ifndef ONEWIRE_MULTI
+#define ONEWIRE_MULTI 0
+#endif
+#define ONEWIRE_MULTI_MAX 8	// buses
+
+// You can run a transaction in the background, on FRC1 interrupts
+// (onewire_async), by defining this to 1.
+#ifndef ONEWIRE_ASYNC
+#define ONEWIRE_ASYNC 0
+#endif
+
 // Platform specific I/O definitions
 
 #define DIRECT_READ(pin)         (0x1 & GPIO_INPUT_GET(GPIO_ID_PIN(pin_num[pin])))
@@ -86,6 +105,44 @@ void onewire_read_bytes(uint8_t pin, uint8_t *buf, uint16_t count);
 // someone shorts your bus.
 void onewire_depower(uint8_t pin);
 
+#if ONEWIRE_MULTI
+// Buses driven together, one per pin, not GPIO16.  Bus i is the i'th pin
+// given to onewire_multi_init(), the data for it is v[i] (or rom[i]).
+typedef struct {
+	uint8_t  n;
+	uint16_t bit[ONEWIRE_MULTI_MAX];	// GPIO bit of each bus
+	uint16_t all;
+} onewire_multi_t;
+
+// Returns 0 if a pin cannot be used.
+uint8_t onewire_multi_init(onewire_multi_t *ow, const uint8_t *pins, uint8_t n);
+
+// Returns a bit (1 << i) for each bus with a presence pulse.
+// A bus whose wire stays low is dropped from 'all' and not driven again.
+uint8_t onewire_multi_reset(onewire_multi_t *ow);
+
+void onewire_multi_select(const onewire_multi_t *ow, const uint8_t rom[][8]);
+void onewire_multi_write(const onewire_multi_t *ow, const uint8_t *v, uint8_t power);
+void onewire_multi_write_all(const onewire_multi_t *ow, uint8_t v, uint8_t power);
+void onewire_multi_read(const onewire_multi_t *ow, uint8_t *v);
+void onewire_multi_depower(const onewire_multi_t *ow);
+#endif
+
+#if ONEWIRE_ASYNC
+// 'present' is 0 if no device answered the reset, then nothing was sent.
+typedef void (*onewire_done_t)(uint8_t present, void *arg);
+
+// A reset, then 'ntx' bytes written from 'tx' and 'nrx' read into 'rx',
+// all done on FRC1 interrupts. Returns at once, 0 if it could not start
+// (busy, GPIO16, the bus is held low). 'done' is called later from a task.
+// 'tx' and 'rx' must stay until then. 'power' as in onewire_write().
+uint8_t onewire_async(uint8_t pin, const uint8_t *tx, uint8_t ntx,
+	uint8_t *rx, uint8_t nrx, uint8_t power,
+	onewire_done_t done, void *arg);
+
+uint8_t onewire_async_busy(void);
+#endif
+
 #if ONEWIRE_SEARCH
 // Clear the search state so that if will start from the beginning again.
 void onewire_reset_search(uint8_t pin);
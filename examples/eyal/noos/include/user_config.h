@@ -20,9 +20,17 @@ do { \
 	os_printf(__VA_ARGS__); \
 } while (0)
 
+#define OW_MAX_BUSES	4		// not more than ONEWIRE_MULTI_MAX
+#define OW_NO_BUS	255		// ends ow_buses
+#define OW_NO_BUSES	{OW_NO_BUS}	// one bus, on ow_pin
+
+#define ENV_MAX_OW	8		// ow_addrs, with the OW_EOL
+#define ENV_LED_OFF	0x01		// flags: turn off the colour LED (witty)
+
+// fixed size, it is kept in flash and in RTC memory
 typedef struct {
 	uint8		clientMAC[6];
-	char *		clientID;
+	char		clientID[16];
 	uint8		clientIP[4];
 	uint8		gateway[4];
 	uint8		netmask[4];
@@ -32,18 +40,37 @@ typedef struct {
 	float		sleep_rate;
 	float		adc_factor;
 	float		vdd_factor;
-	char *		read_device;
+	char		read_device[12];
 	uint8		i2c_SCL;
 	uint8		i2c_SDA;
 	uint8		ow_pin;
-	uint8		(*init_func) (void);
-	uint8		ow_addrs[][8];
+	uint8		ow_buses[OW_MAX_BUSES];	// GPIOs read in lockstep, ow_addrs[i] on bus i
+	uint8		flags;		// ENV_*
+	uint8		ow_addrs[ENV_MAX_OW][8];
 } env_t;
 
+#define ENV_MAGIC	0x454e5631	// "ENV1"
+#define ENV_VERSION	1		// bump when env_t changes
+#define ENV_SECTOR	0x3C		// user data, below irom0 at 0x40000 (check your map)
+#define ENV_RTCMEM_ADDR	72		// after the RTCMEM_* words in user_main.c
+
+typedef struct {
+	uint32		magic;
+	uint16		version;
+	uint16		crc;		// of env
+	env_t		env;
+} env_rec_t;
+
 /* ds18b20.c */
 #define BAD_RET		0x7fffffff
+#define DS18B20_RESOLUTION	12	// bits, 9 (0.5C) to 12 (0.0625C)
 extern uint8		ds18b20_setup(uint8 ow_pin);
 extern sint32		ds18b20_read(const uint8 *ow_addr);
+extern uint8		ds18b20_set_resolution(const uint8 *ow_addr, uint8 bits);
+extern uint32		ds18b20_conversion_ms(uint8 bits);
+extern uint8		ds18b20_multi_setup(const uint8 *gpios);
+extern uint8		ds18b20_read_async(uint8 pin, const uint8 *ow_addr, void (*done)(sint32 t));
+extern uint8		ds18b20_multi_read(const uint8 ow_addrs[][8], sint32 *t);
 
 /* env.c */
 extern const env_t	*env;
@@ -46,6 +46,49 @@ get_scratchpad(const uint8 *ow_addr)
 	return scratchpad;
 }
 
+// 9 to 12 bits, the EEPROM is written only when it changes
+uint8
+ds18b20_set_resolution(const uint8 *ow_addr, uint8 bits)
+{
+	uint8		*data;
+	uint8		buf[3];
+
+	if (bits < 9 || bits > 12) {
+		errPrintf("%s bad resolution %d\n", ds_msg, bits);
+		return 0;
+	}
+
+	if (NULL == (ow_addr = addr_check (ow_addr))) return 0;
+	if (0x28 != ow_addr[0]) return 1;	// DS18S20 has no choice
+
+	if (NULL == (data = get_scratchpad(ow_addr))) return 0;
+	buf[0] = data[2];			// keep TH and TL
+	buf[1] = data[3];
+	buf[2] = ((bits - 9) << 5) | 0x1F;
+	if (buf[2] == data[4]) return 1;
+
+	if (!onewire_reset(ow_pin)) return 0;
+	onewire_select(ow_pin, ow_addr);
+	onewire_write(ow_pin, 0x4E, 1);	// WRITE SCRATCHPAD
+	onewire_write_bytes(ow_pin, buf, 3, 1);
+
+	if (!onewire_reset(ow_pin)) return 0;
+	onewire_select(ow_pin, ow_addr);
+	onewire_write(ow_pin, 0x48, 1);	// COPY SCRATCHPAD
+	os_delay_us(10000);		// EEPROM write
+
+	return 1;
+}
+
+// worst case, rounded up: 94, 188, 375, 750
+uint32
+ds18b20_conversion_ms(uint8 bits)
+{
+	if (bits < 9 || bits > 12) bits = 12;
+
+	return ((750000 >> (12 - bits)) + 999) / 1000;
+}
+
 static uint8
 convert_t(const uint8 *ow_addr)
 {
@@ -56,6 +99,33 @@ convert_t(const uint8 *ow_addr)
 	return 1;
 }
 
+// 1/10000 C per LSB, 0 if unknown
+static sint32
+get_frac(const uint8 *ow_addr)
+{
+	switch (ow_addr[0]) {
+	case 0x28:
+		return 10000/16;	// DS18B20, 4 fractional bits
+	case 0x10:
+		return 10000/2;		// DS18S20, 1 fractional bit
+	default:
+		errPrintf("%s unkown device %x\n", ds_msg, ow_addr[0]);
+		return 0;
+	}
+}
+
+// The raw reading, without the low bits that are undefined below 12 bits
+static sint16
+get_raw(uint8 family, const uint8 *ds)
+{
+	sint16		t = (sint16)(ds[0] | ds[1]<<8);
+
+	if (0x28 == family)	// DS18B20, resolution in the config register
+		t &= ~((1 << (3 - ((ds[4] >> 5) & 3))) - 1);
+
+	return t;
+}
+
 sint32	// fixed point, 4 decimal fractions
 ds18b20_read(const uint8 *ow_addr)
 {
@@ -70,22 +140,173 @@ ds18b20_read(const uint8 *ow_addr)
 
 	if (NULL == (ow_addr = addr_check (ow_addr))) return BAD_RET;
 
-	switch (ow_addr[0]) {
-	case 0x28:
-		frac = 10000/16;	// DS18B20, 4 fractional bits
-		break;
-	case 0x10:
-		frac = 10000/2;		// DS18S20, 1 fractional bit
-		break;
-	default:
-		errPrintf("%s unkown device %x\n", ds_msg, ow_addr[0]);
-		return BAD_RET;
-	}
+	if (0 == (frac = get_frac(ow_addr))) return BAD_RET;
 
 	if (NULL == (data = get_scratchpad(ow_addr))) return BAD_RET;
 
 	(void)convert_t(ow_addr);	// start next conversion
 
-	t = frac * (sint16)(data[0] | data[1]<<8);
+	t = frac * get_raw(ow_addr[0], data);
 	return t == 850000 ? BAD_RET : t;
 }
+
+#if ONEWIRE_ASYNC
+/*
+ * ds18b20_read() in the background. The scratchpad is read, then the next
+ * conversion started, and 'done' gets the temperature (or BAD_RET).
+ */
+
+static struct {
+	uint8		cmd[10];	// MATCH ROM, address, command
+	uint8		scratchpad[9];
+	sint32		frac;
+	uint8		family;
+	sint32		t;
+	void		(*done)(sint32 t);
+} rd;
+
+static void
+converting(uint8 present, void *arg)
+{
+	rd.done(rd.t);
+}
+
+static void
+have_scratchpad(uint8 present, void *arg)
+{
+	const uint8	*ds = rd.scratchpad;
+
+	rd.t = BAD_RET;
+	if (!present) {
+		errPrintf("%s no presence\n", ds_msg);
+		rd.done(rd.t);
+		return;
+	}
+	if (onewire_crc8(ds, 9))
+		errPrintf("%s bad scratchpad crc8\n", ds_msg);
+	else {
+		rd.t = rd.frac * get_raw(rd.family, ds);
+		if (rd.t == 850000)
+			rd.t = BAD_RET;
+	}
+
+	rd.cmd[9] = 0x44;	// CONVERT T, start next conversion
+	if (!onewire_async(ow_pin, rd.cmd, 10, NULL, 0, 1, converting, NULL))
+		rd.done(rd.t);
+}
+
+// Returns 0 if it did not start, else 'done' will be called
+uint8
+ds18b20_read_async(uint8 pin, const uint8 *ow_addr, void (*done)(sint32 t))
+{
+	if (pin > 16)
+		return 0;
+	if (onewire_async_busy())
+		return 0;
+	if (NULL == (ow_addr = addr_check (ow_addr))) return 0;
+	if (0 == (rd.frac = get_frac(ow_addr))) return 0;
+	rd.family = ow_addr[0];
+
+	if (ow_pin != gpio_num[pin]) {
+		ow_pin = gpio_num[pin];
+		onewire_init(ow_pin);
+	}
+
+	rd.done = done;
+	rd.cmd[0] = 0x55;	// MATCH ROM
+	os_memcpy(rd.cmd+1, ow_addr, 8);
+	rd.cmd[9] = 0xBE;	// READ SCRATCHPAD
+
+	return onewire_async(ow_pin, rd.cmd, 10, rd.scratchpad, 9, 1,
+		have_scratchpad, NULL);
+}
+#endif
+
+#if ONEWIRE_MULTI
+/*
+ * One device on each of a few buses, read in lockstep.
+ */
+
+static onewire_multi_t	ow_multi;
+
+// 'gpios' ends at OW_NO_BUS, returns the number of buses
+uint8
+ds18b20_multi_setup(const uint8 *gpios)
+{
+	uint8		pins[ONEWIRE_MULTI_MAX];
+	uint8		present;
+	uint8		n;
+
+	for (n = 0; n < OW_MAX_BUSES && OW_NO_BUS != gpios[n]; ++n) {
+		if (gpios[n] > 16)
+			return 0;
+		pins[n] = gpio_num[gpios[n]];
+	}
+	if (0 == n || !onewire_multi_init(&ow_multi, pins, n))
+		return 0;
+	if (0 == (present = onewire_multi_reset(&ow_multi)))
+		return 0;
+	if (present != (1 << n) - 1)	// the others read as BAD_RET
+		errPrintf("%s no presence on buses %x\n", ds_msg,
+			((1 << n) - 1) & ~present);
+
+	return n;
+}
+
+// t[i] from ow_addrs[i] on bus i, BAD_RET if it failed.
+// Returns how many were good. The next conversion is started.
+uint8
+ds18b20_multi_read(const uint8 ow_addrs[][8], sint32 *t)
+{
+	uint8		data[ONEWIRE_MULTI_MAX];
+	uint8		scratchpad[ONEWIRE_MULTI_MAX][9];
+	uint8		present;
+	uint8		good = 0;
+	uint8		i, j;
+
+	if (0 == ow_multi.n) {
+		errPrintf("%s onewire buses not set\n", ds_msg);
+		return 0;
+	}
+
+	present = onewire_multi_reset(&ow_multi);
+	if (present) {
+		onewire_multi_select(&ow_multi, ow_addrs);
+		onewire_multi_write_all(&ow_multi, 0xBE, 1);	// READ SCRATCHPAD
+		for (j = 0; j < 9; ++j) {
+			onewire_multi_read(&ow_multi, data);
+			for (i = 0; i < ow_multi.n; ++i)
+				scratchpad[i][j] = data[i];
+		}
+
+		if (onewire_multi_reset(&ow_multi)) {	// start next conversion
+			onewire_multi_select(&ow_multi, ow_addrs);
+			onewire_multi_write_all(&ow_multi, 0x44, 1);	// CONVERT T
+		}
+	}
+
+	for (i = 0; i < ow_multi.n; ++i) {
+		const uint8	*ds = scratchpad[i];
+		sint32		frac;
+
+		t[i] = BAD_RET;
+		if (!(present & (1 << i)))
+			continue;
+		if (NULL == addr_check (ow_addrs[i]))
+			continue;
+		if (0 == (frac = get_frac(ow_addrs[i])))
+			continue;
+		if (onewire_crc8(ds, 9)) {
+			errPrintf("%s bad scratchpad crc8 on bus %d\n", ds_msg, i);
+			continue;
+		}
+		t[i] = frac * get_raw(ow_addrs[i][0], ds);
+		if (t[i] == 850000)
+			t[i] = BAD_RET;
+		else
+			++good;
+	}
+
+	return good;
+}
+#endif
@@ -1,4 +1,6 @@
 #include "user_config.h"
+#include "onewire.h"		// onewire_crc16()
+#include <spi_flash.h>
 
 #define OW_EOL	{255,255,255,255,255,255,255,255}
 
@@ -17,7 +19,8 @@ static const env_t env_esp_07b = {
 	"ds18b20",				// read_device
 	-1, -1,					// i2c_SCL, i2c_SDA
 	4,					// ow_pin
-	NULL,					// init_func
+	OW_NO_BUSES,				// ow_buses, or {4,5,12,OW_NO_BUS}
+	0,					// flags
 	{					// ow_addrs
 		{ 40,255,157,227,  0, 21,  3, 35},	// #1 low
 		{ 40,255, 57,229,  0, 21,  3,  6},	// #2 mid
@@ -42,7 +45,8 @@ static const env_t env_esp_12f = {
 	"ds18b20",
 	-1, -1,
 	4,
-	NULL,
+	OW_NO_BUSES,
+	0,
 	{
 		{ 40, 24,158,118,  6,  0,  0,129},
 		OW_EOL
@@ -64,7 +68,8 @@ static const env_t env_esp_witty = {
 	"ds18b20",
 	-1, -1,
 	4,
-	NULL,
+	OW_NO_BUSES,
+	ENV_LED_OFF,
 	{
 		OW_EOL
 	}
@@ -85,7 +90,8 @@ static const env_t env_esp_201 = {
 	"ds18b20",
 	-1, -1,
 	4,
-	NULL,
+	OW_NO_BUSES,
+	0,
 	{
 		{ 40, 24,158,118,  6,  0,  0,129},
 		OW_EOL
@@ -107,7 +113,8 @@ static const env_t env_esp_test = {
 	"ds18b20",
 	-1, -1,
 	4,
-	NULL,
+	OW_NO_BUSES,
+	0,
 	{
 		OW_EOL
 	}
@@ -122,27 +129,95 @@ static const env_t *envs[] = {
 };
 
 const env_t	*env = NULL;
+static env_rec_t	rec;		// what env points to
 
-int
-setup_env (void)
+static uint16
+env_crc (const env_rec_t *r)
+{
+	return onewire_crc16((const uint8_t *)&r->env, sizeof(r->env), 0);
+}
+
+static int
+env_good (const env_rec_t *r)
+{
+	return ENV_MAGIC == r->magic
+	    && ENV_VERSION == r->version
+	    && env_crc(r) == r->crc;
+}
+
+// the built in entry for this board, NULL if there is none
+static const env_t *
+env_builtin (void)
 {
 	uint8		mac[6];
 	int		i;
 
 	wifi_get_macaddr(STATION_IF, mac);
 
-	for (i = 0;; ++i) {
-		env = envs[i];
-		if (NULL == env) {
+	for (i = 0; NULL != envs[i]; ++i)
+		if (!memcmp (mac, envs[i]->clientMAC, sizeof(mac)))
+			return envs[i];
+
+	return NULL;
+}
+
+static void
+env_set (const env_t *e)
+{
+	os_memset(&rec, 0, sizeof(rec));
+	rec.magic = ENV_MAGIC;
+	rec.version = ENV_VERSION;
+	os_memcpy(&rec.env, e, sizeof(rec.env));
+	rec.crc = env_crc(&rec);
+}
+
+static int
+env_store (void)
+{
+	if (SPI_FLASH_RESULT_OK != spi_flash_erase_sector(ENV_SECTOR))
+		return 0;
+	return SPI_FLASH_RESULT_OK == spi_flash_write(ENV_SECTOR * SPI_FLASH_SEC_SIZE,
+		(uint32 *)&rec, sizeof(rec));
+}
+
+// A deep sleep wake uses the copy in RTC memory, a cold start reads the
+// flash sector. The record is (re)written when it is missing, or when the
+// built in entry for this board's MAC was edited since it was stored.
+int
+setup_env (void)
+{
+	const env_t	*e;
+
+	if (REASON_DEEP_SLEEP_AWAKE == system_get_rst_info()->reason) {
+		system_rtc_mem_read (ENV_RTCMEM_ADDR, &rec, sizeof(rec));
+		if (env_good(&rec))
+			goto found;
+	}
+
+	e = env_builtin();
+	if (SPI_FLASH_RESULT_OK != spi_flash_read(ENV_SECTOR * SPI_FLASH_SEC_SIZE,
+			(uint32 *)&rec, sizeof(rec))
+	    || !env_good(&rec)) {
+		if (NULL == e) {
+			env_set(&env_esp_test);
 //			os_printf("setup_env failed\n");
-			env = &env_esp_test;
+			env = &rec.env;
 			return 0;	// failure
 		}
-		if (!memcmp (mac, env->clientMAC, sizeof(mac)))
-			break;	// success
+		env_set(e);
+		if (!env_store())
+			errPrintf("env: flash write failed\n");
+	} else if (NULL != e && os_memcmp(&rec.env, e, sizeof(rec.env))) {
+		env_set(e);
+		if (!env_store())
+			errPrintf("env: flash write failed\n");
 	}
+	system_rtc_mem_write (ENV_RTCMEM_ADDR, &rec, sizeof(rec));
+
+found:
+	env = &rec.env;
 
-	if (env == &env_esp_witty) {	// turn off colour LED
+	if (env->flags & ENV_LED_OFF) {	// turn off colour LED
 		pin_config(12, PLATFORM_GPIO_OUTPUT, PLATFORM_GPIO_LOW);
 		pin_config(13, PLATFORM_GPIO_OUTPUT, PLATFORM_GPIO_LOW);
 		pin_config(15, PLATFORM_GPIO_OUTPUT, PLATFORM_GPIO_LOW);
@@ -243,6 +243,175 @@ void onewire_depower(uint8_t pin)
 	interrupts();
 }
 
+#if ONEWIRE_MULTI
+//
+// Several buses in lockstep. Each slot is done on all the pins at once
+// through the W1TS/W1TC registers, and a read slot samples them all in
+// one read of GPIO_IN. The timing is the same as above.
+//
+#define MULTI_LOW(m)	GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, (m))
+#define MULTI_HIGH(m)	GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, (m))
+#define MULTI_OUTPUT(m)	GPIO_REG_WRITE(GPIO_ENABLE_W1TS_ADDRESS, (m))
+#define MULTI_INPUT(m)	GPIO_REG_WRITE(GPIO_ENABLE_W1TC_ADDRESS, (m))
+#define MULTI_READ()	GPIO_REG_READ(GPIO_IN_ADDRESS)
+
+// Returns 0 if a pin is GPIO16 or there are too many.
+uint8_t onewire_multi_init(onewire_multi_t *ow, const uint8_t *pins, uint8_t n)
+{
+	uint8_t i;
+
+	if (n > ONEWIRE_MULTI_MAX)
+		return 0;
+
+	ow->n = n;
+	ow->all = 0;
+	for (i = 0; i < n; i++) {
+		if (pins[i] >= NUM_OW || pin_num[pins[i]] > 15)
+			return 0;
+		onewire_init(pins[i]);
+		ow->bit[i] = BIT(pin_num[pins[i]]);
+		ow->all |= ow->bit[i];
+	}
+	return 1;
+}
+
+// Returns a bit per bus (1 << i) that had a presence pulse.
+// A stuck bus is dropped, the others carry on.
+uint8_t onewire_multi_reset(onewire_multi_t *ow)
+{
+	uint32_t in;
+	uint8_t r = 0;
+	uint8_t retries = 125;
+	uint8_t i;
+
+	noInterrupts();
+	MULTI_INPUT(ow->all);
+	interrupts();
+	// wait until the wires are high... just in case
+	while ((in = MULTI_READ() & ow->all) != ow->all) {
+		if (--retries == 0) {
+			ow->all = in;	// the ones still low are stuck
+			break;
+		}
+		delayMicroseconds(2);
+	}
+	if (0 == ow->all) return 0;
+
+	noInterrupts();
+	MULTI_LOW(ow->all);
+	MULTI_OUTPUT(ow->all);	// drive output low
+	interrupts();
+	delayMicroseconds(480);
+	noInterrupts();
+	MULTI_INPUT(ow->all);	// allow it to float
+	delayMicroseconds(70);
+	in = MULTI_READ();
+	interrupts();
+	delayMicroseconds(410);
+
+	for (i = 0; i < ow->n; i++)
+		if ((ow->all & ow->bit[i]) && !(in & ow->bit[i])) r |= 1 << i;
+	return r;
+}
+
+// The pins in 'ones' write a 1, the others a 0.
+static void onewire_multi_write_bit(const onewire_multi_t *ow, uint16_t ones)
+{
+	noInterrupts();
+	MULTI_LOW(ow->all);
+	MULTI_OUTPUT(ow->all);	// drive output low
+	delayMicroseconds(10);
+	MULTI_HIGH(ones);	// the 1s end here
+	interrupts();
+	delayMicroseconds(55);	// a longer 0 is still a 0
+	MULTI_HIGH(ow->all);
+	delayMicroseconds(5);
+}
+
+static uint32_t onewire_multi_read_bit(const onewire_multi_t *ow)
+{
+	uint32_t r;
+
+	noInterrupts();
+	MULTI_LOW(ow->all);
+	MULTI_OUTPUT(ow->all);
+	delayMicroseconds(3);
+	MULTI_INPUT(ow->all);	// let pin float, pull up will raise
+	delayMicroseconds(10);
+	r = MULTI_READ();
+	interrupts();
+	delayMicroseconds(53);
+	return r;
+}
+
+// v[i] goes to bus i
+void onewire_multi_write(const onewire_multi_t *ow, const uint8_t *v, uint8_t power)
+{
+	uint8_t bitMask;
+	uint8_t i;
+
+	for (bitMask = 0x01; bitMask; bitMask <<= 1) {
+		uint16_t ones = 0;
+
+		for (i = 0; i < ow->n; i++)
+			if (v[i] & bitMask) ones |= ow->bit[i];
+		onewire_multi_write_bit(ow, ones);
+	}
+	if (!power) {
+		noInterrupts();
+		MULTI_INPUT(ow->all);
+		MULTI_LOW(ow->all);
+		interrupts();
+	}
+}
+
+// The same byte to all buses
+void onewire_multi_write_all(const onewire_multi_t *ow, uint8_t v, uint8_t power)
+{
+	uint8_t buf[ONEWIRE_MULTI_MAX];
+
+	os_memset(buf, v, sizeof(buf));
+	onewire_multi_write(ow, buf, power);
+}
+
+// v[i] is read from bus i
+void onewire_multi_read(const onewire_multi_t *ow, uint8_t *v)
+{
+	uint8_t bitMask;
+	uint8_t i;
+
+	os_memset(v, 0, ow->n);
+	for (bitMask = 0x01; bitMask; bitMask <<= 1) {
+		uint32_t in = onewire_multi_read_bit(ow);
+
+		for (i = 0; i < ow->n; i++)
+			if (in & ow->bit[i]) v[i] |= bitMask;
+	}
+}
+
+// rom[i] on bus i
+void onewire_multi_select(const onewire_multi_t *ow, const uint8_t rom[][8])
+{
+	uint8_t buf[ONEWIRE_MULTI_MAX];
+	uint8_t i, j;
+
+	onewire_multi_write_all(ow, 0x55, owDefaultPower);	// Choose ROM
+
+	for (j = 0; j < 8; j++) {
+		for (i = 0; i < ow->n; i++)
+			buf[i] = rom[i][j];
+		onewire_multi_write(ow, buf, owDefaultPower);
+	}
+}
+
+void onewire_multi_depower(const onewire_multi_t *ow)
+{
+	noInterrupts();
+	MULTI_INPUT(ow->all);
+	interrupts();
+}
+#endif
+
 #if ONEWIRE_SEARCH
 
 //
@@ -425,37 +594,31 @@ uint8_t onewire_search(uint8_t pin, uint8_t *newAddr)
 // "Understanding and Using Cyclic Redundancy Checks with Maxim iButton Products"
 //
 
-#if ONEWIRE_CRC8_TABLE
-// This table comes from Dallas sample code where it is freely reusable,
-// though Copyright (C) 2000 Dallas Semiconductor Corporation
-static const uint8_t dscrc_table[] = {
-      0, 94,188,226, 97, 63,221,131,194,156,126, 32,163,253, 31, 65,
-    157,195, 33,127,252,162, 64, 30, 95,  1,227,189, 62, 96,130,220,
-     35,125,159,193, 66, 28,254,160,225,191, 93,  3,128,222, 60, 98,
-    190,224,  2, 92,223,129, 99, 61,124, 34,192,158, 29, 67,161,255,
-     70, 24,250,164, 39,121,155,197,132,218, 56,102,229,187, 89,  7,
-    219,133,103, 57,186,228,  6, 88, 25, 71,165,251,120, 38,196,154,
-    101, 59,217,135,  4, 90,184,230,167,249, 27, 69,198,152,122, 36,
-    248,166, 68, 26,153,199, 37,123, 58,100,134,216, 91,  5,231,185,
-    140,210, 48,110,237,179, 81, 15, 78, 16,242,172, 47,113,147,205,
-     17, 79,173,243,112, 46,204,146,211,141,111, 49,178,236, 14, 80,
-    175,241, 19, 77,206,144,114, 44,109, 51,209,143, 12, 82,176,238,
-     50,108,142,208, 83, 13,239,177,240,174, 76, 18,145,207, 45,115,
-    202,148,118, 40,171,245, 23, 73,  8, 86,180,234,105, 55,213,139,
-     87,  9,235,181, 54,104,138,212,149,203, 41,119,244,170, 72, 22,
-    233,183, 85, 11,136,214, 52,106, 43,117,151,201, 74, 20,246,168,
-    116, 42,200,150, 21, 75,169,247,182,232, 10, 84,215,137,107, 53};
-
 #ifndef pgm_read_byte
 #define pgm_read_byte(addr) (*(const uint8_t *)(addr))
 #endif
 
+// The tables are generated by the compiler from the polynomial.
+// One step of a reflected CRC, the next data bit is already in bit 0.
+#define CRC8_1(c)	(((c) >> 1) ^ (((c) & 1) ? 0x8C : 0))	// x^8+x^5+x^4+1
+#define CRC8_4(c)	CRC8_1(CRC8_1(CRC8_1(CRC8_1(c))))
+#define CRC8_8(c)	CRC8_4(CRC8_4(c))
+
+#define CRC16_1(c)	(((c) >> 1) ^ (((c) & 1) ? 0xA001 : 0))	// x^16+x^15+x^2+1
+#define CRC16_4(c)	CRC16_1(CRC16_1(CRC16_1(CRC16_1(c))))
+
+#define T4(f,i)		f(i), f((i)+1), f((i)+2), f((i)+3)
+#define T16(f,i)	T4(f,i), T4(f,(i)+4), T4(f,(i)+8), T4(f,(i)+12)
+#define T64(f,i)	T16(f,i), T16(f,(i)+16), T16(f,(i)+32), T16(f,(i)+48)
+#define T256(f,i)	T64(f,i), T64(f,(i)+64), T64(f,(i)+128), T64(f,(i)+192)
+
+#if ONEWIRE_CRC8_TABLE == 1
+// Same as the table in the Dallas sample code.
+static const uint8_t dscrc_table[256] = { T256(CRC8_8, 0) };
+
 //
 // Compute a Dallas Semiconductor 8 bit CRC. These show up in the ROM
-// and the registers.  (note: this might better be done without to
-// table, it would probably be smaller and certainly fast enough
-// compared to all those delayMicrosecond() calls.  But I got
-// confused, so I use this table from the examples.)
+// and the registers.
 //
 uint8_t onewire_crc8(const uint8_t *addr, uint8_t len)
 {
@@ -466,6 +629,23 @@ uint8_t onewire_crc8(const uint8_t *addr, uint8_t len)
 	}
 	return crc;
 }
+#elif ONEWIRE_CRC8_TABLE == 2
+static const uint8_t dscrc_nibble[16] = { T16(CRC8_4, 0) };
+
+//
+// Half a byte at a time, a 16 byte table.
+//
+uint8_t onewire_crc8(const uint8_t *addr, uint8_t len)
+{
+	uint8_t crc = 0;
+
+	while (len--) {
+		crc ^= *addr++;
+		crc = (crc >> 4) ^ pgm_read_byte(dscrc_nibble + (crc & 0x0F));
+		crc = (crc >> 4) ^ pgm_read_byte(dscrc_nibble + (crc & 0x0F));
+	}
+	return crc;
+}
 #else
 //
 // Compute a Dallas Semiconductor 8 bit CRC directly.
@@ -528,6 +708,19 @@ bool onewire_check_crc16(const uint8_t* input, uint16_t len, const uint8_t* inve
 // @param len - How many bytes to use.
 // @param crc - The crc starting value (optional)
 // @return The CRC16, as defined by Dallas Semiconductor.
+#if ONEWIRE_CRC16_TABLE == 2
+uint16_t onewire_crc16(const uint8_t* input, uint16_t len, uint16_t crc)
+{
+    static const uint16_t crc16_nibble[16] = { T16(CRC16_4, 0) };
+
+    while (len--) {
+      crc ^= *input++;
+      crc = (crc >> 4) ^ crc16_nibble[crc & 0x0F];
+      crc = (crc >> 4) ^ crc16_nibble[crc & 0x0F];
+    }
+    return crc;
+}
+#else
 uint16_t onewire_crc16(const uint8_t* input, uint16_t len, uint16_t crc)
 {
     static const uint8_t oddparity[16] =
@@ -552,5 +745,6 @@ uint16_t onewire_crc16(const uint8_t* input, uint16_t len, uint16_t crc)
     return crc;
 }
 #endif
+#endif
 
 #endif
@@ -0,0 +1,204 @@
+/*
+ * 1-Wire in the background.
+ *
+ * A transaction (reset, bytes written, bytes read) is cut into steps, each
+ * one started from the FRC1 timer interrupt. Only the short, timing critical
+ * part of a slot (the low pulse, the sample) is done in the interrupt, the
+ * long parts (the 480us reset, the rest of each slot) are the timer running.
+ * The SDK and WiFi run in between, nothing waits in a loop.
+ *
+ * When done, 'done' is called from a task (not the interrupt).
+ *
+ * Only one transaction at a time, FRC1 is ours (do not use the SDK pwm or
+ * hw_timer with this).
+ */
+
+#include "user_config.h"
+#include "onewire.h"
+
+#if ONEWIRE_ASYNC
+
+#define OW_TASK_PRIO	USER_TASK_PRIO_1
+
+#define FRC1_DIV_16	4		// 80MHz / 16
+#define FRC1_ENABLE	BIT7
+#define FRC1_TICKS(us)	((us) * 5)
+
+#define OW_LOW(m)	GPIO_REG_WRITE(GPIO_OUT_W1TC_ADDRESS, (m))
+#define OW_HIGH(m)	GPIO_REG_WRITE(GPIO_OUT_W1TS_ADDRESS, (m))
+#define OW_OUTPUT(m)	GPIO_REG_WRITE(GPIO_ENABLE_W1TS_ADDRESS, (m))
+#define OW_INPUT(m)	GPIO_REG_WRITE(GPIO_ENABLE_W1TC_ADDRESS, (m))
+#define OW_READ(m)	(GPIO_REG_READ(GPIO_IN_ADDRESS) & (m))
+
+enum {
+	OW_IDLE,
+	OW_RESET,	// the bus is held low
+	OW_PRESENCE,	// released, sample the presence pulse
+	OW_SLOTS,	// a slot is ending
+};
+
+static struct {
+	volatile uint8_t	state;
+	uint8_t		present;
+	uint8_t		power;
+	uint8_t		low;		// a 0 is being written
+	uint16_t	bit;		// GPIO mask
+	uint16_t	n;		// slots done
+	uint16_t	nwrite;
+	uint16_t	nslots;
+	const uint8_t	*tx;
+	uint8_t		*rx;
+	onewire_done_t	done;
+	void		*arg;
+} ow;
+
+static os_event_t	ow_queue[1];
+static uint8_t		ow_task_set = 0;
+
+static void
+ow_arm(uint32_t us)
+{
+	RTC_REG_WRITE(FRC1_LOAD_ADDRESS, FRC1_TICKS(us));
+}
+
+static void
+ow_finish(void)
+{
+	if (!ow.power) {
+		OW_INPUT(ow.bit);
+		OW_LOW(ow.bit);
+	}
+	TM1_EDGE_INT_DISABLE();
+	ow.state = OW_IDLE;
+	system_os_post(OW_TASK_PRIO, 0, 0);
+}
+
+static void
+ow_intr(void *arg)
+{
+	uint16_t	n;
+
+	RTC_CLR_REG_MASK(FRC1_INT_ADDRESS, FRC1_INT_CLR_MASK);
+
+	switch (ow.state) {
+	case OW_RESET:
+		OW_INPUT(ow.bit);	// allow it to float
+		ow.state = OW_PRESENCE;
+		ow_arm(70);
+		return;
+
+	case OW_PRESENCE:
+		ow.present = !OW_READ(ow.bit);
+		if (!ow.present) {
+			ow_finish();
+			return;
+		}
+		ow.state = OW_SLOTS;
+		ow_arm(410);
+		return;
+
+	case OW_SLOTS:
+		break;
+
+	default:
+		return;
+	}
+
+	if (ow.low) {			// end of a 0 slot
+		OW_HIGH(ow.bit);
+		ow.low = 0;
+		os_delay_us(5);
+	}
+
+	if (ow.n >= ow.nslots) {
+		ow_finish();
+		return;
+	}
+
+	n = ow.n++;
+	if (n < ow.nwrite) {
+		OW_LOW(ow.bit);
+		OW_OUTPUT(ow.bit);
+		if (ow.tx[n >> 3] & (1 << (n & 7))) {
+			os_delay_us(10);
+			OW_HIGH(ow.bit);
+			ow_arm(55);
+		} else {
+			ow.low = 1;
+			ow_arm(65);
+		}
+	} else {
+		OW_OUTPUT(ow.bit);
+		OW_LOW(ow.bit);
+		os_delay_us(3);
+		OW_INPUT(ow.bit);	// let pin float, pull up will raise
+		os_delay_us(10);
+		n -= ow.nwrite;
+		if (OW_READ(ow.bit))
+			ow.rx[n >> 3] |= 1 << (n & 7);
+		ow_arm(53);
+	}
+}
+
+static void
+ow_task(os_event_t *e)
+{
+	if (NULL != ow.done)
+		ow.done(ow.present, ow.arg);
+}
+
+uint8_t
+onewire_async(uint8_t pin, const uint8_t *tx, uint8_t ntx,
+	uint8_t *rx, uint8_t nrx, uint8_t power,
+	onewire_done_t done, void *arg)
+{
+	if (OW_IDLE != ow.state)
+		return 0;
+	if (pin >= NUM_OW || pin_num[pin] > 15)	// not GPIO16
+		return 0;
+
+	if (!ow_task_set) {
+		system_os_task(ow_task, OW_TASK_PRIO, ow_queue, 1);
+		ETS_FRC_TIMER1_INTR_ATTACH(ow_intr, NULL);
+		ow_task_set = 1;
+	}
+
+	ow.bit = BIT(pin_num[pin]);
+	ow.tx = tx;
+	ow.rx = rx;
+	ow.nwrite = ntx * 8;
+	ow.nslots = ow.nwrite + nrx * 8;
+	ow.n = 0;
+	ow.low = 0;
+	ow.power = power;
+	ow.present = 0;
+	ow.done = done;
+	ow.arg = arg;
+	if (nrx)
+		os_memset(rx, 0, nrx);
+
+	OW_INPUT(ow.bit);
+	if (!OW_READ(ow.bit))		// held low, no waiting here
+		return 0;
+
+	RTC_REG_WRITE(FRC1_CTRL_ADDRESS, FRC1_DIV_16 | FRC1_ENABLE);	// edge, one shot
+	ow.state = OW_RESET;
+
+	ets_intr_lock();
+	OW_LOW(ow.bit);
+	OW_OUTPUT(ow.bit);		// drive output low
+	ow_arm(480);
+	TM1_EDGE_INT_ENABLE();
+	ETS_FRC1_INTR_ENABLE();
+	ets_intr_unlock();
+
+	return 1;
+}
+
+uint8_t
+onewire_async_busy(void)
+{
+	return OW_IDLE != ow.state;
+}
+
+#endif // ONEWIRE_ASYNC
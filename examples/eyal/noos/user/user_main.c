@@ -1,10 +1,19 @@
 #include "user_config.h"
+#include "onewire.h"		// ONEWIRE_MULTI
 #include <espconn.h>
+#include "lwip/udp.h"
+#include "netif/etharp.h"
+
+#define UDP_RAW		1	// 1= lwIP udp_sendto() straight from msg[], 0= espconn
 
 static uint32		runCount = 0;
 static uint8		cpu_mhz = 160;
+#if UDP_RAW
+static struct udp_pcb	*pcb = NULL;
+#else
 static struct espconn	espconn;
 static esp_udp		udp;
+#endif
 static uint32		sleep_time;
 static uint32		start_time;
 static uint32		wifi_time;
@@ -12,7 +21,8 @@ static uint32		read_time;
 static uint32		send_time;
 static uint16		vdd;
 static uint16		adc;
-static sint32		temp;
+static sint32		temp[OW_MAX_BUSES];
+static uint8		ntemp = 1;
 
 #define SSID		"SSID"
 #define PASS		"PASSPHRASE"
@@ -28,12 +38,74 @@ static const uint8		SERVER[4] =
 // #define DUMMY_MSG	"show esp-witty times=s0.000,w0.000,c0,t0.000 adc=0.000 vdd=0.000 0.0000"
 #define MSG_EOL		"\n"		// for ncat, or ""
 #define WAIT_TIMEOUT_MS	(5*1000000)	// 5s
+#define FAST_TIMEOUT_MS	(1*1000000)	// 1s for the last AP, then scan
 
 #define RTCMEM_MAGIC		0xf0fafee
 #define RTCMEM_MAGIC_ADDR	64
 #define RTCMEM_COUNT_ADDR	65
 #define RTCMEM_LAST_ADDR	66
 #define RTCMEM_TOTAL_ADDR	67
+#define RTCMEM_AP_ADDR		68	// 2 words, struct ap_cache
+#define RTCMEM_ARP_ADDR		70	// 2 words, struct arp_cache
+
+#define ARP_REFRESH		100	// wakes between real ARPs, in case the server changed
+#define ARP_FRAME_LEN		42
+
+// Each vdd read briefly stops the radio, so frequent reads slow the very
+// association being measured. A longer period disturbs it less but can
+// miss the short TX dips.
+#define DROOP_MS		100	// vdd sampled this often while the radio is on, 0=never
+
+// the AP of the last good connect
+struct ap_cache {
+	uint8	bssid[6];
+	uint8	channel;	// 0 = scan
+	uint8	check;		// ~channel
+};
+static struct ap_cache	ap_cache;
+static int		fast = 0;	// this connect uses ap_cache
+
+// the MAC of the next hop (the server or the gateway) from the last send
+struct arp_cache {
+	uint8	mac[6];
+	uint8	uses;		// wakes since it was learnt
+	uint8	check;		// ~sum of the above
+};
+static struct arp_cache	arp_cache;
+static int		arp_used = 0;	// put in this wake
+
+#if DROOP_MS > 0
+// vdd under the radio load, from the WiFi start to the send
+static struct {
+	uint32	start;
+	uint32	min_time;	// us since start
+	uint32	sum;
+	uint16	min;		// fp3
+	uint16	n;
+} droop;
+static os_timer_t	droop_timer[1];
+
+static void
+droop_sample(void *arg)
+{
+	uint16	v = read_vdd();
+
+	if (0 == droop.n || v < droop.min) {
+		droop.min = v;
+		droop.min_time = time_now() - droop.start;
+	}
+	droop.sum += v;
+	++droop.n;
+}
+
+static void
+droop_start(void)
+{
+	droop.start = time_now();
+	os_timer_setfn(droop_timer, (os_timer_func_t *)droop_sample, NULL);
+	os_timer_arm(droop_timer, DROOP_MS, 1);
+}
+#endif
 
 static void
 die(void)
@@ -64,8 +136,9 @@ die(void)
 static char *
 format_msg(void)
 {
-	static uint8	msg[80];
+	static uint8	msg[160];
 	uint32	v;
+	uint8	i;
 
 #ifdef DUMMY_MSG
 	strncpy (msg, DUMMY_MSG, sizeof(msg));
@@ -85,7 +158,18 @@ format_msg(void)
 	FMSG (",t",    3, (time_now()-start_time)/1000);
 	FMSG (" adc=", 3, adc);
 	FMSG (" vdd=", 3, vdd);
-	FMSG (" ",     4, temp);
+#if DROOP_MS > 0
+	os_timer_disarm(droop_timer);
+	if (droop.n > 0) {
+		FMSG (" droop=m", 3, droop.min);
+		FMSG (",a",       3, droop.sum / droop.n);
+		FMSG (",t",       3, droop.min_time/1000);
+		FMSG (",n",       0, droop.n);
+	}
+#endif
+	FMSG (" ",     4, temp[0]);
+	for (i = 1; i < ntemp; ++i)
+		FMSG (",", 4, temp[i]);
 #endif
 
 	logPrintf("msg='%s'\n", msg);
@@ -96,12 +180,119 @@ format_msg(void)
 }
 #undef FMSG
 
+////////////////////////////// ARP /////////////////////////
+
+static uint8
+arp_check(const struct arp_cache *c)
+{
+	const uint8	*b = (const uint8 *)c;
+	uint8		sum = 0;
+	int		i;
+
+	for (i = 0; i < sizeof(*c) - 1; ++i)	// all but check
+		sum += b[i];
+	return ~sum;
+}
+
+static void
+arp_forget(void)
+{
+	os_memset(&arp_cache, 0, sizeof(arp_cache));	// check is wrong
+	system_rtc_mem_write (RTCMEM_ARP_ADDR, &arp_cache, sizeof(arp_cache));
+}
+
+// where the server is reached through
+static struct netif *
+next_hop(ip_addr_t *hop)
+{
+	struct netif	*netif = netif_default;
+
+	IP4_ADDR(hop, SERVER[0], SERVER[1], SERVER[2], SERVER[3]);
+	if (NULL == netif)
+		return NULL;
+	if (!ip_addr_netcmp(hop, &netif->ip_addr, &netif->netmask))
+		ip_addr_copy(*hop, netif->gw);
+	return netif;
+}
+
+// The SDK lwIP has no static ARP entries, so the reply the server gave
+// last time is made up and fed in as if it had just arrived. When this
+// does not take, lwIP ARPs as usual.
+static void
+arp_restore(void)
+{
+	struct netif	*netif;
+	ip_addr_t	hop, *ip;
+	struct eth_addr	*eth;
+	struct pbuf	*p;
+	uint8		*f;
+
+	system_rtc_mem_read (RTCMEM_ARP_ADDR, &arp_cache, sizeof(arp_cache));
+	if (!fast || arp_cache.check != arp_check(&arp_cache)
+	    || arp_cache.uses >= ARP_REFRESH)
+		return;
+
+	netif = next_hop(&hop);
+	if (NULL == netif || NULL == netif->input)
+		return;
+	p = pbuf_alloc(PBUF_RAW, ARP_FRAME_LEN, PBUF_RAM);
+	if (NULL == p)
+		return;
+
+	f = p->payload;
+	os_memcpy(f+0, netif->hwaddr, 6);	// ethernet, to us
+	os_memcpy(f+6, arp_cache.mac, 6);	// from the server
+	f[12] = 0x08; f[13] = 0x06;		// ARP
+	f[14] = 0x00; f[15] = 0x01;		// hardware ethernet
+	f[16] = 0x08; f[17] = 0x00;		// protocol IPv4
+	f[18] = 6;    f[19] = 4;
+	f[20] = 0x00; f[21] = 0x02;		// reply
+	os_memcpy(f+22, arp_cache.mac, 6);
+	os_memcpy(f+28, &hop, 4);
+	os_memcpy(f+32, netif->hwaddr, 6);
+	os_memcpy(f+38, &netif->ip_addr, 4);
+	if (ERR_OK != netif->input(p, netif))
+		pbuf_free(p);
+
+	arp_used = etharp_find_addr(netif, &hop, &eth, &ip) >= 0;
+	if (arp_used)
+		logPrintf("ARP entry put in, %d wakes old\n", arp_cache.uses);
+	else
+		errPrintf("ARP entry not taken, ARPing\n");
+}
+
+// after the send, keep the MAC ARP found for the next wakes
+static void
+arp_save(void)
+{
+	struct netif	*netif;
+	ip_addr_t	hop, *ip;
+	struct eth_addr	*eth;
+
+	if (arp_used)
+		++arp_cache.uses;
+	else {
+		netif = next_hop(&hop);
+		if (NULL == netif || etharp_find_addr(netif, &hop, &eth, &ip) < 0) {
+			logPrintf("no ARP entry to keep\n");
+			return;
+		}
+		os_memcpy(arp_cache.mac, eth->addr, sizeof(arp_cache.mac));
+		arp_cache.uses = 0;
+	}
+	arp_cache.check = arp_check(&arp_cache);
+	system_rtc_mem_write (RTCMEM_ARP_ADDR, &arp_cache, sizeof(arp_cache));
+}
+
 static os_timer_t	send_delay_timer[1];
 static void
 send_delay(void *arg)
 {
 	os_timer_disarm(send_delay_timer);
+#if !UDP_RAW
 	espconn_delete(&espconn);	// needed?
+#endif
+	arp_save();
 
 	die();
 }
@@ -167,6 +358,99 @@ set_ap (int force)
 	return 1;
 }
 
+static void
+ap_forget (void)
+{
+	fast = 0;
+	ap_cache.channel = 0;
+	ap_cache.check = 0;
+	system_rtc_mem_write (RTCMEM_AP_ADDR, &ap_cache, sizeof(ap_cache));
+	arp_forget();		// a new network maybe
+}
+
+// connect straight to the AP we had last time, no scan
+static int
+set_ap_fast (void)
+{
+	struct station_config sta_conf[1];
+
+	system_rtc_mem_read (RTCMEM_AP_ADDR, &ap_cache, sizeof(ap_cache));
+	if (0 == ap_cache.channel || (uint8)~ap_cache.channel != ap_cache.check)
+		return 0;
+
+	logPrintf("fast connect ch %d\n", ap_cache.channel);
+	memset (sta_conf, 0, sizeof(sta_conf));
+	sta_conf->bssid_set = 1;
+	os_memcpy(sta_conf->bssid, ap_cache.bssid, sizeof(sta_conf->bssid));
+	os_sprintf(sta_conf->ssid, SSID);
+	os_sprintf(sta_conf->password, PASS);
+
+	wifi_station_disconnect();
+	wifi_set_channel(ap_cache.channel);
+	if (!wifi_station_set_config_current(sta_conf)) {	// not in flash
+		errPrintf("wifi_station_set_config_current failed\n");
+		return 0;
+	}
+	wifi_station_connect();
+
+	return 1;
+}
+
+static void
+wifi_event (System_Event_t *evt)
+{
+	Event_StaMode_Connected_t *c = &evt->event_info.connected;
+
+	if (EVENT_STAMODE_CONNECTED != evt->event)
+		return;
+
+	logPrintf("connected ch %d\n", c->channel);
+	if (c->channel == ap_cache.channel && (uint8)~c->channel == ap_cache.check
+	    && 0 == os_memcmp(c->bssid, ap_cache.bssid, sizeof(ap_cache.bssid)))
+		return;
+
+	os_memcpy(ap_cache.bssid, c->bssid, sizeof(ap_cache.bssid));
+	ap_cache.channel = c->channel;
+	ap_cache.check = ~c->channel;
+	system_rtc_mem_write (RTCMEM_AP_ADDR, &ap_cache, sizeof(ap_cache));
+}
+
+#if UDP_RAW
+static void
+setup_connection(void)
+{
+	if (NULL != pcb)
+		return;
+
+	logPrintf("connect to %d.%d.%d.%d:%d\n",
+		SERVER[0], SERVER[1], SERVER[2], SERVER[3], PORT);
+	pcb = udp_new();
+	if (NULL == pcb) {
+		errPrintf("udp_new failed\n");
+		die();
+	}
+}
+
+// no copy, the pbuf points at the message, lwIP adds the headers in front
+static int
+send_raw(char *msg, uint16 len)
+{
+	struct pbuf	*p;
+	ip_addr_t	addr;
+	err_t		err;
+
+	p = pbuf_alloc(PBUF_TRANSPORT, len, PBUF_REF);
+	if (NULL == p)
+		return 0;
+	p->payload = msg;
+
+	IP4_ADDR(&addr, SERVER[0], SERVER[1], SERVER[2], SERVER[3]);
+	err = udp_sendto(pcb, p, &addr, PORT);
+	pbuf_free(p);
+
+	return ERR_OK == err;
+}
+#else
 static void
 setup_connection(void)
 {
@@ -191,6 +475,7 @@ setup_connection(void)
 		die();
 	}
 }
+#endif
 
 static void
 have_wifi(void)
@@ -201,13 +486,22 @@ have_wifi(void)
 	logPrintf("have_wifi after %dus\n", wifi_time);
 
 	setup_connection();
+	arp_restore();
 
 	psent = format_msg();
 	send_time = time_now();
+#if UDP_RAW
+	if (!send_raw(psent, strlen(psent))) {
+		errPrintf("udp_sendto failed\n");
+		die();
+	}
+	udp_sent_callback(NULL);	// it is queued, no callback to wait for
+#else
 	if (espconn_sendto(&espconn, psent, strlen(psent))) {
 		errPrintf("espconn_sendto failed\n");
 		die();
 	}
+#endif
 }
 
 ////////////////////////////// get wifi /////////////////////////
@@ -217,6 +511,7 @@ wifi_reset()
 {
 	errPrintf ("wifi_reset ###\n");
 
+	ap_forget();
 	wifi_station_disconnect();
 	wifi_set_opmode(STATION_MODE);
 	if (!set_ap(1))
@@ -266,7 +561,7 @@ have_temp(void)
 	read_time = wifi_time - read_time;
 
 	tries = 1;
-	timeout = wifi_time + WAIT_TIMEOUT_MS;
+	timeout = wifi_time + (fast ? FAST_TIMEOUT_MS : WAIT_TIMEOUT_MS);
 	os_timer_setfn(wait_for_wifi_timer, (os_timer_func_t *)wait_for_wifi, NULL);
 	os_timer_arm(wait_for_wifi_timer, 1, 1);	// 1ms, rearmed
 }
@@ -274,31 +569,116 @@ have_temp(void)
 ////////////////////////////// read temp /////////////////////////
 
 static os_timer_t	wait_for_temp_timer[1];
+
+#if ONEWIRE_MULTI
+// all buses at once, a slot costs the same on N buses as on one
+static void
+wait_for_temps(void *arg)
+{
+	static uint8	tries = 0;
+
+	os_timer_disarm(wait_for_temp_timer);
+	if (ds18b20_multi_read(env->ow_addrs, temp) < ntemp && ++tries < 2) {
+		// a conversion was just started, come back when it is done
+		os_timer_arm(wait_for_temp_timer,
+			ds18b20_conversion_ms(DS18B20_RESOLUTION), 1);
+		return;
+	}
+	have_temp();
+}
+#endif
+
+#if ONEWIRE_ASYNC
+// the bus is driven from the FRC1 interrupt, we only hear when it is done
+static void
+got_temp(sint32 t)
+{
+	static uint8	tries = 0;
+
+	temp[0] = t;
+	if (BAD_RET == t && ++tries < 3) {
+		// a conversion was just started, come back when it is done
+		os_timer_arm(wait_for_temp_timer,
+			ds18b20_conversion_ms(DS18B20_RESOLUTION), 0);
+		return;
+	}
+	have_temp();
+}
+
+static void
+start_temp(void *arg)
+{
+	if (!ds18b20_read_async(env->ow_pin, env->ow_addrs[0], got_temp)) {
+		logPrintf("no onewire on gpio %d\n", env->ow_pin);
+		temp[0] = 850000;
+		have_temp();
+	}
+}
+#else
 static void
 wait_for_temp(void *arg)
 {
 	if (!ds18b20_setup(env->ow_pin))
 		return;
-	temp = ds18b20_read(env->ow_addrs[0]);
-	if (BAD_RET != temp) {
-		os_timer_disarm(wait_for_temp_timer);
+	temp[0] = ds18b20_read(env->ow_addrs[0]);
+	os_timer_disarm(wait_for_temp_timer);
+	if (BAD_RET != temp[0])
 		have_temp();
-	}
+	else	// a conversion was just started, come back when it is done
+		os_timer_arm(wait_for_temp_timer,
+			ds18b20_conversion_ms(DS18B20_RESOLUTION), 1);
 }
+#endif
 
 static void
 read_temp (void)
 {
 	read_time = time_now();
+
+#if ONEWIRE_MULTI
+	if (OW_NO_BUS != env->ow_buses[0]) {
+		uint8	i;
+
+		if (!(ntemp = ds18b20_multi_setup(env->ow_buses)) &&
+		    !(ntemp = ds18b20_multi_setup(env->ow_buses))) {
+			logPrintf("no onewire on gpio %d...\n", env->ow_buses[0]);
+			ntemp = 1;
+			temp[0] = 850000;	// failed twice
+			have_temp();
+			return;
+		}
+		if (1 == runCount)
+			for (i = 0; i < ntemp; ++i) {
+				(void)ds18b20_setup(env->ow_buses[i]);
+				(void)ds18b20_set_resolution(env->ow_addrs[i], DS18B20_RESOLUTION);
+			}
+
+		os_timer_setfn(wait_for_temp_timer, (os_timer_func_t *)wait_for_temps, NULL);
+		os_timer_arm(wait_for_temp_timer, 1, 1);
+		return;
+	}
+#endif
+
+#if ONEWIRE_ASYNC
+	if (1 == runCount && ds18b20_setup(env->ow_pin))
+		(void)ds18b20_set_resolution(env->ow_addrs[0], DS18B20_RESOLUTION);
+
+	os_timer_setfn(wait_for_temp_timer, (os_timer_func_t *)start_temp, NULL);
+	start_temp(NULL);
+#else
 	if (!ds18b20_setup(env->ow_pin) && !ds18b20_setup(env->ow_pin)) {
 		logPrintf("no onewire on gpio %d\n", env->ow_pin);
-		temp = 850000;	// failed twice
+		temp[0] = 850000;	// failed twice
 		have_temp();
 		return;
 	}
 
+	if (1 == runCount)	// first run, the device keeps it in EEPROM
+		(void)ds18b20_set_resolution(env->ow_addrs[0], DS18B20_RESOLUTION);
+
 	os_timer_setfn(wait_for_temp_timer, (os_timer_func_t *)wait_for_temp, NULL);
 	os_timer_arm(wait_for_temp_timer, 1, 1);
+#endif
 }
 
 void
@@ -316,6 +696,7 @@ set_rtcmem(void)
 		system_rtc_mem_write (RTCMEM_TOTAL_ADDR, &v, 4);
 		v = RTCMEM_MAGIC;
 		system_rtc_mem_write (RTCMEM_MAGIC_ADDR, &v, 4);
+		arp_forget();
 	} else {
 		system_rtc_mem_read (RTCMEM_COUNT_ADDR, &v, 4);
 		runCount = ++v;
@@ -344,8 +725,14 @@ test_station(void)
 	logPrintf("DHCPC is %s\n",
 		DHCP_STARTED == wifi_station_dhcpc_status () ? "on" : "off");
 
+#if DROOP_MS > 0
+	droop_start();
+#endif
 	(void)set_ip(0);	// start wifi in the background
 
+	wifi_set_event_handler_cb(wifi_event);
+	fast = set_ap_fast();
+
 	read_temp();
 }
 